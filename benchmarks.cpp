@@ -0,0 +1,714 @@
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QMainWindow>
+#include <QMap>
+#include <QTextStream>
+#include <QUrl>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+#include <QVariantMap>
+#include <QWidget>
+#include <QWindow>
+#include <functional>
+#include <limits>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "benchmarks.h"
+#include "frametimings.h"
+#include "ipcjson.h"
+#include "manager.h"
+#include "mpvwidget.h"
+#include "playlist.h"
+#include "platform/unify.h"
+
+typedef int (*BenchmarkFunction)(QTextStream &out, int size);
+
+struct Benchmark {
+    BenchmarkFunction function;
+    int defaultSize;
+    const char *description;
+};
+
+static int itemMemory(QTextStream &out, int size);
+static int playlistStore(QTextStream &out, int size);
+static int journalReplay(QTextStream &out, int size);
+static int frameVisibility(QTextStream &out, int size);
+static int timingHistogram(QTextStream &out, int size);
+static int ipcThroughput(QTextStream &out, int size);
+static int ipcWireFormat(QTextStream &out, int size);
+static int ipcParse(QTextStream &out, int size);
+
+static const QMap<QString, Benchmark> benchmarks {
+    { "ipc-parse", { ipcParse, 1000000, "taking apart good, cut off and garbled commands" } },
+    { "ipc-throughput", { ipcThroughput, 200000, "commands per second through the mpv socket server" } },
+    { "ipc-wire-format", { ipcWireFormat, 200000, "property changes through an mpv connection as json and as cbor" } },
+    { "frame-visibility", { frameVisibility, 1000000, "drawing frames only while the window is seen" } },
+    { "item-memory", { itemMemory, 200000, "heap bytes per playlist item" } },
+    { "journal-replay", { journalReplay, 1000, "replaying a playlist journal twice" } },
+    { "playlist-store", { playlistStore, 200000, "saving and loading a playlist" } },
+    { "timing-histogram", { timingHistogram, 1000000, "counting frame timings into buckets" } },
+};
+
+
+
+QStringList Benchmarks::names()
+{
+    return benchmarks.keys();
+}
+
+bool Benchmarks::exists(const QString &name)
+{
+    return benchmarks.contains(name);
+}
+
+int Benchmarks::run(const QString &name, int size)
+{
+    QTextStream out(stdout);
+    if (!benchmarks.contains(name)) {
+        out << "unknown benchmark " << name << ", try one of: "
+            << names().join(", ") << "\n";
+        return 1;
+    }
+    Benchmark b = benchmarks.value(name);
+    if (size <= 0)
+        size = b.defaultSize;
+    out << name << ": " << b.description << " (size " << size << ")\n";
+    return b.function(out, size);
+}
+
+
+
+// The layout Item had before it was compacted, filled in the way loading a
+// playlist from JSON did: every item got its own copy of every key and url.
+struct LegacyItem {
+    QUuid uuid;
+    QUuid playlistUuid;
+    QUrl url;
+    QVariantMap metadata;
+    int originalPosition = 0;
+    int queuePosition = 0;
+    int extraPlayTimes = 0;
+    bool hidden = false;
+};
+
+static QString samplePath(int i)
+{
+    return QString("/home/user/Music/Artist %1/Album %2/%3 - Track %3.flac")
+            .arg(i / 1000).arg(i / 20).arg(i % 20 + 1);
+}
+
+static QVariantMap sampleMetadata(int i)
+{
+    // fromLatin1 makes fresh key strings, like the JSON parser does.
+    QVariantMap m;
+    m.insert(QString::fromLatin1("title"), QString("Track %1").arg(i));
+    m.insert(QString::fromLatin1("artist"), QString("Artist %1").arg(i / 1000));
+    m.insert(QString::fromLatin1("album"), QString("Album %1").arg(i / 20));
+    m.insert(QString::fromLatin1("track"), QString::number(i % 20 + 1));
+    m.insert(QString::fromLatin1("genre"), QString("Genre %1").arg(i % 7));
+    return m;
+}
+
+static int itemMemory(QTextStream &out, int size)
+{
+    if (Platform::heapInUse() < 0) {
+        out << "  heap statistics are not available on this platform\n";
+        return 1;
+    }
+    QVector<QSharedPointer<LegacyItem>> legacy;
+    legacy.reserve(size);
+    qint64 base = Platform::heapInUse();
+    for (int i = 0; i < size; ++i) {
+        auto item = QSharedPointer<LegacyItem>::create();
+        item->uuid = QUuid::createUuid();
+        item->url = QUrl::fromLocalFile(samplePath(i));
+        item->metadata = sampleMetadata(i);
+        legacy.append(item);
+    }
+    qint64 before = Platform::heapInUse() - base;
+    legacy.clear();
+    legacy.squeeze();
+
+    QVector<QSharedPointer<Item>> items;
+    items.reserve(size);
+    base = Platform::heapInUse();
+    for (int i = 0; i < size; ++i) {
+        auto item = QSharedPointer<Item>::create(QUrl::fromLocalFile(samplePath(i)));
+        item->setMetadata(sampleMetadata(i));
+        items.append(item);
+    }
+    qint64 after = Platform::heapInUse() - base;
+
+    out << QString("  before: %1 bytes per item\n").arg(double(before) / size, 0, 'f', 1);
+    out << QString("  after:  %1 bytes per item\n").arg(double(after) / size, 0, 'f', 1);
+    return 0;
+}
+
+static int playlistStore(QTextStream &out, int size)
+{
+    PlaylistCollection::getSingleton();
+    QSharedPointer<Playlist> playlist(new Playlist);
+    for (int i = 0; i < size; ++i)
+        playlist->addItem(QUrl::fromLocalFile(samplePath(i)))->setMetadata(sampleMetadata(i));
+
+    // Both formats go through memory only, so disk speed doesn't count.
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray json = QJsonDocument(QJsonArray::fromVariantList({ playlist->toVMap() })).toJson();
+    qint64 jsonSave = timer.restart();
+    QSharedPointer<Playlist> fromJson(new Playlist);
+    fromJson->fromVMap(QJsonDocument::fromJson(json).array().toVariantList().value(0).toMap());
+    qint64 jsonLoad = timer.restart();
+    QByteArray binary = playlist->toBinary();
+    qint64 binarySave = timer.restart();
+    QSharedPointer<Playlist> fromBinary(new Playlist);
+    fromBinary->fromBinary(binary);
+    qint64 binaryLoad = timer.restart();
+
+    out << QString("  json:   save %1 ms, load %2 ms, %3 bytes\n")
+           .arg(jsonSave).arg(jsonLoad).arg(json.size());
+    out << QString("  binary: save %1 ms, load %2 ms, %3 bytes\n")
+           .arg(binarySave).arg(binaryLoad).arg(binary.size());
+    return 0;
+}
+
+
+
+// Records edits to a playlist, then replays them over the saved playlist
+// twice.  Both passes must land on the edited playlist, as records that
+// were already saved are replayed again after a crash.
+static int journalReplay(QTextStream &out, int size)
+{
+    size = qMax(size, 8);
+    QSharedPointer<Playlist> live(new Playlist("journal"));
+    for (int i = 0; i < size; ++i)
+        live->addItem(QUrl::fromLocalFile(samplePath(i)));
+    QByteArray saved = live->toBinary();
+
+    QList<QByteArray> records;
+    PlaylistJournal::setSink([&records](const QByteArray &record) {
+        records.append(record);
+    });
+    live->setJournaled(true);
+    {
+        PlaylistJournal::Batch batch;
+        for (int i = 0; i < 10; ++i)
+            live->addItem(QUrl::fromLocalFile(samplePath(size + i)));
+    }
+    auto clone = live->addItemClone(live->itemAt(0));
+    clone->setMetadata(sampleMetadata(0));
+    live->journalItem(clone.data());
+    live->removeItem(live->itemAt(1)->uuid());
+    live->moveItems(live->itemAt(0)->uuid(), { live->itemLast() });
+    live->replaceItem(live->itemAt(2)->uuid(), { QUrl::fromLocalFile(samplePath(size + 10)),
+                                                 QUrl::fromLocalFile(samplePath(size + 11)) });
+    live->setTitle("journal, edited");
+    live->setNowPlaying(live->itemAt(3)->uuid());
+    live->setJournaled(false);
+    PlaylistJournal::setSink(PlaylistJournal::Sink());
+    QByteArray expected = live->toBinary();
+
+    QSharedPointer<Playlist> restored(new Playlist);
+    restored->fromBinary(saved);
+    QList<QSharedPointer<Playlist>> tabs { restored };
+    QList<QSharedPointer<Playlist>> backup;
+    int failures = 0;
+    for (int pass = 1; pass <= 2; ++pass) {
+        for (const QByteArray &record : records)
+            PlaylistJournal::replay(record, tabs, backup);
+        bool same = tabs.count() == 1 && tabs.first()->toBinary() == expected;
+        out << QString("  pass %1: %2 records, %3\n").arg(pass).arg(records.count())
+               .arg(same ? "matches" : "differs from the edited playlist");
+        if (!same)
+            ++failures;
+    }
+    return failures ? 1 : 0;
+}
+
+
+
+static bool waitFor(int msec, const std::function<bool()> &done)
+{
+    QElapsedTimer waited;
+    waited.start();
+    while (!done() && waited.elapsed() < msec)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    return done();
+}
+
+// Puts a player window, playing a generated video, through the states the
+// renderers skip frames in.  Frames must only be drawn while it is shown.
+// The check for this is timed as well, as it is made for every frame.
+static int frameVisibility(QTextStream &out, int size)
+{
+    QMainWindow window;
+    window.resize(320, 240);
+    MpvObject mpv(nullptr, "benchmark");
+    mpv.setHostWindow(&window);
+    mpv.setWidgetType(Helpers::GlCbWidget);
+    auto widget = qobject_cast<MpvGlWidget*>(mpv.mpvWidget());
+    if (!widget) {
+        out << "  no gl widget could be made\n";
+        return 1;
+    }
+    mpv.urlOpen(QUrl("av://lavfi:testsrc=size=320x240:rate=60"));
+
+    int failures = 0;
+    auto exposed = [&window]() {
+        return window.windowHandle() && window.windowHandle()->isExposed();
+    };
+    auto expect = [&](const QString &state, bool drawn) {
+        bool shows = MpvWidgetInterface::windowShowsFrames(widget);
+        out << QString("  %1: frames %2\n").arg(state, shows ? "drawn" : "skipped");
+        if (shows != drawn)
+            ++failures;
+    };
+    // Plays for a while, and checks which of the counters moved.  One frame
+    // may still be on its way when the window goes.
+    auto play = [&](const QString &state, bool drawn) {
+        quint64 rendered = widget->renderedFrames();
+        quint64 skipped = widget->skippedFrames();
+        waitFor(1000, []() { return false; });
+        quint64 newlyRendered = widget->renderedFrames() - rendered;
+        quint64 newlySkipped = widget->skippedFrames() - skipped;
+        out << QString("  %1: %2 frames rendered, %3 skipped\n")
+               .arg(state).arg(newlyRendered).arg(newlySkipped);
+        if (drawn ? newlyRendered == 0 : (newlyRendered > 1 || newlySkipped == 0))
+            ++failures;
+    };
+
+    expect("never shown", false);
+    window.show();
+    if (!waitFor(5000, [&]() { return exposed() && widget->renderedFrames() > 0; })) {
+        out << "  shown: nothing was drawn, maybe there is no OpenGL or the "
+               "window system never exposed it, not checked\n";
+        return failures ? 1 : 0;
+    }
+    expect("shown", true);
+    play("shown", true);
+
+    QElapsedTimer timer;
+    timer.start();
+    int drawn = 0;
+    for (int i = 0; i < size; ++i)
+        drawn += MpvWidgetInterface::windowShowsFrames(widget);
+    qint64 elapsed = timer.nsecsElapsed();
+    out << QString("  %1 ns per check, %2 of %3 drawn\n")
+           .arg(elapsed / qMax(size, 1)).arg(drawn).arg(size);
+
+    window.showMinimized();
+    waitFor(1000, [&]() { return !exposed(); });
+    expect("minimized", false);
+    play("minimized", false);
+    window.showNormal();
+    waitFor(1000, exposed);
+    play("shown again", true);
+    window.hide();
+    waitFor(1000, [&]() { return !exposed(); });
+    expect("hidden", false);
+    play("hidden", false);
+    return failures ? 1 : 0;
+}
+
+
+
+// Checks that durations on either side of each bucket edge land in the
+// buckets they should, then times adding to the histogram, as it is done
+// several times a frame.
+static int timingHistogram(QTextStream &out, int size)
+{
+    int failures = 0;
+    auto expect = [&](qint64 usec, int wanted) {
+        TimingHistogram h;
+        h.add(usec);
+        if (h.bucket(wanted) == 1)
+            return;
+        out << QString("  %1 us did not land in bucket %2\n").arg(usec).arg(wanted);
+        ++failures;
+    };
+    expect(0, 0);
+    for (int b = 0; b < TimingHistogram::bucketCount - 1; ++b) {
+        qint64 limit = TimingHistogram::bucketLimit(b);
+        expect(limit - 1, b);
+        expect(limit, b + 1);
+    }
+    expect(std::numeric_limits<qint64>::max() / 2, TimingHistogram::bucketCount - 1);
+    out << QString("  bucket edges: %1\n").arg(failures ? "wrong" : "right");
+
+    TimingHistogram h;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < size; ++i)
+        h.add(qint64(i) * 7919 % 600000);
+    qint64 elapsed = timer.nsecsElapsed();
+    out << QString("  %1 ns per add, 95% < %2 ms\n")
+           .arg(elapsed / qMax(size, 1)).arg(h.percentile(0.95));
+    return failures ? 1 : 0;
+}
+
+
+
+// Writes commands to the server in chunks that don't line up with them, the
+// way a busy client's writes get cut up, then waits for every reply.
+class IpcClient : public QThread {
+public:
+    IpcClient(const QString &server, const QString &command, int commands)
+        : server(server), command(command), commands(commands) {}
+    qint64 elapsed = -1;
+    int replies = 0;
+    int failed = 0;
+
+protected:
+    void run()
+    {
+        static const int chunkSize = 4093;
+        QByteArray payload;
+        for (int i = 0; i < commands; ++i)
+            payload.append(QString("{\"command\":%1,\"request_id\":%2}\n")
+                           .arg(command).arg(i).toUtf8());
+
+        QLocalSocket socket;
+        socket.connectToServer(server);
+        if (!socket.waitForConnected(1000))
+            return;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < payload.size(); i += chunkSize) {
+            socket.write(payload.constData() + i, qMin(chunkSize, payload.size() - i));
+            socket.waitForBytesWritten(1000);
+        }
+        IpcFrameBuffer frames;
+        while (replies < commands && socket.waitForReadyRead(5000)) {
+            frames.readFrom(&socket);
+            QByteArray frame;
+            while (frames.takeFrame(frame)) {
+                if (!frame.contains("\"error\":\"success\""))
+                    ++failed;
+                ++replies;
+            }
+        }
+        elapsed = timer.elapsed();
+    }
+
+private:
+    QString server;
+    QString command;
+    int commands;
+};
+
+static int ipcThroughput(QTextStream &out, int size)
+{
+    // The server runs here, on the gui thread, as it does in the player.  It
+    // gets an mpv instance of its own and a socket name that no running
+    // player uses.  client_name is answered straight away, get_property
+    // makes the round trip through mpv.
+    QString name = QString("mpc-qt-benchmark-%1").arg(QCoreApplication::applicationPid());
+    MpvObject mpv(nullptr, "benchmark");
+    PlaybackManager manager;
+    MpvServer server(nullptr, name);
+    server.setPlaybackManger(&manager);
+    server.setMpvObject(&mpv);
+    server.listen();
+
+    const QList<QPair<QString, QString>> commands {
+        { "local:", "[\"client_name\"]" },
+        { "mpv:  ", "[\"get_property\",\"volume\"]" }
+    };
+    for (auto &command : commands) {
+        IpcClient client(server.fullServerName(), command.second, size);
+        QEventLoop loop;
+        QObject::connect(&client, &QThread::finished, &loop, &QEventLoop::quit);
+        client.start();
+        loop.exec();
+        client.wait();
+
+        if (client.elapsed < 0) {
+            out << "  could not connect to " << name << "\n";
+            return 1;
+        }
+        double seconds = qMax<qint64>(client.elapsed, 1) / 1000.0;
+        out << QString("  %1 %2 ms, %3 commands/s, %4 replies, %5 failed\n")
+               .arg(command.first)
+               .arg(client.elapsed)
+               .arg(qRound64(size / seconds))
+               .arg(client.replies).arg(client.failed);
+        if (client.replies != size || client.failed)
+            return 1;
+    }
+    return 0;
+}
+
+
+
+// CPU time the calling thread has used, in nanoseconds.
+static qint64 threadCpuTime()
+{
+#if defined(Q_OS_WIN)
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+        return 0;
+    auto ticks = [](const FILETIME &t) {
+        return (qint64(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Observes time-pos in one wire format and reads the changes until the last
+// one arrives, taking each apart the way a client would.  Changes the server
+// coalesced never arrive, so it only checks that the values go up.
+class IpcEventReader : public QThread {
+public:
+    IpcEventReader(const QString &server, IpcWire::Format format, double last)
+        : server(server), format(format), last(last) {}
+    QAtomicInt observing;
+    qint64 elapsed = -1;
+    qint64 cpuTime = 0;
+    qint64 bytes = 0;
+    int received = 0;
+    int broken = 0;
+
+protected:
+    void run()
+    {
+        QLocalSocket socket;
+        socket.connectToServer(server);
+        if (!socket.waitForConnected(1000))
+            return;
+        IpcFrameBuffer frames;
+        QByteArray frame;
+        auto nextFrame = [&]() {
+            while (!frames.takeFrame(frame)) {
+                if (!socket.waitForReadyRead(5000))
+                    return false;
+                frames.readFrom(&socket);
+            }
+            return true;
+        };
+        auto send = [&](const QVariantList &command, IpcWire::Format sendFormat) {
+            QVariantMap map { { "command", command }, { "request_id", 1 } };
+            socket.write(IpcWire::message(map, sendFormat));
+            socket.flush();
+        };
+        if (format == IpcWire::Cbor) {
+            send({ "set_wire_format", "cbor" }, IpcWire::Json);
+            if (!nextFrame())
+                return;
+            frames.setFraming(IpcFrameBuffer::LengthFraming);
+        }
+        send({ "observe_property", 1, "time-pos" }, format);
+
+        QElapsedTimer timer;
+        qint64 cpuStart = 0;
+        double previous = -1;
+        while (nextFrame()) {
+            QVariantMap map;
+            if (!IpcWire::decode(frame, format, map)) {
+                ++broken;
+                continue;
+            }
+            // The last value from a previous run comes before the reply to
+            // observe_property, and mpv's own for time-pos, while nothing
+            // plays, is an error.  Neither is counted.
+            if (!map.contains("event")) {
+                timer.start();
+                cpuStart = threadCpuTime();
+                observing.storeRelease(1);
+                continue;
+            }
+            if (!observing.loadAcquire() || map.contains("error"))
+                continue;
+            double data = map.value("data").toDouble();
+            if (data <= previous)
+                ++broken;
+            previous = data;
+            bytes += frame.size();
+            ++received;
+            if (data >= last)
+                break;
+        }
+        if (observing.loadAcquire()) {
+            cpuTime = threadCpuTime() - cpuStart;
+            elapsed = timer.elapsed();
+        }
+    }
+
+private:
+    QString server;
+    IpcWire::Format format;
+    double last;
+};
+
+static int ipcWireFormat(QTextStream &out, int size)
+{
+    // A playing file mostly sends numbers, so that is what is measured.  The
+    // changes are handed to a real server as if mpv had sent them, and go
+    // out through MpvConnection's queue.  A fresh server gives the first
+    // property observed subscription 1.
+    QString name = QString("mpc-qt-benchmark-%1").arg(QCoreApplication::applicationPid());
+    MpvObject mpv(nullptr, "benchmark");
+    PlaybackManager manager;
+    MpvServer server(nullptr, name);
+    server.setPlaybackManger(&manager);
+    server.setMpvObject(&mpv);
+    server.listen();
+
+    int failures = 0;
+    for (IpcWire::Format format : { IpcWire::Json, IpcWire::Cbor }) {
+        IpcEventReader reader(server.fullServerName(), format, (size - 1) * 0.25);
+        reader.start();
+        if (!waitFor(5000, [&reader]() { return reader.observing.loadAcquire() != 0; })) {
+            out << "  could not observe time-pos on " << name << "\n";
+            reader.wait();
+            return 1;
+        }
+
+        // Each change is given the chance to be flushed before the next, as
+        // mpv's would be.  Those that meet a full socket are coalesced.
+        qint64 cpuStart = threadCpuTime();
+        MpvEventBatch batch;
+        batch.entries.resize(1);
+        batch.entries[0].kind = MpvEventBatch::PropertyChange;
+        batch.entries[0].userData = 1;
+        batch.entries[0].name = "time-pos";
+        for (int i = 0; i < size; ++i) {
+            // The batch is shared with the copies already queued, so each
+            // change is made on a copy of its own.
+            batch.entries[0].value = i * 0.25;
+            emit mpv.controller()->eventBatch(batch);
+            QCoreApplication::processEvents();
+        }
+        waitFor(10000, [&reader]() { return reader.isFinished(); });
+        reader.wait();
+        qint64 serverCpu = threadCpuTime() - cpuStart;
+
+        if (reader.elapsed < 0 || !reader.received) {
+            out << "  nothing was received from " << name << "\n";
+            return 1;
+        }
+        double seconds = qMax<qint64>(reader.elapsed, 1) / 1000.0;
+        out << QString("  %1 %2 bytes/event, %3 events/s, cpu per event: "
+                       "%4 us writing, %5 us reading, %6 received, %7 broken\n")
+               .arg(format == IpcWire::Cbor ? "cbor:" : "json:")
+               .arg(double(reader.bytes) / reader.received, 0, 'f', 1)
+               .arg(qRound64(reader.received / seconds))
+               .arg(serverCpu / 1000.0 / reader.received, 0, 'f', 2)
+               .arg(reader.cpuTime / 1000.0 / reader.received, 0, 'f', 2)
+               .arg(reader.received).arg(reader.broken);
+        failures += reader.broken;
+    }
+    return failures ? 1 : 0;
+}
+
+
+
+// Feeds the command parser every cut-off version of a good line, and lines
+// of junk, none of which may be taken for a command.  MpvConnection falls
+// back to QJsonDocument, so what the parser leaves to it must fail there.
+// Then times the parser on good lines.
+static int ipcParse(QTextStream &out, int size)
+{
+    int failures = 0;
+    IpcCommand parsed;
+    auto rejected = [&parsed](const QByteArray &line) {
+        IpcCommand::Result result = parsed.parse(line);
+        if (result == IpcCommand::Parsed)
+            return false;
+        if (result == IpcCommand::Invalid)
+            return true;
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(line, &error);
+        return error.error != QJsonParseError::NoError || !document.isObject();
+    };
+
+    QByteArray good("{\"request_id\":7,\"command\":[\"get_property\",\"time-pos\"]}");
+    if (parsed.parse(good) != IpcCommand::Parsed || parsed.requestId.toInt() != 7
+            || parsed.command.size() != 2) {
+        out << "  a good line was not parsed\n";
+        ++failures;
+    }
+    int truncated = 0;
+    for (int i = 1; i < good.size(); ++i) {
+        QByteArray line = good.left(i);
+        if (!rejected(line)) {
+            out << "  taken as a command: " << line << "\n";
+            ++failures;
+            continue;
+        }
+        ++truncated;
+        // The id is read early on, and the reply should still carry it.
+        if (i > good.indexOf(',') && parsed.requestId.toInt() != 7) {
+            out << "  request_id lost from: " << line << "\n";
+            ++failures;
+        }
+    }
+    out << QString("  %1 cut off lines rejected\n").arg(truncated);
+
+    const QList<QByteArray> junk {
+        "}", "{", "[]", "null", "\"command\"", "{command:[\"stop\"]}",
+        "{\"command\":\"stop\"}", "{\"command\":[\"stop\",]}",
+        "{\"command\":[\"stop\"]}}", "{\"command\":[\"stop\"],}",
+        "{\"command\":[\"stop\"] \"request_id\":1}", "{\"command\":[\"st\\",
+        "{\"request_id\":[1,{\"a\":}]}", QByteArray("{\"command\":[\"\0\"", 14),
+        "\xff\xfe{", "{\"command\":[1e999999999999]}garbage"
+    };
+    for (const QByteArray &line : junk) {
+        if (!rejected(line)) {
+            out << "  taken as a command: " << line << "\n";
+            ++failures;
+        }
+    }
+    quint32 seed = 1;
+    int garbled = 0;
+    for (int i = 0; i < 10000; ++i) {
+        QByteArray line = good;
+        for (int j = 0; j < 3; ++j) {
+            seed = seed * 1103515245 + 12345;
+            line[int(seed >> 8) % line.size()] = char(seed >> 24);
+        }
+        garbled += parsed.parse(line) != IpcCommand::Parsed;
+    }
+    out << QString("  %1 junk lines rejected, %2 of 10000 garbled lines rejected\n")
+           .arg(junk.size()).arg(garbled);
+
+    // The last line of a connection may come without its newline.
+    QBuffer device;
+    device.setData("{\"command\":[\"stop\"]}\n{\"command\":[\"pause\"]}");
+    device.open(QIODevice::ReadOnly);
+    IpcFrameBuffer frames;
+    QByteArray frame;
+    frames.readFrom(&device);
+    int taken = 0;
+    while (frames.takeFrame(frame))
+        ++taken;
+    if (taken != 1 || !frames.takeRemainder(frame)
+            || frame != "{\"command\":[\"pause\"]}" || frames.takeRemainder(frame)) {
+        out << "  the last line was not kept for the end of the connection\n";
+        ++failures;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int commands = 0;
+    for (int i = 0; i < size; ++i)
+        commands += parsed.parse(good) == IpcCommand::Parsed;
+    qint64 elapsed = timer.nsecsElapsed();
+    out << QString("  %1 ns per line, %2 parsed\n")
+           .arg(elapsed / qMax(size, 1)).arg(commands);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+// Built-in benchmarks, run with --benchmark name[:size].  They print their
+// results to stdout, so that numbers can be compared across builds.  Some
+// also check what they measure, and exit with 1 when the check fails.
+
+#include <QString>
+#include <QStringList>
+
+namespace Benchmarks {
+    QStringList names();
+    bool exists(const QString &name);
+    int run(const QString &name, int size = 0);
+}
+
+#endif // BENCHMARKS_H
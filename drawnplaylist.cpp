@@ -4,20 +4,25 @@
 #include <QFontMetrics>
 #include <QMenu>
 #include <QKeyEvent>
+#include <QDropEvent>
+#include <algorithm>
 #include "drawnplaylist.h"
 #include "playlist.h"
 #include "helpers.h"
 
+// Beyond this many separate inserted or removed ranges, a row-by-row update
+// costs more than a reset, so the model resets and the view restores its
+// selection and scroll position afterwards.
+static const int maxDeltaRuns = 256;
+
 PlayPainter::PlayPainter(QObject *parent) : QAbstractItemDelegate(parent) {}
 
 void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
                         const QModelIndex &index) const
 {
     auto playWidget = qobject_cast<DrawnPlaylist*>(parent());
-    auto p = playWidget->playlist();
-    if (p == nullptr)
-        return;
-    QSharedPointer<Item> i = p->itemOf(QUuid(index.data(Qt::DisplayRole).toString()));
+    auto model = static_cast<const PlaylistModel*>(index.model());
+    QSharedPointer<Item> i = model->itemAt(index.row());
     if (i == nullptr)
         return;
 
@@ -47,10 +52,14 @@ void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
     }
 
     DisplayParser *dp = playWidget->displayParser();
-    QString text = i->toDisplayString();
-    if (dp) {
+    QString text;
+    if (!dp) {
+        text = i->toDisplayString();
+    } else if (!i->cachedLabel(dp->formatSerial(), text)) {
         // TODO: detect what type of file is being played
-        text = dp->parseMetadata(i->metadata(), text, Helpers::VideoFile);
+        text = dp->parseMetadata(i->metadata(), i->toDisplayString(),
+                                 Helpers::VideoFile);
+        i->setCachedLabel(dp->formatSerial(), text);
     }
 
     QFont f = playWidget->font();
@@ -71,31 +80,227 @@ QSize PlayPainter::sizeHint(const QStyleOptionViewItem &option,
                                                    option.rect.size());
 }
 
-PlayItem::PlayItem(const QUuid &uuid, const QUuid &playlistUuid,
-                   QListWidget *parent)
-    : QListWidgetItem(parent, QListWidgetItem::UserType)
+
+
+PlaylistModel::PlaylistModel(QObject *parent) : QAbstractListModel(parent)
 {
-    playlistUuid_ = playlistUuid;
-    uuid_ = uuid;
-    setData(Qt::DisplayRole, uuid.toString());
+
+}
+
+int PlaylistModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.count();
 }
 
-PlayItem::~PlayItem()
+QVariant PlaylistModel::data(const QModelIndex &index, int role) const
 {
+    QSharedPointer<Item> i = itemAt(index.row());
+    if (!index.isValid() || i.isNull())
+        return QVariant();
+    if (role == Qt::DisplayRole)
+        return i->toDisplayString();
+    if (role == UuidRole)
+        return i->uuid();
+    return QVariant();
+}
 
+Qt::ItemFlags PlaylistModel::flags(const QModelIndex &index) const
+{
+    // Only the gaps between rows accept drops, so that an internal move
+    // never lands on top of an item.
+    if (!index.isValid())
+        return Qt::ItemIsDropEnabled;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDragEnabled
+            | Qt::ItemNeverHasChildren;
 }
 
-QUuid PlayItem::playlistUuid()
+Qt::DropActions PlaylistModel::supportedDropActions() const
 {
-    return playlistUuid_;
+    return Qt::MoveAction | Qt::CopyAction;
 }
 
-QUuid PlayItem::uuid()
+QSharedPointer<Item> PlaylistModel::itemAt(int row) const
 {
-    return uuid_;
+    if (row < 0 || row >= rows.count())
+        return QSharedPointer<Item>();
+    return rows.at(row);
+}
+
+int PlaylistModel::rowOf(const QUuid &uuid) const
+{
+    for (; staleFrom < rows.count(); ++staleFrom)
+        rowsByUuid.insert(rows.at(staleFrom)->uuid(), staleFrom);
+    int row = rowsByUuid.value(uuid, -1);
+    if (row < 0 || row >= rows.count() || rows.at(row)->uuid() != uuid)
+        return -1;
+    return row;
+}
+
+void PlaylistModel::setItems(const QVector<QSharedPointer<Item>> &items)
+{
+    beginResetModel();
+    rows = items;
+    rowsByUuid.clear();
+    staleFrom = 0;
+    endResetModel();
+}
+
+void PlaylistModel::updateItems(const QVector<QSharedPointer<Item>> &items)
+{
+    QSet<const Item*> incoming;
+    QSet<const Item*> current;
+    incoming.reserve(items.count());
+    current.reserve(rows.count());
+    for (const QSharedPointer<Item> &i : items)
+        incoming.insert(i.data());
+    for (const QSharedPointer<Item> &i : rows)
+        current.insert(i.data());
+
+    int runs = 0;
+    bool inRun = false;
+    for (const QSharedPointer<Item> &i : rows) {
+        bool gone = !incoming.contains(i.data());
+        if (gone && !inRun)
+            ++runs;
+        inRun = gone;
+    }
+    inRun = false;
+    for (const QSharedPointer<Item> &i : items) {
+        bool fresh = !current.contains(i.data());
+        if (fresh && !inRun)
+            ++runs;
+        inRun = fresh;
+    }
+    if (runs > maxDeltaRuns) {
+        setItems(items);
+        return;
+    }
+
+    // Removed ranges, back to front so earlier rows keep their numbers.
+    for (int last = rows.count() - 1; last >= 0; --last) {
+        if (incoming.contains(rows.at(last).data()))
+            continue;
+        int first = last;
+        while (first > 0 && !incoming.contains(rows.at(first - 1).data()))
+            --first;
+        removeItems(first, last - first + 1);
+        last = first;
+    }
+
+    // The rows left over are in the old order, which only differs from the
+    // new one after sorting.
+    QVector<QSharedPointer<Item>> kept;
+    kept.reserve(rows.count());
+    for (const QSharedPointer<Item> &i : items)
+        if (current.contains(i.data()))
+            kept.append(i);
+    if (kept != rows)
+        reorderItems(kept);
+
+    // Inserted ranges, front to back.
+    int row = 0;
+    int index = 0;
+    while (index < items.count()) {
+        if (current.contains(items.at(index).data())) {
+            ++index;
+            ++row;
+            continue;
+        }
+        int end = index;
+        while (end < items.count() && !current.contains(items.at(end).data()))
+            ++end;
+        insertItems(row, items.mid(index, end - index));
+        row += end - index;
+        index = end;
+    }
 }
 
-DrawnPlaylist::DrawnPlaylist(QWidget *parent) : QListWidget(parent),
+void PlaylistModel::insertItems(int row,
+                                const QVector<QSharedPointer<Item>> &items)
+{
+    if (items.isEmpty())
+        return;
+    row = qBound(0, row, rows.count());
+    beginInsertRows(QModelIndex(), row, row + items.count() - 1);
+    // Open a gap for the whole block at once, so the rows after it move
+    // only once.
+    if (row == rows.count()) {
+        rows.append(items);
+    } else {
+        rows.insert(row, items.count(), QSharedPointer<Item>());
+        std::copy(items.constBegin(), items.constEnd(), rows.begin() + row);
+    }
+    markStale(row);
+    endInsertRows();
+}
+
+void PlaylistModel::removeItems(int row, int count)
+{
+    if (row < 0 || count < 1 || row + count > rows.count())
+        return;
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    for (int i = row; i < row + count; ++i)
+        rowsByUuid.remove(rows.at(i)->uuid());
+    rows.remove(row, count);
+    markStale(row);
+    endRemoveRows();
+}
+
+void PlaylistModel::moveItems(const QList<int> &sourceRows, int destination)
+{
+    // sourceRows is sorted, and destination is a row that is not moving
+    // (or the end), in the numbering before the move.
+    QVector<QSharedPointer<Item>> moving;
+    for (int row : sourceRows)
+        moving.append(rows.at(row));
+
+    int index = sourceRows.count() - 1;
+    while (index >= 0) {
+        int last = sourceRows.at(index);
+        int first = last;
+        while (index > 0 && sourceRows.at(index - 1) == first - 1)
+            first = sourceRows.at(--index);
+        --index;
+        removeItems(first, last - first + 1);
+        if (first < destination)
+            destination -= last - first + 1;
+    }
+    insertItems(destination, moving);
+}
+
+void PlaylistModel::clear()
+{
+    setItems(QVector<QSharedPointer<Item>>());
+}
+
+void PlaylistModel::reorderItems(const QVector<QSharedPointer<Item>> &items)
+{
+    // Same rows, new order: move the persistent indexes along with their
+    // items so that the selection and current row follow them.
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(),
+                                QAbstractItemModel::VerticalSortHint);
+    QVector<QSharedPointer<Item>> old = rows;
+    rows = items;
+    rowsByUuid.clear();
+    staleFrom = 0;
+
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    for (const QModelIndex &i : from)
+        to.append(index(rowOf(old.at(i.row())->uuid())));
+    changePersistentIndexList(from, to);
+    emit layoutChanged(QList<QPersistentModelIndex>(),
+                       QAbstractItemModel::VerticalSortHint);
+}
+
+void PlaylistModel::markStale(int row)
+{
+    staleFrom = std::min(staleFrom, row);
+}
+
+
+
+DrawnPlaylist::DrawnPlaylist(QWidget *parent) : QListView(parent),
     displayParser_(nullptr), worker(nullptr), searcher(nullptr)
 {
     worker = new QThread();
@@ -104,24 +309,29 @@ DrawnPlaylist::DrawnPlaylist(QWidget *parent) : QListWidget(parent),
     searcher->moveToThread(worker);
 
     collection_ = PlaylistCollection::getSingleton();
+    model_ = new PlaylistModel(this);
+    setModel(model_);
+    setUniformItemSizes(true);
     setSelectionMode(QAbstractItemView::ContiguousSelection);
     setDragDropMode(QAbstractItemView::InternalMove);
 
     setItemDelegate(new PlayPainter(this));
 
     connect(worker, &QThread::finished, searcher, &QObject::deleteLater);
-    connect(model(), SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)),
-            this, SLOT(model_rowsMoved(QModelIndex,int,int,QModelIndex,int)));
     connect(this, &DrawnPlaylist::searcher_filterPlaylist,
             searcher, &PlaylistSearcher::filterPlaylist,
             Qt::QueuedConnection);
     connect(searcher, &PlaylistSearcher::playlistFiltered,
-            this, &DrawnPlaylist::repopulateItems,
+            this, &DrawnPlaylist::applyFilterChanges,
             Qt::QueuedConnection);
-    connect(this, &DrawnPlaylist::currentItemChanged,
-            this, &DrawnPlaylist::self_currentItemChanged);
-    connect(this, SIGNAL(itemDoubleClicked(QListWidgetItem*)),
-            this, SLOT(self_itemDoubleClicked(QListWidgetItem*)));
+    connect(model_, &PlaylistModel::modelAboutToBeReset,
+            this, &DrawnPlaylist::model_modelAboutToBeReset);
+    connect(model_, &PlaylistModel::modelReset,
+            this, &DrawnPlaylist::model_modelReset);
+    connect(selectionModel(), &QItemSelectionModel::currentChanged,
+            this, &DrawnPlaylist::self_currentChanged);
+    connect(this, &DrawnPlaylist::doubleClicked,
+            this, &DrawnPlaylist::self_doubleClicked);
     connect(this, SIGNAL(customContextMenuRequested(QPoint)),
             this, SLOT(self_customContextMenuRequested(QPoint)));
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -149,9 +359,9 @@ QUuid DrawnPlaylist::uuid() const
 
 QUuid DrawnPlaylist::currentItemUuid() const
 {
-    PlayItem *item = reinterpret_cast<PlayItem*>(currentItem());
+    QSharedPointer<Item> item = model_->itemAt(currentIndex().row());
     if (!item)
-        item = reinterpret_cast<PlayItem*>(QListWidget::item(0));
+        item = model_->itemAt(0);
     if (item)
         return item->uuid();
     return QUuid();
@@ -160,33 +370,29 @@ QUuid DrawnPlaylist::currentItemUuid() const
 QList<QUuid> DrawnPlaylist::currentItemUuids() const
 {
     QList<QUuid> selected;
-    for (auto &i : selectedItems())
-        selected.append(QUuid(i->text()));
+    for (int row : selectedRows())
+        selected.append(model_->itemAt(row)->uuid());
     return selected;
 }
 
 void DrawnPlaylist::traverseSelected(std::function<void (QUuid)> callback)
 {
-    for (auto &i : selectedItems())
-        callback(QUuid(i->text()));
+    for (const QUuid &uuid : currentItemUuids())
+        callback(uuid);
 }
 
 void DrawnPlaylist::setCurrentItem(QUuid itemUuid)
 {
-    QList<QListWidgetItem *> items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.isEmpty())
-        setCurrentRow(-1);
-    else
-        QListWidget::setCurrentItem(items.first());
+    int row = model_->rowOf(itemUuid);
+    setCurrentRow(row);
 }
 
 void DrawnPlaylist::scrollToItem(QUuid itemUuid)
 {
-    auto items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.empty())
+    int row = model_->rowOf(itemUuid);
+    if (row < 0)
         return;
-    auto item = items.first();
-    scrollTo(indexFromItem(item));
+    scrollTo(model_->index(row));
 }
 
 void DrawnPlaylist::setUuid(const QUuid &uuid)
@@ -199,26 +405,20 @@ void DrawnPlaylist::setUuid(const QUuid &uuid)
 
 void DrawnPlaylist::addItem(QUuid uuid)
 {
-    PlayItem *playItem = new PlayItem(uuid, uuid_, this);
-    QListWidget::addItem(playItem);
+    insertItems(model_->rowCount(), { uuid });
 }
 
 void DrawnPlaylist::addItems(const QList<QUuid> &items)
 {
-    for (const QUuid &item : items)
-        addItem(item);
+    insertItems(model_->rowCount(), items);
 }
 
 void DrawnPlaylist::addItemsAfter(QUuid item, const QList<QUuid> &items)
 {
-    auto matchingRows = findItems(item.toString(), Qt::MatchExactly);
-    if (matchingRows.length() < 1)
+    int row = model_->rowOf(item);
+    if (row < 0)
         return;
-    int itemIndex = row(matchingRows[0]) + 1;
-    for (auto i : items) {
-        PlayItem *playItem = new PlayItem(i);
-        QListWidget::insertItem(itemIndex++, playItem);
-    }
+    insertItems(row + 1, items);
 }
 
 void DrawnPlaylist::removeItem(QUuid uuid)
@@ -226,9 +426,9 @@ void DrawnPlaylist::removeItem(QUuid uuid)
     QSharedPointer<Playlist> playlist = this->playlist();
     if (playlist && playlist->contains(uuid))
         playlist->removeItem(uuid);
-    auto matchingRows = findItems(uuid.toString(), Qt::MatchExactly);
-    if (matchingRows.length() > 0)
-        takeItem(row(matchingRows[0]));
+    int row = model_->rowOf(uuid);
+    if (row >= 0)
+        model_->removeItems(row, 1);
 }
 
 void DrawnPlaylist::removeItems(const QList<int> &indicies)
@@ -236,7 +436,7 @@ void DrawnPlaylist::removeItems(const QList<int> &indicies)
     QListIterator<int> iterator(indicies);
     iterator.toBack();
     while (iterator.hasPrevious())
-        delete takeItem(iterator.previous());
+        model_->removeItems(iterator.previous(), 1);
 }
 
 void DrawnPlaylist::removeAll()
@@ -248,6 +448,26 @@ void DrawnPlaylist::removeAll()
     clear();
 }
 
+void DrawnPlaylist::clear()
+{
+    model_->clear();
+}
+
+int DrawnPlaylist::count() const
+{
+    return model_->rowCount();
+}
+
+int DrawnPlaylist::currentRow() const
+{
+    return currentIndex().row();
+}
+
+void DrawnPlaylist::setCurrentRow(int row)
+{
+    setCurrentIndex(model_->index(row));
+}
+
 QPair<QUuid,QUuid> DrawnPlaylist::importUrl(QUrl url)
 {
     QPair<QUuid,QUuid> info;
@@ -303,6 +523,14 @@ void DrawnPlaylist::fromVMap(const QVariantMap &qvm)
     setUuid(p->uuid());
 }
 
+QByteArray DrawnPlaylist::toBinary() const
+{
+    QSharedPointer<Playlist> playlist = this->playlist();
+    if (!playlist)
+        return QByteArray();
+    return playlist->toBinary();
+}
+
 void DrawnPlaylist::setDisplayParser(DisplayParser *parser)
 {
     displayParser_ = parser;
@@ -336,65 +564,241 @@ bool DrawnPlaylist::event(QEvent *e)
         }
     }
     end:
-    return QListWidget::event(e);
+    return QListView::event(e);
 }
 
-void DrawnPlaylist::repopulateItems()
+void DrawnPlaylist::dropEvent(QDropEvent *event)
 {
-    clear();
+    if (event->source() != this) {
+        QListView::dropEvent(event);
+        return;
+    }
+
+    QList<int> rows = selectedRows();
+    QSharedPointer<Playlist> p = playlist();
+    if (rows.isEmpty() || p.isNull()) {
+        event->ignore();
+        return;
+    }
+
+    int destination = model_->rowCount();
+    QModelIndex target = indexAt(event->pos());
+    if (target.isValid())
+        destination = target.row()
+                + (dropIndicatorPosition() == BelowItem ? 1 : 0);
+    while (destination < model_->rowCount() && rows.contains(destination))
+        ++destination;
+
+    // Move the items in the playlist, then mirror that in the model.
+    QSharedPointer<Item> destinationItem = model_->itemAt(destination);
+    QList<QSharedPointer<Item>> itemsToGrab;
+    for (int row : rows)
+        itemsToGrab.append(model_->itemAt(row));
+    p->moveItems(destinationItem ? destinationItem->uuid() : QUuid(),
+                 itemsToGrab);
+    model_->moveItems(rows, destination);
+
+    int first = destinationItem ? model_->rowOf(destinationItem->uuid())
+                                  - rows.count()
+                                : model_->rowCount() - rows.count();
+    QItemSelection moved(model_->index(first),
+                         model_->index(first + rows.count() - 1));
+    selectionModel()->select(moved, QItemSelectionModel::ClearAndSelect);
+    selectionModel()->setCurrentIndex(model_->index(first),
+                                      QItemSelectionModel::NoUpdate);
+
+    // We already did the moving, so don't let the drag source remove rows.
+    event->setDropAction(Qt::CopyAction);
+    event->accept();
+    stopAutoScroll();
+    setState(NoState);
+    viewport()->update();
+}
+
+QSharedPointer<Item> DrawnPlaylist::itemOf(const QUuid &uuid) const
+{
+    QSharedPointer<Playlist> p = playlist();
+    return p ? p->itemOf(uuid) : QSharedPointer<Item>();
+}
+
+void DrawnPlaylist::insertItems(int row, const QList<QUuid> &items)
+{
+    QVector<QSharedPointer<Item>> rows;
+    rows.reserve(items.count());
+    for (const QUuid &uuid : items) {
+        QSharedPointer<Item> item = itemOf(uuid);
+        if (item)
+            rows.append(item);
+    }
+    model_->insertItems(row, rows);
+}
 
+QList<int> DrawnPlaylist::selectedRows() const
+{
+    QList<int> rows;
+    for (const QModelIndex &index : selectionModel()->selectedIndexes())
+        rows.append(index.row());
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
+void DrawnPlaylist::repopulateItems()
+{
     auto playlist = this->playlist();
-    if (playlist == nullptr)
+    if (playlist == nullptr) {
+        model_->clear();
         return;
+    }
 
+    QVector<QSharedPointer<Item>> visible;
+    visible.reserve(playlist->count());
     auto itemAdder = [&](QSharedPointer<Item> item) {
         if (!item->hidden())
-            addItem(item->uuid());
+            visible.append(item);
     };
     playlist->iterateItems(itemAdder);
-    setCurrentItem(lastSelectedItem);
+    model_->updateItems(visible);
+    if (!currentIndex().isValid())
+        setCurrentItem(lastSelectedItem);
 }
 
-void DrawnPlaylist::model_rowsMoved(const QModelIndex &parent,
-                                     int start, int end,
-                                     const QModelIndex &destination, int row)
+void DrawnPlaylist::applyFilterChanges()
 {
-    Q_UNUSED(parent)
-    Q_UNUSED(destination)
-    QSharedPointer<Playlist> p = playlist();
-    if (p.isNull())
+    // Only the rows whose visibility changed are touched.  Leaving rows are
+    // found by uuid, and the model is in playlist order, so arriving ones are
+    // placed by a binary search over playlist positions.  The positions are
+    // taken once for the whole batch.
+    auto playlist = this->playlist();
+    if (playlist == nullptr)
         return;
-    QListWidgetItem *destinationItem = QListWidget::item(row);
-    QUuid destinationId = destinationItem ? QUuid(destinationItem->text())
-                                          : QUuid();
-    QList<QSharedPointer<Item>> itemsToGrab;
-    for (int index = start; index <= end; index++) {
-        QUuid itemUuid = QUuid(QListWidget::item(index)->text());
-        itemsToGrab.append(p->itemOf(itemUuid));
+    QVector<QSharedPointer<Item>> changed = playlist->takeFilterChanges();
+    PlaylistPositions positions = playlist->positionSnapshot();
+    QSet<const Item*> seen;
+    QVector<int> leaving;
+    QVector<QPair<int, QSharedPointer<Item>>> arriving;
+    for (const QSharedPointer<Item> &i : changed) {
+        if (seen.contains(i.data()))
+            continue;
+        seen.insert(i.data());
+        int row = model_->rowOf(i->uuid());
+        if (i->hidden() && row >= 0) {
+            leaving.append(row);
+        } else if (!i->hidden() && row < 0) {
+            int position = positions.indexOf(i->uuid());
+            if (position >= 0)
+                arriving.append({ position, i });
+        }
+    }
+    std::sort(leaving.begin(), leaving.end());
+    std::sort(arriving.begin(), arriving.end(),
+              [](const QPair<int, QSharedPointer<Item>> &a,
+                 const QPair<int, QSharedPointer<Item>> &b) {
+        return a.first < b.first;
+    });
+
+    // Work out where every range goes before changing anything.  Arriving
+    // rows are placed among the rows that stay, so the ones leaving before
+    // them are taken off their row.
+    QVector<QPair<int,int>> removals;
+    for (int i = 0; i < leaving.count(); ) {
+        int j = i;
+        while (j + 1 < leaving.count() && leaving.at(j + 1) == leaving.at(j) + 1)
+            ++j;
+        removals.append({ leaving.at(i), j - i + 1 });
+        i = j + 1;
+    }
+    QVector<QPair<int, QVector<QSharedPointer<Item>>>> insertions;
+    for (const auto &a : arriving) {
+        int low = 0;
+        int high = model_->rowCount();
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (positions.indexOf(model_->itemAt(mid)->uuid()) < a.first)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        low -= int(std::lower_bound(leaving.begin(), leaving.end(), low) - leaving.begin());
+        if (insertions.isEmpty() || insertions.last().first != low)
+            insertions.append({ low, {} });
+        insertions.last().second.append(a.second);
     }
-    p->takeItemsRaw(itemsToGrab);
-    p->addItems(destinationId, itemsToGrab);
+    if (removals.count() + insertions.count() > maxDeltaRuns) {
+        repopulateItems();
+        return;
+    }
+
+    // Back to front, so that no change moves the rows of the ones to come.
+    for (int r = removals.count() - 1; r >= 0; --r)
+        model_->removeItems(removals.at(r).first, removals.at(r).second);
+    for (int n = insertions.count() - 1; n >= 0; --n)
+        model_->insertItems(insertions.at(n).first, insertions.at(n).second);
+    if (!currentIndex().isValid())
+        setCurrentItem(lastSelectedItem);
+}
+
+void DrawnPlaylist::model_modelAboutToBeReset()
+{
+    resetSelection = currentItemUuids();
+    resetCurrent = model_->itemAt(currentIndex().row())
+            ? model_->itemAt(currentIndex().row())->uuid() : QUuid();
+    QSharedPointer<Item> top = model_->itemAt(indexAt(QPoint(0, 0)).row());
+    resetTop = top ? top->uuid() : QUuid();
 }
 
-void DrawnPlaylist::self_currentItemChanged(QListWidgetItem *current,
-                                             QListWidgetItem *previous)
+void DrawnPlaylist::model_modelReset()
+{
+    QList<int> rows;
+    for (const QUuid &uuid : resetSelection) {
+        int row = model_->rowOf(uuid);
+        if (row >= 0)
+            rows.append(row);
+    }
+    std::sort(rows.begin(), rows.end());
+
+    QItemSelection selection;
+    for (int i = 0; i < rows.count(); ) {
+        int j = i;
+        while (j + 1 < rows.count() && rows.at(j + 1) == rows.at(j) + 1)
+            ++j;
+        selection.select(model_->index(rows.at(i)), model_->index(rows.at(j)));
+        i = j + 1;
+    }
+    selectionModel()->select(selection, QItemSelectionModel::ClearAndSelect);
+
+    int current = model_->rowOf(resetCurrent);
+    if (current >= 0)
+        selectionModel()->setCurrentIndex(model_->index(current),
+                                          QItemSelectionModel::NoUpdate);
+    int top = model_->rowOf(resetTop);
+    if (top >= 0)
+        scrollTo(model_->index(top), PositionAtTop);
+
+    resetSelection.clear();
+    resetCurrent = QUuid();
+    resetTop = QUuid();
+}
+
+void DrawnPlaylist::self_currentChanged(const QModelIndex &current,
+                                        const QModelIndex &previous)
 {
     Q_UNUSED(previous)
-    QUuid uuid;
-    if (current && !(uuid=reinterpret_cast<PlayItem*>(current)->uuid()).isNull())
-        lastSelectedItem = uuid;
+    QSharedPointer<Item> item = model_->itemAt(current.row());
+    if (item && !item->uuid().isNull())
+        lastSelectedItem = item->uuid();
 }
 
-void DrawnPlaylist::self_itemDoubleClicked(QListWidgetItem *item)
+void DrawnPlaylist::self_doubleClicked(const QModelIndex &index)
 {
-    PlayItem *playItem = reinterpret_cast<PlayItem*>(item);
-    emit itemDesired(playItem->playlistUuid(), playItem->uuid());
+    QSharedPointer<Item> item = model_->itemAt(index.row());
+    if (item)
+        emit itemDesired(item->playlistUuid(), item->uuid());
 }
 
 void DrawnPlaylist::self_customContextMenuRequested(const QPoint &p)
 {
-    PlayItem *playItem = reinterpret_cast<PlayItem*>(this->itemAt(p));
-    QUuid playItemUuid = playItem ? playItem->uuid() : QUuid();
+    QSharedPointer<Item> item = model_->itemAt(indexAt(p).row());
+    QUuid playItemUuid = item ? item->uuid() : QUuid();
     emit contextMenuRequested(p, uuid_, playItemUuid);
 }
 
@@ -469,6 +873,7 @@ void PlaylistSelection::appendToPlaylist(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
+    PlaylistJournal::Batch batch;
     for (auto &i : d->items) {
         list->addItem(pl->addItemClone(i)->uuid());
     }
@@ -481,6 +886,7 @@ void PlaylistSelection::appendAndQuickQueue(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
+    PlaylistJournal::Batch batch;
     for (auto &i : d->items) {
         QUuid uuid = pl->addItemClone(i)->uuid();
         list->addItem(uuid);
@@ -494,11 +900,7 @@ QSharedPointer<Playlist> DrawnQueue::playlist() const
     return PlaylistCollection::queuePlaylist();
 }
 
-void DrawnQueue::addItem(QUuid uuid)
+QSharedPointer<Item> DrawnQueue::itemOf(const QUuid &uuid) const
 {
-    auto actualItem = ItemCollection::getSingleton()->itemOf(uuid);
-    if (actualItem.isNull())
-        return;
-    PlayItem *playItem = new PlayItem(uuid, actualItem->playlistUuid(), this);
-    QListWidget::addItem(playItem);
+    return ItemCollection::getSingleton()->itemOf(uuid);
 }
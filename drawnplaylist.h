@@ -1,7 +1,9 @@
 #ifndef QDRAWNPLAYLIST_H
 #define QDRAWNPLAYLIST_H
 
-#include <QListWidget>
+#include <QListView>
+#include <QAbstractListModel>
+#include <QVector>
 #include <QUuid>
 #include <functional>
 #include "playlist.h"
@@ -21,24 +23,45 @@ public:
 };
 
 
-class PlayItem : public QListWidgetItem {
+// PlaylistModel holds the rows shown by a DrawnPlaylist as plain pointers to
+// playlist items, so no per-row widget items are made and painting needs no
+// lookups.  Rows are found by uuid through a hash that is rebuilt lazily from
+// the first row that moved.  updateItems diffs a new set of rows against the
+// current one and reports only the removed, moved and inserted rows.
+class PlaylistModel : public QAbstractListModel {
+    Q_OBJECT
 public:
-    PlayItem(const QUuid &uuid = QUuid(), const QUuid &playlistUuid = QUuid(), QListWidget *parent = nullptr);
-    ~PlayItem();
+    enum Roles { UuidRole = Qt::UserRole };
+
+    PlaylistModel(QObject *parent = nullptr);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    Qt::DropActions supportedDropActions() const;
 
-    QUuid playlistUuid();
-    QUuid uuid();
+    QSharedPointer<Item> itemAt(int row) const;
+    int rowOf(const QUuid &uuid) const;
+
+    void setItems(const QVector<QSharedPointer<Item>> &items);
+    void updateItems(const QVector<QSharedPointer<Item>> &items);
+    void insertItems(int row, const QVector<QSharedPointer<Item>> &items);
+    void removeItems(int row, int count);
+    void moveItems(const QList<int> &sourceRows, int destination);
+    void clear();
 
 private:
-    QUuid playlistUuid_;
-    QUuid uuid_;
+    void reorderItems(const QVector<QSharedPointer<Item>> &items);
+    void markStale(int row);
+
+    QVector<QSharedPointer<Item>> rows;
+    mutable QHash<QUuid, int> rowsByUuid;
+    mutable int staleFrom = 0;
 };
 
 
-// DrawnPlaylist abuses a ListWidget's items to store the uuid of playlist
-// items, which is decoded and looked up during drawing.  The alternative is a
-// subclass of QAbstractItemModel with about 1.5x the code.
-class DrawnPlaylist : public QListWidget {
+// DrawnPlaylist is a view over a PlaylistModel.  It keeps the subset of the
+// playlist that survives the current filter, in playlist order.
+class DrawnPlaylist : public QListView {
     Q_OBJECT
 public:
     DrawnPlaylist(QWidget *parent = nullptr);
@@ -58,6 +81,10 @@ public:
     void removeItem(QUuid uuid);
     void removeItems(const QList<int> &indicies);
     void removeAll();
+    void clear();
+    int count() const;
+    int currentRow() const;
+    void setCurrentRow(int row);
     template<class T>
     void sort(std::function<T(QSharedPointer<Item>)> converter,
               std::function<bool(const T &a, const T &b)> lessThan);
@@ -70,6 +97,7 @@ public:
 
     QVariantMap toVMap() const;
     void fromVMap(const QVariantMap &qvm);
+    QByteArray toBinary() const;
 
     void setDisplayParser(DisplayParser *parser);
     DisplayParser *displayParser();
@@ -78,11 +106,16 @@ public:
 
 protected:
     bool event(QEvent *e);
+    void dropEvent(QDropEvent *event);
+    virtual QSharedPointer<Item> itemOf(const QUuid &uuid) const;
+    void insertItems(int row, const QList<QUuid> &items);
+    QList<int> selectedRows() const;
+
+    PlaylistModel *model_ = nullptr;
 
 private:
     QSharedPointer<PlaylistCollection> collection_;
     QUuid uuid_;
-    QHash <QUuid, PlayItem*> itemsByUuid;
     QUuid lastSelectedItem;
     QUuid nowPlayingItem_;
     DisplayParser *displayParser_ = nullptr;
@@ -90,6 +123,9 @@ private:
     PlaylistSearcher *searcher;
     QString currentFilterText;
     QStringList currentFilterList;
+    QList<QUuid> resetSelection;
+    QUuid resetCurrent;
+    QUuid resetTop;
 
 signals:
     // for lack of a better term that doesn't conflict with what we already
@@ -102,12 +138,13 @@ signals:
 
 private slots:
     void repopulateItems();
+    void applyFilterChanges();
 
-    void model_rowsMoved(const QModelIndex & parent, int start, int end,
-                         const QModelIndex & destination, int row);
-    void self_currentItemChanged(QListWidgetItem *current,
-                                 QListWidgetItem *previous);
-    void self_itemDoubleClicked(QListWidgetItem *item);
+    void model_modelAboutToBeReset();
+    void model_modelReset();
+    void self_currentChanged(const QModelIndex &current,
+                             const QModelIndex &previous);
+    void self_doubleClicked(const QModelIndex &index);
     void self_customContextMenuRequested(const QPoint &p);
 };
 
@@ -127,8 +164,7 @@ void DrawnPlaylist::sort(
     qSort(items.begin(), items.end(), [&](const QSharedPointer<Item> &a, const QSharedPointer<Item> &b) {
         return lessThan(playlistMap.value(a->uuid()), playlistMap.value(b->uuid()));
     });
-    pl->takeItemsRaw(items);
-    pl->addItems(QUuid(), items);
+    pl->moveItems(QUuid(), items);
     repopulateItems();
 }
 
@@ -137,7 +173,9 @@ class DrawnQueue : public DrawnPlaylist {
     Q_OBJECT
 public:
     virtual QSharedPointer<Playlist> playlist() const;
-    void addItem(QUuid uuid);
+
+protected:
+    QSharedPointer<Item> itemOf(const QUuid &uuid) const;
 };
 
 class PlaylistSelectionPrivate;
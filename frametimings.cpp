@@ -0,0 +1,238 @@
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include "frametimings.h"
+
+// Swaps further apart than this are taken to be a pause in playback rather
+// than frames missing their vsync.
+static const qint64 swapIdleLimit = 250000;
+
+
+
+qint64 TimingHistogram::bucketLimit(int bucket)
+{
+    if (bucket >= bucketCount - 1)
+        return -1;
+    return qint64(250) << bucket;
+}
+
+void TimingHistogram::add(qint64 usec)
+{
+    int index = 0;
+    while (index < bucketCount - 1 && usec >= bucketLimit(index))
+        ++index;
+    ++buckets[index];
+    ++total;
+    sum += usec;
+    max = std::max(max, usec);
+}
+
+void TimingHistogram::clear()
+{
+    std::fill(buckets, buckets + bucketCount, 0);
+    total = 0;
+    sum = 0;
+    max = 0;
+}
+
+quint64 TimingHistogram::count() const
+{
+    return total;
+}
+
+quint64 TimingHistogram::bucket(int index) const
+{
+    return buckets[index];
+}
+
+double TimingHistogram::average() const
+{
+    return total ? sum / 1000.0 / total : 0.0;
+}
+
+double TimingHistogram::maximum() const
+{
+    return max / 1000.0;
+}
+
+double TimingHistogram::percentile(double fraction) const
+{
+    // The answer is the upper bound of the bucket it falls in.
+    quint64 wanted = quint64(std::ceil(total * fraction));
+    quint64 seen = 0;
+    for (int i = 0; i < bucketCount; i++) {
+        seen += buckets[i];
+        if (seen >= wanted && seen > 0)
+            return bucketLimit(i) < 0 ? maximum() : bucketLimit(i) / 1000.0;
+    }
+    return 0.0;
+}
+
+
+
+FrameTimings::FrameTimings()
+{
+    clock.start();
+}
+
+void FrameTimings::callback()
+{
+    // Only the first callback of a run is timed.  Those after it are
+    // coalesced into the same frame.
+    qint64 expected = -1;
+    callbacks.fetch_add(1, std::memory_order_relaxed);
+    callbackTime.compare_exchange_strong(expected, now());
+}
+
+void FrameTimings::delivered()
+{
+    qint64 sent = callbackTime.exchange(-1);
+    if (sent < 0)
+        return;
+    QMutexLocker locker(&lock);
+    histograms[Delivery].add(now() - sent);
+    if (waitingCallback < 0)
+        waitingCallback = sent;
+}
+
+void FrameTimings::paintStarted()
+{
+    QMutexLocker locker(&lock);
+    if (waitingCallback < 0)
+        return;
+    histograms[Latency].add(now() - waitingCallback);
+    waitingCallback = -1;
+    ++framePaints;
+}
+
+void FrameTimings::renderStarted()
+{
+    QMutexLocker locker(&lock);
+    renderStart = now();
+}
+
+void FrameTimings::renderFinished()
+{
+    QMutexLocker locker(&lock);
+    histograms[Render].add(now() - renderStart);
+}
+
+void FrameTimings::frameSkipped()
+{
+    QMutexLocker locker(&lock);
+    waitingCallback = -1;
+    lastSwap = -1;
+}
+
+void FrameTimings::swapped(double refreshRate)
+{
+    QMutexLocker locker(&lock);
+    qint64 time = now();
+    qint64 interval = lastSwap < 0 ? -1 : time - lastSwap;
+    lastSwap = time;
+    if (interval < 0 || interval > swapIdleLimit)
+        return;
+    histograms[SwapInterval].add(interval);
+    if (refreshRate <= 0)
+        return;
+    double period = 1000000.0 / refreshRate;
+    if (interval > period * 1.5)
+        missed += quint64(std::lround(interval / period)) - 1;
+}
+
+void FrameTimings::clear()
+{
+    QMutexLocker locker(&lock);
+    for (auto &h : histograms)
+        h.clear();
+    callbacks = 0;
+    waitingCallback = -1;
+    lastSwap = -1;
+    framePaints = 0;
+    missed = 0;
+}
+
+const TimingHistogram &FrameTimings::histogram(FrameTimings::Histogram which) const
+{
+    return histograms[which];
+}
+
+quint64 FrameTimings::coalescedUpdates() const
+{
+    QMutexLocker locker(&lock);
+    return coalescedUnlocked();
+}
+
+quint64 FrameTimings::coalescedUnlocked() const
+{
+    quint64 sent = callbacks.load(std::memory_order_relaxed);
+    return sent > framePaints ? sent - framePaints : 0;
+}
+
+quint64 FrameTimings::missedVsyncs() const
+{
+    QMutexLocker locker(&lock);
+    return missed;
+}
+
+QString FrameTimings::summary() const
+{
+    QMutexLocker locker(&lock);
+    QString text;
+    QTextStream stream(&text);
+    stream.setRealNumberNotation(QTextStream::FixedNotation);
+    stream.setRealNumberPrecision(2);
+    stream << "Render Timings\n";
+    for (int i = 0; i < HistogramCount; i++) {
+        const TimingHistogram &h = histograms[i];
+        stream << histogramName(Histogram(i)) << ": avg " << h.average()
+               << " ms, 95% < " << h.percentile(0.95)
+               << " ms, max " << h.maximum() << " ms (" << h.count() << ")\n";
+    }
+    stream << "Coalesced updates: " << coalescedUnlocked() << "\n"
+           << "Missed vsyncs: " << missed;
+    stream.flush();
+    return text;
+}
+
+QString FrameTimings::toCsv() const
+{
+    QMutexLocker locker(&lock);
+    QString text;
+    QTextStream stream(&text);
+    stream << "histogram,bucket_ms,count\n";
+    for (int i = 0; i < HistogramCount; i++) {
+        const TimingHistogram &h = histograms[i];
+        for (int b = 0; b < TimingHistogram::bucketCount; b++) {
+            qint64 limit = TimingHistogram::bucketLimit(b);
+            stream << histogramName(Histogram(i)) << ','
+                   << (limit < 0 ? QString("inf") : QString::number(limit / 1000.0))
+                   << ',' << h.bucket(b) << '\n';
+        }
+    }
+    stream << "Coalesced updates,," << coalescedUnlocked() << '\n'
+           << "Missed vsyncs,," << missed << '\n';
+    stream.flush();
+    return text;
+}
+
+QString FrameTimings::histogramName(FrameTimings::Histogram which)
+{
+    switch (which) {
+    case Delivery:
+        return "Callback delivery";
+    case Latency:
+        return "Callback to paint";
+    case Render:
+        return "Render";
+    case SwapInterval:
+        return "Swap interval";
+    default:
+        return QString();
+    }
+}
+
+qint64 FrameTimings::now() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
@@ -0,0 +1,75 @@
+#ifndef FRAMETIMINGS_H
+#define FRAMETIMINGS_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+
+// TimingHistogram counts durations into buckets that double in width, from
+// under a quarter of a millisecond to over a quarter of a second.
+class TimingHistogram {
+public:
+    static const int bucketCount = 12;
+    // Upper bound of a bucket in microseconds, or -1 for the last one.
+    static qint64 bucketLimit(int bucket);
+
+    void add(qint64 usec);
+    void clear();
+    quint64 count() const;
+    quint64 bucket(int index) const;
+    double average() const;
+    double maximum() const;
+    double percentile(double fraction) const;
+
+private:
+    quint64 buckets[bucketCount] = {};
+    quint64 total = 0;
+    qint64 sum = 0;
+    qint64 max = 0;
+};
+
+
+// FrameTimings follows the frames of a render widget from mpv's update
+// callback to the swap of the frame that was drawn.  callback may be called
+// from any thread.  The other events come from the thread that renders,
+// which need not be the gui thread, so they and the reports take a lock.
+// histogram is only for the rendering thread.
+class FrameTimings {
+public:
+    enum Histogram { Delivery, Latency, Render, SwapInterval, HistogramCount };
+
+    FrameTimings();
+    void callback();
+    void delivered();
+    void paintStarted();
+    void renderStarted();
+    void renderFinished();
+    void frameSkipped();
+    void swapped(double refreshRate);
+    void clear();
+
+    const TimingHistogram &histogram(Histogram which) const;
+    quint64 coalescedUpdates() const;
+    quint64 missedVsyncs() const;
+    QString summary() const;
+    QString toCsv() const;
+    static QString histogramName(Histogram which);
+
+private:
+    qint64 now() const;
+    quint64 coalescedUnlocked() const;
+
+    mutable QMutex lock;
+    QElapsedTimer clock;
+    std::atomic<qint64> callbackTime { -1 };
+    std::atomic<quint64> callbacks { 0 };
+    qint64 waitingCallback = -1;
+    qint64 renderStart = 0;
+    qint64 lastSwap = -1;
+    quint64 framePaints = 0;
+    quint64 missed = 0;
+    TimingHistogram histograms[HistogramCount];
+};
+
+#endif // FRAMETIMINGS_H
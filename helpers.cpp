@@ -12,6 +12,7 @@
 #include <QAction>
 #include <cmath>
 #include <QRegularExpression>
+#include <QVarLengthArray>
 #include <QStandardPaths>
 #include "helpers.h"
 #include "platform/unify.h"
@@ -151,6 +152,29 @@ QSet<QString> Helpers::fileExtensions {
     "cbr"
 };
 
+// Formats that can hold video, for when only pictures are of any use.
+QSet<QString> Helpers::videoExtensions {
+    "yuv", "y4m",
+    "m2ts", "m2t", "mts", "mtv", "ts", "tsv", "tts", "trp",
+    "mpeg", "mpg", "mpe", "mpeg2", "m1v", "m2v", "mp2v", "mpv", "mpv2", "tod",
+    "vob", "vro",
+    "evob", "evo",
+    "mpeg4", "m4v", "mp4", "mp4v", "mpg4",
+    "h264", "avc", "x264", "264",
+    "hevc", "h265", "x265", "265",
+    "ogv", "ogm", "ogx",
+    "mkv", "mk3d", "webm", "av1",
+    "avi", "vfw", "divx", "3iv", "xvid", "nut",
+    "flic", "fli", "flc",
+    "nsv", "gxf", "mxf",
+    "wm", "wmv", "asf", "dvr-ms", "dvr", "wtv",
+    "dv", "hdv",
+    "flv", "f4v",
+    "qt", "mov", "hdmov",
+    "rm", "rmvb",
+    "3gpp", "3gp", "3gp2", "3g2"
+};
+
 QSet<QString> Helpers::subsExtensions {
     "aqtitle", "aqt",
     "ass", "ssa",
@@ -464,7 +488,8 @@ bool Helpers::urlSurvivesFilter(const QUrl &url)
     return fileExtensions.contains(info.suffix().toLower());
 }
 
-QList<QUrl> Helpers::filterUrls(const QList<QUrl> &urls)
+QList<QUrl> Helpers::filterUrls(const QList<QUrl> &urls,
+                                const QSet<QString> &extensions)
 {
     QList<QUrl> filtered;
     for (const QUrl &u : urls) {
@@ -480,10 +505,10 @@ QList<QUrl> Helpers::filterUrls(const QList<QUrl> &urls)
             for (auto &i : dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries,
                                              QDir::Name | QDir::DirsLast))
                children << QUrl::fromLocalFile(i.filePath());
-            filtered.append(filterUrls(children));
+            filtered.append(filterUrls(children, extensions));
             continue;
         }
-        if (fileExtensions.contains(info.suffix().toLower())) {
+        if (extensions.contains(info.suffix().toLower())) {
             filtered << u;
             continue;
         }
@@ -631,7 +656,7 @@ void LogoDrawer::resizeGL(int w, int h)
     }
 }
 
-void LogoDrawer::paintGL(QOpenGLWidget *widget)
+void LogoDrawer::paintGL(QWidget *widget)
 {
     QPainter painter(widget);
     int ratio = widget->devicePixelRatio();
@@ -704,9 +729,8 @@ void LogoWidget::resizeGL(int w, int h)
 
 
 
-// For the sake of optimizing 0.0001% of execution time, let's create a
-// tree out of the format string, so we don't need to do string operations
-// all the time other than those we need to.
+// The format string is first parsed into a tree of these, which
+// DisplayParser::compile then flattens into its program.
 class DisplayNode {
 public:
     enum NodeType { NullNode, PlainText, Trie, Property, DisplayName };
@@ -763,38 +787,6 @@ public:
         if (videoNode)  { delete videoNode; videoNode = nullptr; }
     }
 
-    QString output(const QVariantMap &metaData, const QString &displayString,
-                   const Helpers::FileType fileType) {
-        QString t;
-        switch (type) {
-        case NullNode:
-            break;
-        case PlainText:
-            t += data;
-            break;
-        case Trie:
-            if (metaData.contains(data) && tagNode) {
-                t += tagNode->output(metaData, displayString, fileType);
-            } else if (fileType == Helpers::AudioFile && audioNode) {
-                t += audioNode->output(metaData, displayString, fileType);
-            } else if (videoNode) {
-                t += videoNode->output(metaData, displayString, fileType);
-            }
-            break;
-        case Property:
-            if (metaData.contains(data)) {
-                t += metaData[data].toString();
-            }
-            break;
-        case DisplayName:
-            t += displayString;
-            break;
-        }
-        if (next)
-            t += next->output(metaData, displayString, fileType);
-        return t;
-    }
-
 private:
     DisplayNode *tagNode = nullptr;
     DisplayNode *audioNode = nullptr;
@@ -802,6 +794,8 @@ private:
     DisplayNode *next = nullptr;
     QString data;
     NodeType type = NullNode;
+
+    friend class DisplayParser;
 };
 
 
@@ -813,7 +807,7 @@ DisplayParser::DisplayParser()
 
 DisplayParser::~DisplayParser()
 {
-    if (node) { delete node; node = nullptr; }
+
 }
 
 void DisplayParser::takeFormatString(QString fmt)
@@ -892,10 +886,7 @@ void DisplayParser::takeFormatString(QString fmt)
         return first;
     };
 
-    if (node)
-        delete node;
-    node = new DisplayNode;
-
+    DisplayNode *node = new DisplayNode;
     DisplayNode *current = node;
     QString prop;
     QStringList tuple;
@@ -922,19 +913,130 @@ void DisplayParser::takeFormatString(QString fmt)
         }
     }
     dumpGatheredData(gathered, current, true);
+
+    static int serialCounter = 0;
+    program.clear();
+    keys.clear();
+    titleKey = -1;
+    compile(node);
+    serial = ++serialCounter;
+    delete node;
 }
 
-QString DisplayParser::parseMetadata(QVariantMap metaData,
-                                     QString displayString,
-                                     Helpers::FileType fileType)
+QString DisplayParser::parseMetadata(const QVariantMap &metaData,
+                                     const QString &displayString,
+                                     Helpers::FileType fileType) const
 {
-    if (metaData.isEmpty()) {
+    if (metaData.isEmpty())
         return displayString;
-    } else {
-        if (!metaData.contains("title"))
-            metaData["title"] = displayString;
-        return node->output(metaData, displayString, fileType);
+
+    // Resolve every property the format uses up front.  A missing title
+    // falls back to the display string.
+    QVarLengthArray<const QVariant*, 16> values(keys.count());
+    for (int k = 0; k < keys.count(); ++k) {
+        auto it = metaData.constFind(keys.at(k));
+        values[k] = it != metaData.constEnd() ? &it.value() : nullptr;
     }
+
+    QString t;
+    t.reserve(displayString.length() + 32);
+    int pc = 0;
+    int end = program.count();
+    while (pc < end) {
+        const Instruction &i = program.at(pc++);
+        switch (i.op) {
+        case Instruction::Text:
+            t += i.text;
+            break;
+        case Instruction::DisplayName:
+            t += displayString;
+            break;
+        case Instruction::Property:
+            if (values[i.key])
+                t += values[i.key]->toString();
+            else if (i.key == titleKey)
+                t += displayString;
+            break;
+        case Instruction::JumpIfMissing:
+            if (!values[i.key] && i.key != titleKey)
+                pc = i.target;
+            break;
+        case Instruction::JumpIfNotAudio:
+            if (fileType != Helpers::AudioFile)
+                pc = i.target;
+            break;
+        case Instruction::Jump:
+            pc = i.target;
+            break;
+        }
+    }
+    return t;
+}
+
+int DisplayParser::formatSerial() const
+{
+    return serial;
+}
+
+void DisplayParser::compile(DisplayNode *node)
+{
+    // A trie %prop{tag}{audio}{video} becomes:
+    //      JumpIfMissing prop -> audio
+    //      <tag> Jump -> end
+    //  audio:
+    //      JumpIfNotAudio -> video
+    //      <audio> Jump -> end
+    //  video:
+    //      <video>
+    //  end:
+    for (; node; node = node->next) {
+        switch (node->type) {
+        case DisplayNode::NullNode:
+            break;
+        case DisplayNode::PlainText:
+            program.append({ Instruction::Text, -1, -1, node->data });
+            break;
+        case DisplayNode::DisplayName:
+            program.append({ Instruction::DisplayName, -1, -1, QString() });
+            break;
+        case DisplayNode::Property:
+            program.append({ Instruction::Property, keyIndex(node->data), -1,
+                             QString() });
+            break;
+        case DisplayNode::Trie: {
+            int toAudio = program.count();
+            program.append({ Instruction::JumpIfMissing, keyIndex(node->data),
+                             -1, QString() });
+            compile(node->tagNode);
+            int tagDone = program.count();
+            program.append({ Instruction::Jump, -1, -1, QString() });
+
+            program[toAudio].target = program.count();
+            int toVideo = program.count();
+            program.append({ Instruction::JumpIfNotAudio, -1, -1, QString() });
+            compile(node->audioNode);
+            int audioDone = program.count();
+            program.append({ Instruction::Jump, -1, -1, QString() });
+
+            program[toVideo].target = program.count();
+            compile(node->videoNode);
+            program[tagDone].target = program.count();
+            program[audioDone].target = program.count();
+            break;
+        }
+        }
+    }
+}
+
+int DisplayParser::keyIndex(const QString &key)
+{
+    int index = keys.indexOf(key);
+    if (index >= 0)
+        return index;
+    keys.append(key);
+    if (key == "title")
+        titleKey = keys.count() - 1;
+    return keys.count() - 1;
 }
 
 
@@ -6,6 +6,8 @@
 #include <QWidget>
 #include <QSet>
 #include <QList>
+#include <QVector>
+#include <QStringList>
 #include <QUrl>
 #include <QUuid>
 #include <QOpenGLWidget>
@@ -26,7 +28,7 @@ namespace Helpers {
     enum ScreenshotRender { VideoRender, SubsRender, WindowRender };
     enum TitlePrefix { PrefixFullPath, PrefixFileName, NoPrefix };
     enum MpvWidgetType { NullWidget, EmbedWidget, GlCbWidget, VulkanCbWidget,
-                         CustomWidget };
+                         GlThreadWidget, CustomWidget };
     enum ControlHiding { NeverShown, ShowWhenMoving, ShowWhenHovering,
                          AlwaysShow };
     enum AfterPlayback { DoNothingAfter, RepeatAfter, PlayNextAfter,
@@ -37,6 +39,7 @@ namespace Helpers {
                       LongHourFormat, ShortHourFormat };
 
     extern QSet<QString> fileExtensions;
+    extern QSet<QString> videoExtensions;
     extern QSet<QString> subsExtensions;
 
     QString fileSizeToString(int64_t bytes);
@@ -54,7 +57,8 @@ namespace Helpers {
     QString fileOpenFilter();
     QString subsOpenFilter();
     bool urlSurvivesFilter(const QUrl &url);
-    QList<QUrl> filterUrls(const QList<QUrl> &urls);
+    QList<QUrl> filterUrls(const QList<QUrl> &urls,
+                           const QSet<QString> &extensions = fileExtensions);
     QRect vmapToRect(const QVariantMap &m);
     QVariantMap rectToVmap(const QRect &r);
     bool sizeFromString(QSize &size, const QString &text);
@@ -92,7 +96,7 @@ public:
     void setLogoUrl(const QString &filename);
     void setLogoBackground(const QColor &color);
     void resizeGL(int w, int h);
-    void paintGL(QOpenGLWidget *widget);
+    void paintGL(QWidget *widget);
 
 signals:
     void logoSize(QSize size);
@@ -126,6 +130,10 @@ private:
     QColor logoBackground;
 };
 
+// DisplayParser compiles a format string into a flat program.  Property
+// names are gathered into a key table, so formatting looks each one up at
+// most once per item.  formatSerial changes with every format string, so
+// callers can use it to cache the labels they make.
 class DisplayNode;
 class DisplayParser {
 public:
@@ -133,10 +141,28 @@ public:
     ~DisplayParser();
 
     void takeFormatString(QString fmt);
-    QString parseMetadata(QVariantMap metaData, QString displayString,
-                          Helpers::FileType fileType);
+    QString parseMetadata(const QVariantMap &metaData,
+                          const QString &displayString,
+                          Helpers::FileType fileType) const;
+    int formatSerial() const;
+
 private:
-    DisplayNode *node = nullptr;
+    struct Instruction {
+        enum Op { Text, DisplayName, Property, JumpIfMissing, JumpIfNotAudio,
+                  Jump };
+        Op op;
+        int key;
+        int target;
+        QString text;
+    };
+
+    void compile(DisplayNode *node);
+    int keyIndex(const QString &key);
+
+    QVector<Instruction> program;
+    QStringList keys;
+    int titleKey = -1;
+    int serial = 0;
 };
 
 class TrackInfo {
@@ -1,11 +1,22 @@
+#include <cctype>
+#include <cstring>
+#include <limits>
 #include <QLocalSocket>
 #include <QLocalServer>
 #include <QCoreApplication>
 #include <QMetaMethod>
+#include <QPointer>
+#include <QtEndian>
+#include <QCborMap>
+#include <QCborValue>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
 
 #include <mpv/client.h>
 
+#include "logger.h"
 #include "mainwindow.h"
 #include "manager.h"
 #include "mpvwidget.h"
@@ -36,6 +47,590 @@ Q_GLOBAL_STATIC_WITH_ARGS(QSet<QString>, bannedCommands, ({
     "suspend", "volume"
 }))
 
+// A connection with more than this waiting to be written is a slow reader.
+// Its events queue up to the message limit, after which property changes
+// are only coalesced and other events dropped.
+static const qint64 writeHighWater = 256 * 1024;
+static const int maxQueuedMessages = 1024;
+
+// Commands a client may have waiting on mpv before no more are read.
+static const int maxCommandsInFlight = 256;
+
+
+
+bool IpcFrameBuffer::readFrom(QIODevice *device)
+{
+    // Move what is left to the front once the spent part is the larger, so
+    // the buffer is reused instead of growing.
+    if (readPos > 0 && readPos >= buffer.size() - readPos) {
+        int left = buffer.size() - readPos;
+        memmove(buffer.data(), buffer.constData() + readPos, size_t(left));
+        buffer.resize(left);
+        scanPos -= readPos;
+        readPos = 0;
+    }
+    qint64 available = device->bytesAvailable();
+    if (available <= 0)
+        return false;
+    int size = buffer.size();
+    buffer.resize(size + int(available));
+    qint64 got = device->read(buffer.data() + size, available);
+    buffer.resize(size + int(qMax<qint64>(got, 0)));
+    return got > 0;
+}
+
+void IpcFrameBuffer::setFraming(IpcFrameBuffer::Framing framing)
+{
+    if (this->framing == framing)
+        return;
+    this->framing = framing;
+    scanPos = readPos;
+    discarding = false;
+}
+
+bool IpcFrameBuffer::takeFrame(QByteArray &frame)
+{
+    if (framing == LengthFraming)
+        return takeLengthFrame(frame);
+    while (true) {
+        const char *data = buffer.constData();
+        const char *newline = static_cast<const char*>(
+                    memchr(data + scanPos, '\n', size_t(buffer.size() - scanPos)));
+        if (!newline) {
+            scanPos = buffer.size();
+            // A line this long is not a command.  Skip to the end of it.
+            if (scanPos - readPos > maxFrameSize) {
+                if (!discarding)
+                    ++dropped;
+                discarding = true;
+                buffer.clear();
+                readPos = scanPos = 0;
+            }
+            return false;
+        }
+        int start = readPos;
+        int end = int(newline - data);
+        readPos = scanPos = end + 1;
+        if (discarding) {
+            discarding = false;
+            continue;
+        }
+        if (end == start)
+            continue;
+        frame = QByteArray::fromRawData(data + start, end - start);
+        return true;
+    }
+}
+
+bool IpcFrameBuffer::takeRemainder(QByteArray &frame)
+{
+    // Once the client has stopped sending, a last line without its newline
+    // is still a message.  Part of a CBOR frame is not.
+    if (!peekRemainder(frame))
+        return false;
+    readPos = scanPos = buffer.size();
+    return !frame.trimmed().isEmpty();
+}
+
+bool IpcFrameBuffer::peekRemainder(QByteArray &frame) const
+{
+    if (framing != LineFraming || discarding || readPos >= buffer.size())
+        return false;
+    frame = QByteArray::fromRawData(buffer.constData() + readPos, buffer.size() - readPos);
+    return true;
+}
+
+quint64 IpcFrameBuffer::droppedFrames() const
+{
+    return dropped;
+}
+
+bool IpcFrameBuffer::broken() const
+{
+    return lost;
+}
+
+bool IpcFrameBuffer::takeLengthFrame(QByteArray &frame)
+{
+    // There is nothing to find the next frame by after one that is too
+    // long, so the rest of the connection is lost.
+    if (lost || buffer.size() - readPos < 4)
+        return false;
+    const char *data = buffer.constData() + readPos;
+    quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data));
+    if (length > quint32(maxFrameSize)) {
+        ++dropped;
+        lost = true;
+        buffer.clear();
+        readPos = scanPos = 0;
+        return false;
+    }
+    if (buffer.size() - readPos - 4 < int(length))
+        return false;
+    frame = QByteArray::fromRawData(data + 4, int(length));
+    readPos = scanPos = readPos + 4 + int(length);
+    return true;
+}
+
+
+
+// JsonScanner reads the JSON values that commands are made of from a line.
+// Strings without escapes are decoded straight from the line.
+class JsonScanner
+{
+public:
+    JsonScanner(const char *begin, const char *end) : p(begin), end(end) {}
+
+    void skipSpace()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            ++p;
+    }
+
+    bool take(char c)
+    {
+        skipSpace();
+        if (p == end || *p != c)
+            return false;
+        ++p;
+        return true;
+    }
+
+    char peek()
+    {
+        skipSpace();
+        return p == end ? 0 : *p;
+    }
+
+    bool atEnd()
+    {
+        skipSpace();
+        return p == end;
+    }
+
+    // Reads a key that has no escapes in it.
+    bool readKey(const char *&key, int &length)
+    {
+        if (!take('"'))
+            return false;
+        key = p;
+        while (p < end && *p != '"' && *p != '\\')
+            ++p;
+        if (p == end || *p != '"')
+            return false;
+        length = int(p - key);
+        ++p;
+        return true;
+    }
+
+    bool readString(QString &s)
+    {
+        if (!take('"'))
+            return false;
+        const char *start = p;
+        while (p < end && *p != '"' && *p != '\\')
+            ++p;
+        if (p == end)
+            return false;
+        if (*p == '"') {
+            s = QString::fromUtf8(start, int(p - start));
+            ++p;
+            return true;
+        }
+        s = QString::fromUtf8(start, int(p - start));
+        while (p < end) {
+            if (*p == '"') {
+                ++p;
+                return true;
+            }
+            if (*p != '\\') {
+                start = p;
+                while (p < end && *p != '"' && *p != '\\')
+                    ++p;
+                s.append(QString::fromUtf8(start, int(p - start)));
+                continue;
+            }
+            if (++p == end)
+                return false;
+            switch (*p++) {
+            case '"': s.append(QLatin1Char('"')); break;
+            case '\\': s.append(QLatin1Char('\\')); break;
+            case '/': s.append(QLatin1Char('/')); break;
+            case 'b': s.append(QLatin1Char('\b')); break;
+            case 'f': s.append(QLatin1Char('\f')); break;
+            case 'n': s.append(QLatin1Char('\n')); break;
+            case 'r': s.append(QLatin1Char('\r')); break;
+            case 't': s.append(QLatin1Char('\t')); break;
+            case 'u': {
+                // Surrogate pairs come as two escapes, which is what QString
+                // wants anyway.
+                if (end - p < 4)
+                    return false;
+                bool ok;
+                ushort unit = QByteArray::fromRawData(p, 4).toUShort(&ok, 16);
+                if (!ok)
+                    return false;
+                s.append(QChar(unit));
+                p += 4;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Reads a string, number, bool or null.  Objects and arrays set nested
+    // instead, and are not read.
+    bool readScalar(QVariant &v, bool &nested)
+    {
+        nested = false;
+        char c = peek();
+        if (c == '"') {
+            QString s;
+            if (!readString(s))
+                return false;
+            v = s;
+            return true;
+        }
+        if (c == '{' || c == '[') {
+            nested = true;
+            return true;
+        }
+        if (readLiteral("true")) {
+            v = true;
+            return true;
+        }
+        if (readLiteral("false")) {
+            v = false;
+            return true;
+        }
+        if (readLiteral("null")) {
+            v = QVariant();
+            return true;
+        }
+        return readNumber(v);
+    }
+
+    // Skips over a value of any kind.
+    bool skipValue()
+    {
+        char c = peek();
+        if (c == '"') {
+            ++p;
+            while (p < end && *p != '"')
+                p += *p == '\\' ? 2 : 1;
+            if (p >= end)
+                return false;
+            ++p;
+            return true;
+        }
+        if (c != '{' && c != '[') {
+            QVariant v;
+            bool nested;
+            return readScalar(v, nested);
+        }
+        int depth = 0;
+        while (p < end) {
+            switch (*p) {
+            case '"':
+                if (!skipValue())
+                    return false;
+                continue;
+            case '{': case '[':
+                ++depth;
+                break;
+            case '}': case ']':
+                if (--depth == 0) {
+                    ++p;
+                    return true;
+                }
+                break;
+            }
+            ++p;
+        }
+        return false;
+    }
+
+private:
+    bool readLiteral(const char *literal)
+    {
+        int length = int(qstrlen(literal));
+        if (end - p < length || qstrncmp(p, literal, uint(length)))
+            return false;
+        p += length;
+        return true;
+    }
+
+    bool readNumber(QVariant &v)
+    {
+        const char *start = p;
+        bool integer = true;
+        while (p < end && (isdigit(uchar(*p)) || *p == '-' || *p == '+'
+                           || *p == '.' || *p == 'e' || *p == 'E')) {
+            if (*p == '.' || *p == 'e' || *p == 'E')
+                integer = false;
+            ++p;
+        }
+        if (p == start)
+            return false;
+        QByteArray text = QByteArray::fromRawData(start, int(p - start));
+        bool ok;
+        if (integer)
+            v = text.toLongLong(&ok);
+        else
+            v = text.toDouble(&ok);
+        return ok;
+    }
+
+    const char *p;
+    const char *end;
+};
+
+
+
+bool IpcWire::formatFromName(const QString &name, IpcWire::Format &format)
+{
+    if (name == "json")
+        format = Json;
+    else if (name == "cbor")
+        format = Cbor;
+    else
+        return false;
+    return true;
+}
+
+static QByteArray cborFrame(const QByteArray &cbor)
+{
+    QByteArray frame(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(quint32(cbor.size()), reinterpret_cast<uchar*>(frame.data()));
+    return frame.append(cbor);
+}
+
+static QByteArray jsonValue(const QJsonValue &value)
+{
+    // QJsonDocument only takes arrays and objects, so the value is written
+    // inside an array, and the brackets cut off.
+    QByteArray json = QJsonDocument(QJsonArray { value }).toJson(QJsonDocument::Compact);
+    return json.mid(1, json.size() - 2);
+}
+
+QByteArray IpcWire::message(const QVariant &v, IpcWire::Format format)
+{
+    if (format == Cbor)
+        return cborFrame(QCborValue::fromVariant(v).toCbor());
+    return QJsonDocument::fromVariant(v).toJson(QJsonDocument::Compact).append('\n');
+}
+
+bool IpcWire::decode(const QByteArray &frame, IpcWire::Format format, QVariantMap &map)
+{
+    if (format == Cbor) {
+        QCborParserError error;
+        QCborValue value = QCborValue::fromCbor(frame, &error);
+        if (error.error != QCborError::NoError || !value.isMap())
+            return false;
+        map = value.toMap().toVariantMap();
+        return true;
+    }
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(frame, &error);
+    if (error.error != QJsonParseError::NoError || !document.isObject())
+        return false;
+    map = document.object().toVariantMap();
+    return true;
+}
+
+QByteArray IpcWire::propertyChangePrefix(const QString &name, const QVariant &value,
+                                         const QByteArray &error, IpcWire::Format format)
+{
+    const char *event = mpv_event_name(MPV_EVENT_PROPERTY_CHANGE);
+    if (format == Cbor) {
+        // A map of up to 23 pairs has its size in the first byte, so the
+        // pairs can be written one at a time, with the id last.
+        QByteArray prefix(1, char(0xa0 + (error.isEmpty() ? 4 : 5)));
+        prefix.append(QCborValue("event").toCbor()).append(QCborValue(event).toCbor());
+        prefix.append(QCborValue("name").toCbor()).append(QCborValue(name).toCbor());
+        if (!error.isEmpty())
+            prefix.append(QCborValue("error").toCbor())
+                  .append(QCborValue(QString::fromUtf8(error)).toCbor());
+        prefix.append(QCborValue("data").toCbor())
+              .append(QCborValue::fromVariant(value).toCbor());
+        prefix.append(QCborValue("id").toCbor());
+        return prefix;
+    }
+    QByteArray line("{\"event\":\"");
+    line.append(event);
+    line.append("\",\"name\":").append(jsonValue(name));
+    if (!error.isEmpty())
+        line.append(",\"error\":\"").append(error).append('"');
+    line.append(",\"data\":").append(jsonValue(QJsonValue::fromVariant(value)));
+    line.append(",\"id\":");
+    return line;
+}
+
+QByteArray IpcWire::propertyChange(const QByteArray &prefix, uint64_t id,
+                                   IpcWire::Format format)
+{
+    // Observers are only taken with ids below 2^63, so both formats write
+    // the same number.
+    qint64 value = qint64(id);
+    if (format == Cbor)
+        return cborFrame(prefix + QCborValue(value).toCbor());
+    QByteArray line = prefix;
+    return line.append(QByteArray::number(value)).append("}\n");
+}
+
+
+
+IpcCommand::Result IpcCommand::parse(const QByteArray &frame)
+{
+    command.clear();
+    requestId = QVariant();
+
+    JsonScanner scan(frame.constBegin(), frame.constEnd());
+    if (!scan.take('{'))
+        return Invalid;
+    if (scan.take('}'))
+        return scan.atEnd() ? Parsed : Invalid;
+    do {
+        const char *key;
+        int length;
+        if (!scan.readKey(key, length))
+            return Fallback;
+        if (!scan.take(':'))
+            return Invalid;
+        bool nested;
+        if (length == 7 && !qstrncmp(key, "command", 7)) {
+            command.clear();
+            if (!scan.take('['))
+                return scan.peek() == '{' ? Fallback : Invalid;
+            if (scan.take(']'))
+                continue;
+            do {
+                QVariant v;
+                if (!scan.readScalar(v, nested))
+                    return Invalid;
+                if (nested)
+                    return Fallback;
+                command.append(v);
+            } while (scan.take(','));
+            if (!scan.take(']'))
+                return Invalid;
+        } else if (length == 10 && !qstrncmp(key, "request_id", 10)) {
+            if (!scan.readScalar(requestId, nested))
+                return Invalid;
+            if (nested)
+                return Fallback;
+        } else if (!scan.skipValue()) {
+            return Invalid;
+        }
+    } while (scan.take(','));
+    if (!scan.take('}') || !scan.atEnd())
+        return Invalid;
+    return Parsed;
+}
+
+
+
+IpcConnection::IpcConnection(QLocalSocket *socket, QObject *parent)
+    : QObject(parent), socket(socket)
+{
+    socket->setParent(this);
+    connect(socket, &QLocalSocket::readyRead,
+            this, &IpcConnection::socket_readyRead);
+    connect(socket, &QLocalSocket::disconnected,
+            this, &IpcConnection::socket_disconnected);
+    // Anything already sent waits until whoever made us is listening.
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(this, "socket_readyRead", Qt::QueuedConnection);
+}
+
+IpcWire::Format IpcConnection::wireFormat() const
+{
+    return wire;
+}
+
+bool IpcConnection::isOpen() const
+{
+    return socket->isOpen();
+}
+
+void IpcConnection::close()
+{
+    socket->disconnectFromServer();
+}
+
+void IpcConnection::setWireFormat(IpcWire::Format format)
+{
+    // Frames after the one being handled are cut the new way.
+    wire = format;
+    frames.setFraming(format == IpcWire::Cbor ? IpcFrameBuffer::LengthFraming
+                                              : IpcFrameBuffer::LineFraming);
+}
+
+void IpcConnection::readFrames()
+{
+    // Frames point into the buffer, so it must not be read into again while
+    // they are being handled.  While paused, commands are left in the socket
+    // so that the client feels the backpressure.
+    if (reading)
+        return;
+    reading = true;
+    QByteArray frame;
+    do {
+        while (!readingPaused() && frames.takeFrame(frame))
+            handleFrame(frame);
+    } while (!readingPaused() && frames.readFrom(socket));
+    // The socket is drained.  A client that never sends newlines gets its
+    // message handled now if what is left already makes one.
+    if (!readingPaused() && frames.peekRemainder(frame)
+            && isWholeMessage(frame) && frames.takeRemainder(frame))
+        handleFrame(frame);
+    reading = false;
+    if (frames.broken())
+        socket->disconnectFromServer();
+}
+
+bool IpcConnection::readingPaused() const
+{
+    return false;
+}
+
+bool IpcConnection::isWholeMessage(const QByteArray &rest) const
+{
+    Q_UNUSED(rest)
+    return false;
+}
+
+void IpcConnection::connectionClosed()
+{
+    deleteLater();
+}
+
+void IpcConnection::socket_readyRead()
+{
+    readFrames();
+}
+
+void IpcConnection::socket_disconnected()
+{
+    // What the client sent before closing is still carried out, even a last
+    // command without its newline.
+    if (!reading) {
+        reading = true;
+        QByteArray frame;
+        do {
+            while (frames.takeFrame(frame))
+                handleFrame(frame);
+        } while (frames.readFrom(socket));
+        if (frames.takeRemainder(frame))
+            handleFrame(frame);
+        reading = false;
+    }
+    connectionClosed();
+}
+
 
 
 JsonServer::JsonServer(const QString &socketName, QObject *parent) :
@@ -51,12 +646,16 @@ bool JsonServer::sendPayload(const QByteArray &payload)
 
 bool JsonServer::sendPayload(const QByteArray &payload, const QString &serverName)
 {
+    // Messages are one to a line, so the server only sees this once the
+    // newline arrives.
     QLocalSocket socket;
     socket.setServerName(serverName);
     socket.connectToServer();
     if (!socket.waitForConnected(100))
         return false;
     socket.write(payload);
+    if (!payload.endsWith('\n'))
+        socket.write("\n");
     return socket.waitForReadyRead(100);
 }
 
@@ -77,8 +676,18 @@ void JsonServer::listen()
     server->listen(socketName);
 }
 
+void JsonServer::setAccepting(bool yes)
+{
+    accepting = yes;
+    if (accepting && server)
+        while (server->hasPendingConnections())
+            server_newConnection();
+}
+
 void JsonServer::server_newConnection()
 {
+    if (!accepting)
+        return;
     QLocalSocket *connection = server->nextPendingConnection();
     if (connection)
         emit newConnection(connection);
@@ -105,7 +714,7 @@ bool MpcQtServer::sendIdentify()
 
 void MpcQtServer::fakePayload(const QByteArray &payload)
 {
-    socket_payloadReceived(payload, nullptr);
+    connection_payloadReceived(payload, nullptr);
 }
 
 QString MpcQtServer::defaultSocketName()
@@ -133,13 +742,16 @@ void MpcQtServer::setupIpcCommands()
     }
 }
 
-void MpcQtServer::socketReturn(QLocalSocket *socket,
-                               bool wasParsed, QVariant value)
+void MpcQtServer::socketReturn(MpcQtConnection *connection,
+                               bool wasParsed, QVariant value,
+                               const QVariant &requestId)
 {
-    if (!socket)
+    if (!connection || !connection->isOpen())
         return;
 
     QVariantMap result;
+    if (requestId.isValid())
+        result["request_id"] = requestId;
     if (!wasParsed) {
         result["code"] = "unknown";
         goto end;
@@ -152,9 +764,23 @@ void MpcQtServer::socketReturn(QLocalSocket *socket,
     }
     result["value"] = value;
     end:
-    socket->write(QJsonDocument::fromVariant(result).toJson(QJsonDocument::Compact).append('\n'));
-    socket->flush();
-    socket->deleteLater();
+    connection->reply(result);
+}
+
+std::function<void(QVariant)> MpcQtServer::replyLater(MpcQtConnection *connection,
+                                                      const QVariantMap &map)
+{
+    // Replies to commands that went to mpv come back when mpv is done with
+    // them, in whatever order that is.  The client may be gone by then,
+    // and a one-shot client that has closed its end can't be written to, so
+    // it gets nothing.
+    QPointer<MpcQtServer> self(this);
+    QPointer<MpcQtConnection> target(connection);
+    QVariant requestId = map.value("request_id");
+    return [self, target, requestId](QVariant value) {
+        if (self && target)
+            self->socketReturn(target, true, value, requestId);
+    };
 }
 
 void MpcQtServer::self_newConnection(QLocalSocket *socket)
@@ -164,39 +790,53 @@ void MpcQtServer::self_newConnection(QLocalSocket *socket)
         return;
     }
 
-    connect(socket, &QLocalSocket::readyRead, this, [=]() {
-        QList<QByteArray> dataList = socket->readAll().split('\n');
-        for (const QByteArray &data : dataList) {
-            if(data.size())
-                socket_payloadReceived(data, socket);
-        }
-    });
+    auto connection = new MpcQtConnection(socket, this);
+    connect(connection, &MpcQtConnection::payloadReceived,
+            this, &MpcQtServer::connection_payloadReceived);
 }
 
-void MpcQtServer::socket_payloadReceived(const QByteArray &payload,
-                                         QLocalSocket *socket)
+void MpcQtServer::connection_payloadReceived(const QByteArray &payload,
+                                             MpcQtConnection *connection)
 {
-    QJsonParseError parseError;
-    QVariantMap map = QJsonDocument::fromJson(payload, &parseError).toVariant().toMap();
-
-    if (!map.contains("command"))
-        socketReturn(socket, false);
+    // Messages that can't be made out are answered, and go no further.
+    QVariantMap map;
+    IpcWire::Format format = connection ? connection->wireFormat() : IpcWire::Json;
+    if (!IpcWire::decode(payload, format, map)) {
+        socketReturn(connection, true,
+                     QVariant::fromValue(MpvErrorCode(MPV_ERROR_INVALID_PARAMETER)));
+        return;
+    }
+    QString command = map.value("command").toString();
+    QVariant requestId = map.value("request_id");
+
+    // One-shot clients, such as socat, wait for the connection to close
+    // after the reply.  Clients that tag their commands with a request_id,
+    // ask for keepAlive, or switch the wire format may send several, so
+    // theirs stays open until they close it.
+    if (connection && (map.contains("request_id") || map.value("keepAlive").toBool()
+                       || command == "setWireFormat"))
+        connection->keepOpen();
+    if (command.isEmpty() || !ipcCommands.contains(command)) {
+        socketReturn(connection, false, QVariant(), requestId);
+        return;
+    }
 
-    QString command = map["command"].toString();
+    // Commands taking the connection as well answer it themselves, later.
     QVariant value;
-    if (ipcCommands.contains(command)) {
-        QMetaMethod method = ipcCommands[command];
-        if (ipcCommands[command].returnType() == QMetaType::QVariant)
-            method.invoke(this, Q_RETURN_ARG(QVariant, value),
-                                Q_ARG(QVariantMap, map));
-        else if (method.parameterCount())
-            method.invoke(this, Q_ARG(QVariantMap,map));
-        else
-            method.invoke(this);
-        socketReturn(socket, true, value);
-    } else {
-        socketReturn(socket, false);
+    QMetaMethod method = ipcCommands[command];
+    if (method.parameterCount() == 2) {
+        method.invoke(this, Q_ARG(QVariantMap, map),
+                            Q_ARG(MpcQtConnection*, connection));
+        return;
     }
+    if (method.returnType() == QMetaType::QVariant)
+        method.invoke(this, Q_RETURN_ARG(QVariant, value),
+                            Q_ARG(QVariantMap, map));
+    else if (method.parameterCount())
+        method.invoke(this, Q_ARG(QVariantMap,map));
+    else
+        method.invoke(this);
+    socketReturn(connection, true, value, requestId);
 }
 
 void MpcQtServer::ipc_identify()
@@ -290,36 +930,46 @@ void MpcQtServer::ipc_deltaExtraPlaytimes(const QVariantMap &map)
     playbackManager->deltaExtraPlaytimes(delta);
 }
 
-QVariant MpcQtServer::ipc_getMpvProperty(const QVariantMap &map)
+void MpcQtServer::ipc_getMpvProperty(const QVariantMap &map, MpcQtConnection *connection)
 {
-    if (!map.contains("name"))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
-    return mainWindow->mpvObject()->getMpvPropertyVariant(map["name"].toString());
+    auto reply = replyLater(connection, map);
+    if (!map.contains("name")) {
+        reply(QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    mainWindow->mpvObject()->getMpvPropertyAsync(map["name"].toString(), reply);
 }
 
-QVariant MpcQtServer::ipc_setMpvProperty(const QVariantMap &map)
+void MpcQtServer::ipc_setMpvProperty(const QVariantMap &map, MpcQtConnection *connection)
 {
+    auto reply = replyLater(connection, map);
     QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedProperties->contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
-
-    return mainWindow->mpvObject()->blockingSetMpvPropertyVariant(name, map["value"]);
+    if (name.isEmpty() || bannedProperties->contains(name)) {
+        reply(QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    mainWindow->mpvObject()->setMpvPropertyAsync(name, map["value"], reply);
 }
 
-QVariant MpcQtServer::ipc_setMpvOption(const QVariantMap &map)
+void MpcQtServer::ipc_setMpvOption(const QVariantMap &map, MpcQtConnection *connection)
 {
+    auto reply = replyLater(connection, map);
     QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedOptions->contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
-
-    return mainWindow->mpvObject()->blockingSetMpvOptionVariant(name, map["value"]);
+    if (name.isEmpty() || bannedOptions->contains(name)) {
+        reply(QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    mainWindow->mpvObject()->setMpvOptionAsync(name, map["value"], reply);
 }
 
-QVariant MpcQtServer::ipc_doMpvCommand(const QVariantMap &map)
+void MpcQtServer::ipc_doMpvCommand(const QVariantMap &map, MpcQtConnection *connection)
 {
+    auto reply = replyLater(connection, map);
     QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedCommands->contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+    if (name.isEmpty() || bannedCommands->contains(name)) {
+        reply(QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
 
     QVariantList command = { name };
     QVariant options = map.value("options");
@@ -330,12 +980,63 @@ QVariant MpcQtServer::ipc_doMpvCommand(const QVariantMap &map)
     else
         command.append(options);
     end:
-    return mainWindow->mpvObject()->blockingMpvCommand(QVariant(command));
+    mainWindow->mpvObject()->mpvCommandAsync(QVariant(command), reply);
+}
+
+void MpcQtServer::ipc_setWireFormat(const QVariantMap &map, MpcQtConnection *connection)
+{
+    // The reply is still in the old format.
+    IpcWire::Format format;
+    if (!IpcWire::formatFromName(map.value("format").toString(), format)) {
+        socketReturn(connection, true, QVariant::fromValue(MpvErrorCode(MPV_ERROR_INVALID_PARAMETER)),
+                     map.value("request_id"));
+        return;
+    }
+    socketReturn(connection, true, QVariant(), map.value("request_id"));
+    if (connection)
+        connection->setWireFormat(format);
+}
+
+
+
+MpcQtConnection::MpcQtConnection(QLocalSocket *socket, QObject *parent)
+    : IpcConnection(socket, parent)
+{
+}
+
+void MpcQtConnection::keepOpen()
+{
+    keptOpen = true;
 }
 
+void MpcQtConnection::reply(const QVariantMap &map)
+{
+    socket->write(IpcWire::message(map, wireFormat()));
+    if (!keptOpen)
+        close();
+}
+
+void MpcQtConnection::handleFrame(const QByteArray &frame)
+{
+    emit payloadReceived(frame, this);
+}
 
-MpvServer::MpvServer(QObject *parent)
-    : JsonServer(QCoreApplication::organizationDomain() + ".mpv", parent)
+bool MpcQtConnection::isWholeMessage(const QByteArray &rest) const
+{
+    // Older senders wrote one object and waited for the reply without a
+    // newline.  Only a closing brace is worth trying to parse.
+    QByteArray trimmed = rest.trimmed();
+    if (!trimmed.endsWith('}'))
+        return false;
+    QJsonParseError error;
+    QJsonDocument::fromJson(trimmed, &error);
+    return error.error == QJsonParseError::NoError;
+}
+
+
+MpvServer::MpvServer(QObject *parent, const QString &socketName)
+    : JsonServer(socketName.isEmpty() ? QCoreApplication::organizationDomain() + ".mpv"
+                                      : socketName, parent)
 {
     connect(this, &MpvServer::newConnection,
             this, &MpvServer::server_newConnection);
@@ -348,7 +1049,117 @@ void MpvServer::setPlaybackManger(PlaybackManager *manager)
 
 void MpvServer::setMpvObject(MpvObject *object)
 {
+    if (mpvObject)
+        disconnect(mpvObject->controller(), nullptr, this, nullptr);
     mpvObject = object;
+    if (mpvObject)
+        connect(mpvObject->controller(), &MpvController::eventBatch,
+                this, &MpvServer::ctrl_eventBatch);
+}
+
+int MpvServer::observeProperty(MpvConnection *connection, uint64_t id,
+                               const QString &name, int format)
+{
+    QPair<QString,int> key(name, format);
+    uint64_t subscription = subscriptionIds.value(key, 0);
+    if (!subscription) {
+        subscription = nextSubscriptionId++;
+        MpvController::PropertyList property = {
+            { name, subscription, static_cast<mpv_format>(format) }
+        };
+        int err = mpvObject->controller()->observeProperties(property);
+        if (err < 0)
+            return err;
+        subscriptionIds.insert(key, subscription);
+        subscriptions.insert(subscription, { name, format, {}, QVariant(), false });
+    }
+    Subscription &s = subscriptions[subscription];
+    s.subscribers[connection].insert(id);
+    // mpv only sends the current value to the first observer, so latecomers
+    // get the one we last saw.  Only the new id gets it, as the connection's
+    // other ids have it already.
+    if (s.hasValue)
+        connection->writePropertyChange(subscription, id);
+    return MPV_ERROR_SUCCESS;
+}
+
+int MpvServer::unobserveProperty(MpvConnection *connection, uint64_t id)
+{
+    QList<uint64_t> matching;
+    for (auto it = subscriptions.cbegin(); it != subscriptions.cend(); ++it)
+        if (it.value().subscribers.value(connection).contains(id))
+            matching.append(it.key());
+    for (uint64_t subscription : matching)
+        removeSubscriber(subscription, connection, { id });
+    return MPV_ERROR_SUCCESS;
+}
+
+QByteArray MpvServer::propertyChangePrefix(const MpvServer::Subscription &s,
+                                           IpcWire::Format format)
+{
+    QVariant value = s.lastValue;
+    QByteArray error;
+    if (value.canConvert<MpvErrorCode>()) {
+        error = mpv_error_string(value.value<MpvErrorCode>().errorcode());
+        value = QVariant();
+    }
+    return IpcWire::propertyChangePrefix(s.name, value, error, format);
+}
+
+QByteArray MpvServer::propertyChangeLine(uint64_t subscription, MpvConnection *connection,
+                                         uint64_t id, IpcWire::Format format)
+{
+    // Connections ask for this when they flush, so a value that changed
+    // several times in between is only written once, with its latest value.
+    // Everything but the id is the same for every subscriber, so that part
+    // is only written once for each format in use.
+    auto it = subscriptions.find(subscription);
+    if (it == subscriptions.end() || !it->subscribers.value(connection).contains(id))
+        return QByteArray();
+    QByteArray &prefix = it->prefixes[format];
+    if (prefix.isEmpty())
+        prefix = propertyChangePrefix(*it, format);
+    return IpcWire::propertyChange(prefix, id, format);
+}
+
+void MpvServer::sendPropertyChange(uint64_t subscription)
+{
+    const Subscription &s = subscriptions[subscription];
+    for (auto it = s.subscribers.cbegin(); it != s.subscribers.cend(); ++it) {
+        for (uint64_t id : it.value())
+            it.key()->writePropertyChange(subscription, id);
+    }
+}
+
+void MpvServer::sendEvent(const QVariantMap &map)
+{
+    QByteArray messages[IpcWire::FormatCount];
+    for (MpvConnection *connection : connections) {
+        IpcWire::Format format = connection->wireFormat();
+        if (messages[format].isEmpty())
+            messages[format] = IpcWire::message(map, format);
+        connection->writeEvent(messages[format]);
+    }
+}
+
+void MpvServer::removeSubscriber(uint64_t subscription, MpvConnection *connection,
+                                 const QSet<uint64_t> &ids)
+{
+    auto it = subscriptions.find(subscription);
+    if (it == subscriptions.end())
+        return;
+    auto subscriber = it->subscribers.find(connection);
+    if (subscriber == it->subscribers.end())
+        return;
+    subscriber->subtract(ids);
+    if (!subscriber->isEmpty())
+        return;
+    it->subscribers.erase(subscriber);
+    if (!it->subscribers.isEmpty())
+        return;
+    mpvObject->controller()->unobservePropertiesById({ subscription });
+    subscriptionIds.remove(qMakePair(it->name, it->format));
+    subscriptions.erase(it);
 }
 
 void MpvServer::server_newConnection(QLocalSocket *socket)
@@ -359,23 +1170,76 @@ void MpvServer::server_newConnection(QLocalSocket *socket)
     }
 
     qDebug() << "[ipc] new mpv connection";
-    new MpvConnection(socket, playbackManager, mpvObject, this);
+    auto connection = new MpvConnection(socket, playbackManager, mpvObject, this);
+    connect(connection, &MpvConnection::disconnected,
+            this, &MpvServer::connection_disconnected);
+    connections.append(connection);
 }
 
-MpvConnection::MpvConnection(QLocalSocket *socket, PlaybackManager *manager,
-                             MpvObject *mpvObject, QObject *parent)
-    : QObject(parent), socket(socket), manager(manager), mpvObject(mpvObject)
-{
-    MpvController* ctrl = mpvObject->controller();
-    connect(ctrl, &MpvController::mpvPropertyChanged,
-            this, &MpvConnection::ctrl_mpvPropertyChanged);
-    connect(ctrl, &MpvController::clientMessage,
-            this, &MpvConnection::ctrl_clientMessage);
-    connect(ctrl, &MpvController::videoSizeChanged,
-            this, &MpvConnection::ctrl_videoSizeChanged);
-    connect(ctrl, &MpvController::unhandledMpvEvent,
-            this, &MpvConnection::ctrl_unhandledMpvEvent);
+void MpvServer::connection_disconnected(MpvConnection *connection)
+{
+    connections.removeAll(connection);
+    QList<uint64_t> subscribed;
+    for (auto it = subscriptions.cbegin(); it != subscriptions.cend(); ++it)
+        if (it.value().subscribers.contains(connection))
+            subscribed.append(it.key());
+    for (uint64_t subscription : subscribed)
+        removeSubscriber(subscription, connection,
+                         subscriptions[subscription].subscribers.value(connection));
+}
+
+void MpvServer::ctrl_eventBatch(const MpvEventBatch &batch)
+{
+    for (const MpvEventBatch::Entry &e : batch.entries) {
+        if (e.superseded)
+            continue;
+        switch (e.kind) {
+        case MpvEventBatch::PropertyChange: {
+            auto it = subscriptions.find(e.userData);
+            if (!e.userData || it == subscriptions.end())
+                break;
+            it->lastValue = e.value;
+            it->hasValue = true;
+            for (QByteArray &prefix : it->prefixes)
+                prefix.clear();
+            sendPropertyChange(e.userData);
+            break;
+        }
+        case MpvEventBatch::ClientMessage: {
+            QVariantMap map {
+                { "event", mpv_event_name(MPV_EVENT_CLIENT_MESSAGE) },
+                { "id", static_cast<unsigned long long>(e.userData) },
+                { "args", e.detail->args }
+            };
+            sendEvent(map);
+            break;
+        }
+        case MpvEventBatch::VideoSizeChange: {
+            QVariantMap map {
+                { "event", mpv_event_name(MPV_EVENT_VIDEO_RECONFIG) }
+            };
+            sendEvent(map);
+            break;
+        }
+        case MpvEventBatch::Unhandled: {
+            QVariantMap map {
+                { "event", mpv_event_name(static_cast<mpv_event_id>(e.eventId)) }
+            };
+            sendEvent(map);
+            break;
+        }
+        case MpvEventBatch::FastPropertyChange:
+        case MpvEventBatch::Hook:
+            break;
+        }
+    }
+}
 
+MpvConnection::MpvConnection(QLocalSocket *socket, PlaybackManager *manager,
+                             MpvObject *mpvObject, MpvServer *server)
+    : IpcConnection(socket, server), manager(manager), mpvObject(mpvObject),
+      server(server)
+{
     int methodCount = metaObject()->methodCount();
     for (int i = 0; i < methodCount; i++) {
         auto method = metaObject()->method(i);
@@ -384,24 +1248,98 @@ MpvConnection::MpvConnection(QLocalSocket *socket, PlaybackManager *manager,
     }
     commandParsers.remove("raw");
 
-    connect(socket, &QLocalSocket::readyRead,
-            this, &MpvConnection::socket_readyRead);
-    connect(socket, &QLocalSocket::disconnected,
-            this, &MpvConnection::socket_disconnected);
-    if (socket->bytesAvailable())
-        socket_readyRead();
-
+    connect(socket, &QLocalSocket::bytesWritten,
+            this, &MpvConnection::socket_bytesWritten);
 }
 
 MpvConnection::~MpvConnection()
 {
+    LogStream("ipc") << "mpv connection closed: " << messagesSent << " messages, "
+                     << bytesSent << " bytes written, " << messagesCoalesced
+                     << " coalesced, " << messagesDropped << " dropped";
+}
+
+void MpvConnection::writePropertyChange(uint64_t subscription, uint64_t id)
+{
+    // Nothing is written yet, so a change that replaces one still waiting
+    // costs only the lookup.
+    QPair<uint64_t,uint64_t> key(subscription, id);
+    if (queuedProperties.contains(key)) {
+        ++messagesCoalesced;
+        return;
+    }
+    if (queue.size() >= maxQueuedMessages) {
+        ++messagesDropped;
+        return;
+    }
+    queuedProperties.insert(key);
+    queue.append({ QByteArray(), subscription, id });
+    scheduleFlush();
+}
 
+void MpvConnection::writeEvent(const QByteArray &line)
+{
+    queueLine(line, Event);
 }
 
 void MpvConnection::socketWrite(const QVariant &v)
 {
-    socket->write(QJsonDocument::fromVariant(v).toJson(QJsonDocument::Compact).append('\n'));
-    socket->flush();
+    queueLine(IpcWire::message(v, wireFormat()), Reply);
+}
+
+void MpvConnection::queueLine(const QByteArray &line, MessageKind kind)
+{
+    // Replies are never dropped.  Instead, commands stop being read until
+    // the client catches up.
+    if (kind != Reply && queue.size() >= maxQueuedMessages) {
+        ++messagesDropped;
+        return;
+    }
+    queue.append({ line, 0, 0 });
+    scheduleFlush();
+}
+
+void MpvConnection::scheduleFlush()
+{
+    if (!flushScheduled) {
+        flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushWrites", Qt::QueuedConnection);
+    }
+}
+
+void MpvConnection::writeQueuedProperties()
+{
+    // Unsubscribed ids come back empty, and are left out.
+    for (Message &m : queue) {
+        if (!m.subscription)
+            continue;
+        m.line = server->propertyChangeLine(m.subscription, this, m.id, wireFormat());
+        m.subscription = 0;
+    }
+    queuedProperties.clear();
+}
+
+void MpvConnection::flushWrites()
+{
+    flushScheduled = false;
+    if (queue.isEmpty() || !socket->isOpen() || socket->bytesToWrite() > writeHighWater)
+        return;
+
+    writeQueuedProperties();
+    int size = 0;
+    int messages = 0;
+    for (const Message &m : queue) {
+        size += m.line.size();
+        messages += !m.line.isEmpty();
+    }
+    QByteArray data;
+    data.reserve(size);
+    for (const Message &m : queue)
+        data.append(m.line);
+    socket->write(data);
+    bytesSent += quint64(size);
+    messagesSent += quint64(messages);
+    queue.clear();
 }
 
 void MpvConnection::commandReturn(int errorCode, QVariant requestId, QVariant data)
@@ -423,112 +1361,110 @@ void MpvConnection::commandReturnVariant(const QVariant &requestId, const QVaria
         commandReturn(MPV_ERROR_SUCCESS, requestId, data);
 }
 
-void MpvConnection::socket_readyRead()
+void MpvConnection::handleFrame(const QByteArray &frame)
 {
-    QList<QByteArray> dataList = socket->readAll().split('\n');
-    for(QByteArray &data : dataList) {
-        if(!data.size())
-            continue;
-
-        QVariantMap rawCommand = QJsonDocument::fromJson(data).toVariant().toMap();
-        QVariant requestId = rawCommand["request_id"];
-
-        QStringList list = rawCommand["command"].toStringList();
-        if (list.isEmpty()) {
-            commandReturn(MPV_ERROR_UNSUPPORTED, requestId);
+    // Messages that can't be made out are answered, with the request_id if
+    // it was read before things went wrong, and go no further.
+    if (wireFormat() == IpcWire::Cbor) {
+        QVariantMap rawCommand;
+        if (!IpcWire::decode(frame, IpcWire::Cbor, rawCommand)) {
+            commandReturn(MPV_ERROR_INVALID_PARAMETER, QVariant());
             return;
         }
-
-        QString command = list.at(0);
-        if (commandParsers.contains(command)) {
-            QMetaMethod m = commandParsers[command];
-            switch (m.parameterCount()) {
-            case 2:
-                if (Q_UNLIKELY(m.parameterType(0) == QMetaType::QVariantList))
-                    m.invoke(this, Q_ARG(QVariantList, rawCommand["command"].toList()),
-                            Q_ARG(QVariant, requestId));
-                else
-                    m.invoke(this, Q_ARG(QStringList, list),
-                             Q_ARG(QVariant, requestId));
-                break;
-            case 1:
-                m.invoke(this, Q_ARG(QVariant, requestId));
-                break;
-            case 0:
-                m.invoke(this);
-                break;
+        parsed.command = rawCommand["command"].toList();
+        parsed.requestId = rawCommand["request_id"];
+    } else {
+        IpcCommand::Result result = parsed.parse(frame);
+        if (result == IpcCommand::Fallback) {
+            QJsonParseError error;
+            QJsonDocument document = QJsonDocument::fromJson(frame, &error);
+            if (error.error != QJsonParseError::NoError || !document.isObject()) {
+                result = IpcCommand::Invalid;
+            } else {
+                QVariantMap rawCommand = document.toVariant().toMap();
+                parsed.command = rawCommand["command"].toList();
+                parsed.requestId = rawCommand["request_id"];
             }
         }
-        else if (bannedCommands->contains(command))
-            command_forbidden();
-        else
-            command_raw(list, requestId);
+        if (result == IpcCommand::Invalid) {
+            commandReturn(MPV_ERROR_INVALID_PARAMETER, parsed.requestId);
+            return;
+        }
     }
-}
-
-void MpvConnection::socket_disconnected()
-{
-    deleteLater();
-}
-
-void MpvConnection::ctrl_mpvPropertyChanged(QString name, const QVariant &v,
-                                            uint64_t userData)
-{
-    if (!userData)
+    const QVariant &requestId = parsed.requestId;
+
+    QStringList list;
+    list.reserve(parsed.command.size());
+    for (const QVariant &v : parsed.command)
+        list.append(v.toString());
+    if (list.isEmpty()) {
+        commandReturn(MPV_ERROR_UNSUPPORTED, requestId);
         return;
+    }
 
-    QVariantMap map {
-        { "event", mpv_event_name(MPV_EVENT_PROPERTY_CHANGE) },
-        { "name", name },
-        { "id", static_cast<unsigned long long>(userData) }
-    };
-    if (v.canConvert<MpvErrorCode>()) {
-        map.insert("error", mpv_error_string(v.value<MpvErrorCode>().errorcode()));
-        map.insert("data", QVariant());
-    } else {
-        map.insert("data", v);
+    QString command = list.at(0);
+    if (commandParsers.contains(command)) {
+        QMetaMethod m = commandParsers[command];
+        switch (m.parameterCount()) {
+        case 2:
+            if (Q_UNLIKELY(m.parameterType(0) == QMetaType::QVariantList))
+                m.invoke(this, Q_ARG(QVariantList, parsed.command),
+                        Q_ARG(QVariant, requestId));
+            else
+                m.invoke(this, Q_ARG(QStringList, list),
+                         Q_ARG(QVariant, requestId));
+            break;
+        case 1:
+            m.invoke(this, Q_ARG(QVariant, requestId));
+            break;
+        case 0:
+            m.invoke(this);
+            break;
+        }
     }
-    socketWrite(map);
+    else if (bannedCommands->contains(command))
+        command_forbidden();
+    else
+        command_raw(list, requestId);
 }
 
-void MpvConnection::ctrl_logMessage(QString message)
+bool MpvConnection::readingPaused() const
 {
-    // no connection -- if you're parsing log messages for anything useful,
-    // you're insane.  Doesn't mean I may not get to it later though.
-    Q_UNUSED(message)
+    return queue.size() >= maxQueuedMessages || inFlight >= maxCommandsInFlight;
 }
 
-void MpvConnection::ctrl_clientMessage(uint64_t id, const QStringList &args)
+std::function<void(QVariant)> MpvConnection::replyLater(const QVariant &requestId)
 {
-    QVariantMap map {
-        { "event", mpv_event_name(MPV_EVENT_CLIENT_MESSAGE) },
-        { "id", static_cast<unsigned long long>(id) },
-        { "args", args }
+    // Replies go out as mpv finishes each command, matched by request_id.
+    // Reading resumes here if too many commands were waiting.
+    ++inFlight;
+    QPointer<MpvConnection> self(this);
+    return [self, requestId](QVariant data) {
+        if (!self)
+            return;
+        --self->inFlight;
+        self->commandReturnVariant(requestId, data);
+        self->readFrames();
     };
-    socketWrite(map);
 }
 
-void MpvConnection::ctrl_videoSizeChanged(const QSize &size)
+void MpvConnection::socket_bytesWritten()
 {
-    Q_UNUSED(size)
-    QVariantMap map {
-        { "event", mpv_event_name(MPV_EVENT_VIDEO_RECONFIG) },
-    };
-    socketWrite(map);
+    if (queue.isEmpty() || socket->bytesToWrite() > writeHighWater)
+        return;
+    flushWrites();
+    readFrames();
 }
 
-void MpvConnection::ctrl_unhandledMpvEvent(int eventNumber)
+void MpvConnection::connectionClosed()
 {
-    QVariantMap map {
-        { "event", mpv_event_name(static_cast<mpv_event_id>(eventNumber)) }
-    };
-    socketWrite(map);
+    emit disconnected(this);
+    deleteLater();
 }
 
 void MpvConnection::command_raw(const QStringList &list, const QVariant &requestId)
 {
-    QVariant v = mpvObject->controller()->command(list);
-    commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    mpvObject->mpvCommandAsync(list, replyLater(requestId));
 }
 
 void MpvConnection::command_forbidden()
@@ -563,7 +1499,7 @@ void MpvConnection::command_get_property(const QStringList &list,
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
         return;
     }
-    commandReturnVariant(requestId, mpvObject->controller()->getPropertyVariant(list.at(1)));
+    mpvObject->getMpvPropertyAsync(list.at(1), replyLater(requestId));
 }
 
 void MpvConnection::command_get_property_string(const QStringList &list,
@@ -573,31 +1509,46 @@ void MpvConnection::command_get_property_string(const QStringList &list,
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
         return;
     }
-    QString s = mpvObject->controller()->getPropertyString(list.at(1));
-    if (s.isEmpty())
-        commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId, QVariant(static_cast<char*>(nullptr)));
-    else
-        commandReturn(MPV_ERROR_SUCCESS, requestId, s);
+    auto reply = replyLater(requestId);
+    mpvObject->getMpvPropertyStringAsync(list.at(1), [reply](QVariant data) {
+        if (data.canConvert<MpvErrorCode>())
+            reply(data);
+        else if (data.toString().isEmpty())
+            reply(QVariant::fromValue<MpvErrorCode>(
+                      MpvErrorCode(MPV_ERROR_INVALID_PARAMETER)));
+        else
+            reply(data.toString());
+    });
 }
 
 void MpvConnection::command_set_property(const QVariantList &list,
                                          const QVariant &requestId)
 {
-    if (list.count() != 2
+    if (list.count() != 3
             || !list.at(1).canConvert<QString>()
             || bannedProperties->contains(list.at(1).toString()))
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
     else
-        commandReturn(mpvObject->controller()->setPropertyVariant(list.at(1).toString(), list.at(2)), requestId);
+        mpvObject->setMpvPropertyAsync(list.at(1).toString(), list.at(2),
+                                       replyLater(requestId));
 }
 
 void MpvConnection::command_set_property_string(const QStringList &list,
                                                 const QVariant &requestId)
 {
-    if (list.count() != 2)
+    if (list.count() != 3 || bannedProperties->contains(list.at(1)))
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
     else
-        commandReturn(mpvObject->controller()->setPropertyString(list.at(1), list.at(2)), requestId);
+        mpvObject->setMpvPropertyAsync(list.at(1), list.at(2), replyLater(requestId));
+}
+
+// Zero is ours, and CBOR has no signed integer past 2^63 - 1 to write the id
+// back with, so those are turned away.
+static bool observeId(const QVariant &v, uint64_t &id)
+{
+    bool ok = false;
+    id = v.toULongLong(&ok);
+    return ok && id != 0 && id <= uint64_t(std::numeric_limits<qint64>::max());
 }
 
 void MpvConnection::command_observe_property(const QVariantList &list,
@@ -605,15 +1556,13 @@ void MpvConnection::command_observe_property(const QVariantList &list,
 {
     uint64_t id;
     if (list.count() != 3
-            || (id = list.at(1).toULongLong())==0
+            || !observeId(list.at(1), id)
             || !list.at(2).canConvert<QString>()) {
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
         return;
     }
-    MpvController::PropertyList property = {
-        { list[2].toString(), id, MPV_FORMAT_NODE }
-    };
-    commandReturn(mpvObject->controller()->observeProperties(property), requestId);
+    commandReturn(server->observeProperty(this, id, list[2].toString(), MPV_FORMAT_NODE),
+                  requestId);
 }
 
 void MpvConnection::command_observe_property_string(const QVariantList &list,
@@ -621,20 +1570,50 @@ void MpvConnection::command_observe_property_string(const QVariantList &list,
 {
     uint64_t id;
     if (list.count() != 3
-            || (id = list.at(1).toULongLong())==0
+            || !observeId(list.at(1), id)
             || !list.at(2).canConvert<QString>())
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
     else
-        commandReturn(mpvObject->controller()->observeProperties({{list[2].toString(), id, MPV_FORMAT_STRING}}), requestId);
+        commandReturn(server->observeProperty(this, id, list[2].toString(), MPV_FORMAT_STRING),
+                      requestId);
 }
 
 void MpvConnection::command_unobserve_property(const QVariantList &list,
                                                const QVariant &requestId)
 {
     uint64_t id;
-    if (list.count() != 2 || (id = list.at(1).toULongLong())==0)
+    if (list.count() != 2 || !observeId(list.at(1), id))
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
     else
-        commandReturn(mpvObject->controller()->unobservePropertiesById(QSet<uint64_t>() << id), requestId);
+        commandReturn(server->unobserveProperty(this, id), requestId);
+}
+
+void MpvConnection::command_get_connection_stats(const QVariant &requestId)
+{
+    QVariantMap stats {
+        { "bytes", static_cast<unsigned long long>(bytesSent) },
+        { "messages", static_cast<unsigned long long>(messagesSent) },
+        { "coalesced", static_cast<unsigned long long>(messagesCoalesced) },
+        { "dropped", static_cast<unsigned long long>(messagesDropped) },
+        { "queued", queue.size() },
+        { "mpv", mpvObject->eventStats() }
+    };
+    commandReturn(MPV_ERROR_SUCCESS, requestId, stats);
 }
 
+void MpvConnection::command_set_wire_format(const QStringList &list,
+                                            const QVariant &requestId)
+{
+    // The reply is still in the old format.  Everything after it, both ways,
+    // is in the new one.
+    IpcWire::Format format;
+    if (list.count() != 2 || !IpcWire::formatFromName(list.at(1), format)) {
+        commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
+        return;
+    }
+    commandReturn(MPV_ERROR_SUCCESS, requestId);
+    // Property changes still waiting were sent before the reply, so they
+    // are written in the old format now.
+    writeQueuedProperties();
+    setWireFormat(format);
+}
@@ -5,11 +5,118 @@
 #include <QVariant>
 #include <QSharedPointer>
 #include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QVector>
 #include <QMetaMethod>
 #include <QSize>
+#include <functional>
 
+class QIODevice;
 class QLocalServer;
 class QLocalSocket;
+
+// IpcFrameBuffer holds what has been read from a connection until it makes
+// whole messages, so that a message split across reads is only parsed once
+// all of it has arrived.  JSON messages end with a newline, and CBOR ones
+// start with their length as four big-endian bytes.  Frames handed out by
+// takeFrame and takeRemainder point into the buffer, and are only good until
+// the next readFrom.
+class IpcFrameBuffer
+{
+public:
+    enum Framing { LineFraming, LengthFraming };
+    static const int maxFrameSize = 4 * 1024 * 1024;
+
+    void setFraming(Framing framing);
+    bool readFrom(QIODevice *device);
+    bool takeFrame(QByteArray &frame);
+    bool takeRemainder(QByteArray &frame);
+    bool peekRemainder(QByteArray &frame) const;
+    quint64 droppedFrames() const;
+    bool broken() const;
+
+private:
+    bool takeLengthFrame(QByteArray &frame);
+
+    Framing framing = LineFraming;
+    QByteArray buffer;
+    int readPos = 0;
+    int scanPos = 0;
+    bool discarding = false;
+    bool lost = false;
+    quint64 dropped = 0;
+};
+
+
+// IpcCommand takes the command array and request id straight from a line
+// of JSON, without making a document out of it first.  Lines it can't
+// follow, such as commands with objects for arguments, are left for
+// QJsonDocument.
+class IpcCommand
+{
+public:
+    enum Result { Parsed, Fallback, Invalid };
+
+    Result parse(const QByteArray &frame);
+
+    QVariantList command;
+    QVariant requestId;
+};
+
+
+// IpcWire writes messages in the format a connection speaks.  Connections
+// start out with JSON, and may switch to CBOR after asking for it.
+namespace IpcWire {
+    enum Format { Json, Cbor, FormatCount };
+
+    bool formatFromName(const QString &name, Format &format);
+    QByteArray message(const QVariant &v, Format format);
+    // False unless the frame is a whole map.
+    bool decode(const QByteArray &frame, Format format, QVariantMap &map);
+
+    // A property change is the same for everyone but the id, so the rest is
+    // written once with propertyChangePrefix.
+    QByteArray propertyChangePrefix(const QString &name, const QVariant &value,
+                                    const QByteArray &error, Format format);
+    QByteArray propertyChange(const QByteArray &prefix, uint64_t id, Format format);
+}
+
+
+// IpcConnection reads a client's messages, cut up in the wire format it
+// speaks, and hands each to handleFrame.  It owns the socket, and goes away
+// once the client has closed it.
+class IpcConnection : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IpcConnection(QLocalSocket *socket, QObject *parent = nullptr);
+    IpcWire::Format wireFormat() const;
+    void setWireFormat(IpcWire::Format format);
+    bool isOpen() const;
+    // Closes the connection once everything written has gone out.
+    void close();
+
+protected:
+    void readFrames();
+    virtual void handleFrame(const QByteArray &frame) = 0;
+    virtual bool readingPaused() const;
+    virtual bool isWholeMessage(const QByteArray &rest) const;
+    virtual void connectionClosed();
+
+    QLocalSocket *socket = nullptr;
+
+private slots:
+    void socket_readyRead();
+    void socket_disconnected();
+
+private:
+    IpcFrameBuffer frames;
+    IpcWire::Format wire = IpcWire::Json;
+    bool reading = false;
+};
+
+
 class JsonServer : public QObject
 {
     Q_OBJECT
@@ -19,6 +126,8 @@ public:
     static bool sendPayload(const QByteArray &payload, const QString &serverName);
     QString fullServerName();
     void listen();
+    // Connections made while not accepting wait until accepting resumes.
+    void setAccepting(bool yes);
 
 signals:
     void newConnection(QLocalSocket *socket);
@@ -30,11 +139,13 @@ private slots:
 private:
     QString socketName;
     QLocalServer *server = nullptr;
+    bool accepting = true;
 };
 
 
 class MainWindow;
 class PlaybackManager;
+class MpcQtConnection;
 class MpcQtServer : public JsonServer
 {
     Q_OBJECT
@@ -52,13 +163,16 @@ signals:
 
 private:
     void setupIpcCommands();
-    void socketReturn(QLocalSocket *socket, bool wasParsed,
-                      QVariant value = QVariant());
+    void socketReturn(MpcQtConnection *connection, bool wasParsed,
+                      QVariant value = QVariant(),
+                      const QVariant &requestId = QVariant());
+    std::function<void(QVariant)> replyLater(MpcQtConnection *connection,
+                                             const QVariantMap &map);
 
 private slots:
     void self_newConnection(QLocalSocket *socket);
-    void socket_payloadReceived(const QByteArray &payload,
-                                QLocalSocket *socket);
+    void connection_payloadReceived(const QByteArray &payload,
+                                    MpcQtConnection *connection);
     void ipc_identify();
     void ipc_playFiles(const QVariantMap &map);
     void ipc_play(const QVariantMap &map);
@@ -71,10 +185,11 @@ private slots:
     void ipc_repeat();
     void ipc_togglePlayback();
     void ipc_deltaExtraPlaytimes(const QVariantMap &map);
-    QVariant ipc_getMpvProperty(const QVariantMap &map);
-    QVariant ipc_setMpvProperty(const QVariantMap &map);
-    QVariant ipc_setMpvOption(const QVariantMap &map);
-    QVariant ipc_doMpvCommand(const QVariantMap &map);
+    void ipc_getMpvProperty(const QVariantMap &map, MpcQtConnection *connection);
+    void ipc_setMpvProperty(const QVariantMap &map, MpcQtConnection *connection);
+    void ipc_setMpvOption(const QVariantMap &map, MpcQtConnection *connection);
+    void ipc_doMpvCommand(const QVariantMap &map, MpcQtConnection *connection);
+    void ipc_setWireFormat(const QVariantMap &map, MpcQtConnection *connection);
 
 private:
     PlaybackManager *playbackManager = nullptr;
@@ -83,50 +198,124 @@ private:
 };
 
 
+// MpcQtConnection passes a client's messages on to MpcQtServer.  It is
+// closed after a reply unless the client asked for it to be kept open.
+class MpcQtConnection : public IpcConnection
+{
+    Q_OBJECT
+public:
+    explicit MpcQtConnection(QLocalSocket *socket, QObject *parent = nullptr);
+    void keepOpen();
+    void reply(const QVariantMap &map);
+
+signals:
+    void payloadReceived(const QByteArray &payload, MpcQtConnection *self);
+
+protected:
+    void handleFrame(const QByteArray &frame);
+    bool isWholeMessage(const QByteArray &rest) const;
+
+private:
+    bool keptOpen = false;
+};
+
+
 class MpvConnection;
 class MpvObject;
+class MpvEventBatch;
 class MpvServer : public JsonServer
 {
     Q_OBJECT
 public:
-    explicit MpvServer(QObject *parent = nullptr);
+    explicit MpvServer(QObject *parent = nullptr,
+                       const QString &socketName = QString());
     void setPlaybackManger(PlaybackManager *manager);
     void setMpvObject(MpvObject *object);
+    int observeProperty(MpvConnection *connection, uint64_t id,
+                        const QString &name, int format);
+    int unobserveProperty(MpvConnection *connection, uint64_t id);
+    QByteArray propertyChangeLine(uint64_t subscription, MpvConnection *connection,
+                                  uint64_t id, IpcWire::Format format);
+
+private:
+    // A property is observed from mpv once for each format it is wanted in,
+    // no matter how many clients want it.  Changes are sent to just the
+    // connections that asked for it, under the ids they asked with.  The
+    // message without its id is kept for each wire format until the value
+    // changes again.
+    struct Subscription {
+        QString name;
+        int format;
+        QHash<MpvConnection*, QSet<uint64_t>> subscribers;
+        QVariant lastValue;
+        bool hasValue;
+        QByteArray prefixes[IpcWire::FormatCount];
+    };
+
+    QByteArray propertyChangePrefix(const Subscription &s, IpcWire::Format format);
+    void sendPropertyChange(uint64_t subscription);
+    void sendEvent(const QVariantMap &map);
+    void removeSubscriber(uint64_t subscription, MpvConnection *connection,
+                          const QSet<uint64_t> &ids);
 
 private slots:
     void server_newConnection(QLocalSocket *socket);
+    void connection_disconnected(MpvConnection *connection);
+    void ctrl_eventBatch(const MpvEventBatch &batch);
 
 private:
     PlaybackManager *playbackManager = nullptr;
     MpvObject *mpvObject = nullptr;
+    QList<MpvConnection*> connections;
+    QHash<uint64_t, Subscription> subscriptions;
+    QHash<QPair<QString,int>, uint64_t> subscriptionIds;
+    uint64_t nextSubscriptionId = 1;
 };
 
 
 
-class MpvConnection : public QObject
+class MpvConnection : public IpcConnection
 {
     Q_OBJECT
 public:
     explicit MpvConnection(QLocalSocket *socket, PlaybackManager *manager,
-                           MpvObject *mpvObject, QObject *parent = nullptr);
+                           MpvObject *mpvObject, MpvServer *server);
     ~MpvConnection();
+    void writePropertyChange(uint64_t subscription, uint64_t id);
+    void writeEvent(const QByteArray &line);
 
 signals:
     void disconnected(MpvConnection *self);
 
+private:
+    enum MessageKind { Reply, Event };
+
+    // Property changes are queued by where they go, and only written when
+    // the queue is flushed.  Those have a subscription and no line yet.
+    struct Message {
+        QByteArray line;
+        uint64_t subscription;
+        uint64_t id;
+    };
+
+    std::function<void(QVariant)> replyLater(const QVariant &requestId);
+
+protected:
+    void handleFrame(const QByteArray &frame);
+    bool readingPaused() const;
+    void connectionClosed();
+
 private:
     void socketWrite(const QVariant &v);
+    void queueLine(const QByteArray &line, MessageKind kind);
+    void scheduleFlush();
+    void writeQueuedProperties();
     void commandReturn(int errorCode, QVariant requestId, QVariant data = QVariant());
     void commandReturnVariant(const QVariant &requestId, const QVariant &data);
 
 private slots:
-    void socket_readyRead();
-    void socket_disconnected();
-    void ctrl_mpvPropertyChanged(QString name, const QVariant &v, uint64_t userData);
-    void ctrl_logMessage(QString message);
-    void ctrl_clientMessage(uint64_t id, const QStringList &args);
-    void ctrl_videoSizeChanged(const QSize &size);
-    void ctrl_unhandledMpvEvent(int eventNumber);
+    void flushWrites();
+    void socket_bytesWritten();
 
     void command_raw(const QStringList &list, const QVariant &requestId);
     void command_forbidden();
@@ -140,12 +329,27 @@ private slots:
     void command_observe_property(const QVariantList &list, const QVariant &requestId);
     void command_observe_property_string(const QVariantList &list, const QVariant &requestId);
     void command_unobserve_property(const QVariantList &list, const QVariant &requestId);
+    void command_get_connection_stats(const QVariant &requestId);
+    void command_set_wire_format(const QStringList &list, const QVariant &requestId);
 
 private:
-    QLocalSocket *socket = nullptr;
     PlaybackManager *manager = nullptr;
     MpvObject *mpvObject = nullptr;
+    MpvServer *server = nullptr;
     QMap<QString,QMetaMethod> commandParsers;
+    IpcCommand parsed;
+    int inFlight = 0;
+
+    // Messages wait here until the end of the event loop turn, and longer if
+    // the client is not keeping up.  A property change still waiting takes
+    // the place of any that come after it for the same id.
+    QVector<Message> queue;
+    QSet<QPair<uint64_t,uint64_t>> queuedProperties;
+    bool flushScheduled = false;
+    quint64 bytesSent = 0;
+    quint64 messagesSent = 0;
+    quint64 messagesCoalesced = 0;
+    quint64 messagesDropped = 0;
 };
 
 #endif // IPCJSON_H
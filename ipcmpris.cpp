@@ -103,8 +103,25 @@ void MprisInstance::mainwindow_volumeChanged(int level)
     player->instance_setVolume(level/100.0);
 }
 
+void MprisInstance::setLowPower(bool lowPower)
+{
+    // In low power mode the position is only announced when the length
+    // changes, and the last one seen is pushed once we are woken up.
+    lowPower_ = lowPower;
+    if (!lowPower && parkedTime >= 0) {
+        player->instance_timeChange(parkedTime, parkedLength);
+        parkedTime = -1;
+    }
+}
+
 void MprisInstance::manager_timeChanged(double time, double length)
 {
+    if (lowPower_ && length == parkedLength) {
+        parkedTime = time;
+        return;
+    }
+    parkedTime = -1;
+    parkedLength = length;
     player->instance_timeChange(time, length);
 }
 
@@ -29,6 +29,7 @@ public:
     bool registered();
 
     void setProtocolList(const QStringList &protocolList);
+    void setLowPower(bool lowPower);
 
 signals:
     void dbusRegistered(bool yes);
@@ -66,6 +67,9 @@ private:
     int dbusId_ = 0;
     QString dbusName_;
     bool registered_ = false;
+    bool lowPower_ = false;
+    double parkedTime = -1;
+    double parkedLength = -1;
     QDBusConnection dbus;
 
     MprisServer *server = nullptr;
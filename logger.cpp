@@ -8,6 +8,7 @@
 
 static bool loggerInstanceSetBefore = false;
 static Logger *loggerInstance = nullptr;
+static const int parkedMessageLimit = 1000;
 
 void loggerCallback(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
@@ -161,7 +162,7 @@ void Logger::setLoggingEnabled(bool enabled)
     if (enabled && !loggingEnabled) {
         loggingEnabled = true;
         makeLogPrefixed("logger", "enabling logging");
-        if (!immediateMode)
+        if (!immediateMode && !parked)
             flushTimer->start();
     } else if (!enabled && loggingEnabled) {
         makeLogPrefixed("logger", "disabling logging");
@@ -182,6 +183,23 @@ void Logger::setFlushTime(int msec)
     } else {
         immediateMode = false;
         flushTimer->setInterval(std::max(100, msec));
+        if (!parked)
+            flushTimer->start();
+    }
+}
+
+void Logger::setParked(bool parked)
+{
+    // While parked the flush timer is stopped, so that an idle program is
+    // not woken up just to find nothing to flush.  Messages are held until
+    // unparked, or until too many of them pile up.
+    if (this->parked == parked)
+        return;
+    this->parked = parked;
+    if (parked) {
+        flushTimer->stop();
+    } else if (loggingEnabled && !immediateMode) {
+        flushMessages();
         flushTimer->start();
     }
 }
@@ -213,6 +231,8 @@ void Logger::makeLog(QString line)
         }
     } else {
         pendingMessages.append(line);
+        if (parked && pendingMessages.count() >= parkedMessageLimit)
+            flushMessages();
     }
 }
 
@@ -39,6 +39,7 @@ public slots:
     void setLogFile(QString fileName);
     void setLoggingEnabled(bool enabled);
     void setFlushTime(int msec);
+    void setParked(bool parked);
     void flushMessages();
     void makeLog(QString line);
     void makeLogPrefixed(QString prefix, QString message);
@@ -47,6 +48,7 @@ public slots:
 private:
     bool loggingEnabled = true; // by default, log everything until we get told not to
     bool immediateMode = false; // by default, debug messages are stored
+    bool parked = false;        // stored messages wait without a timer
     QElapsedTimer elapsed;
     QTimer *flushTimer = nullptr;
     QFile *logFile = nullptr;
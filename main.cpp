@@ -1,15 +1,24 @@
+#include <algorithm>
+#include <climits>
 #include <clocale>
+#include <QAbstractEventDispatcher>
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QLocalSocket>
 #include <QFileDialog>
 #include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
 #include <QStandardPaths>
 #include <QUuid>
 #include <QJsonDocument>
 #include <QTimer>
 #include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QSurfaceFormat>
+#include <QTextStream>
 #include <QThread>
 #include <QTranslator>
 #include <QLibraryInfo>
@@ -24,6 +33,7 @@
 #include "ipcmpris.h"
 #include "platform/unify.h"
 #include "playlist.h"
+#include "benchmarks.h"
 
 //---------------------------------------------------------------------------
 
@@ -52,10 +62,69 @@ static const char filePlaylistsBackup[] = "playlists_backup";
 static const char fileRecent[] = "recent";
 static const char fileSettings[] = "settings";
 
+// The playlist journal is folded into the playlist records once it grows
+// past this size, checked every so often.
+static const qint64 journalCompactSize = 4 * 1024 * 1024;
+static const int journalCheckInterval = 60000;
+
+// With --export-playlists, the playlist records are exported to the JSON
+// files on the way out, so that an older build run next finds them.
+static QVariant playlistExporter(const QByteArray &record)
+{
+    return Playlist::recordToVMap(record);
+}
+
+//---------------------------------------------------------------------------
+
+// With --startup-trace, each phase of startup is printed with its time since
+// main() was entered.  Phases passed before the option was parsed are held
+// back until then.
+static QElapsedTimer startupClock;
+static QMutex startupTraceLock;
+static bool startupTraceEnabled = false;
+static qint64 startupTraceLast = 0;
+static QList<QPair<qint64, QString>> startupTracePending;
+
+static void startupTrace(const QString &phase)
+{
+    QMutexLocker locker(&startupTraceLock);
+    startupTracePending.append({ startupClock.nsecsElapsed() / 1000, phase });
+    if (!startupTraceEnabled)
+        return;
+    QTextStream out(stdout);
+    for (auto &p : startupTracePending) {
+        out << QString("startup: %1 ms (+%2 ms) %3\n")
+               .arg(p.first / 1000.0, 8, 'f', 1)
+               .arg((p.first - startupTraceLast) / 1000.0, 7, 'f', 1)
+               .arg(p.second);
+        startupTraceLast = p.first;
+    }
+    startupTracePending.clear();
+}
+
+static void startupTraceEnable()
+{
+    {
+        QMutexLocker locker(&startupTraceLock);
+        startupTraceEnabled = true;
+    }
+    startupTrace("arguments parsed");
+}
+
+// Runs a function on its own thread, for the loading done during startup.
+class LoaderThread : public QThread {
+public:
+    LoaderThread(const std::function<void()> &job) : job(job) {}
+    void run() { job(); }
+private:
+    std::function<void()> job;
+};
+
 //---------------------------------------------------------------------------
 
 int main(int argc, char *argv[])
 {
+    startupClock.start();
     QCoreApplication::setOrganizationDomain("cmdrkotori.mpc-qt");
     QApplication a(argc, argv);
     Logger::singleton();
@@ -80,6 +149,9 @@ int main(int argc, char *argv[])
     qRegisterMetaType<MpvController::PropertyList>("MpvController::PropertyList");
     qRegisterMetaType<MpvController::OptionList>("MpvController::OptionList");
     qRegisterMetaType<MpvErrorCode>("MpvErrorCode");
+    qRegisterMetaType<MpvFastProperty>("MpvFastProperty");
+    qRegisterMetaType<MpvEventBatch>("MpvEventBatch");
+    qRegisterMetaType<MpvCallback*>("MpvCallback*");
     qRegisterMetaType<uint64_t>("uint64_t");
 
     QTranslator qtTranslator;
@@ -98,11 +170,18 @@ int main(int argc, char *argv[])
     QCoreApplication::setApplicationVersion(MPCQT_VERSION_STR);
 
     Flow f;
+    startupTrace("settings read");
     f.parseArgs();
+    if (f.benchmarkRequested())
+        return f.runBenchmark();
+    if (f.thumbnailsRequested())
+        return f.runThumbnails();
     f.detectMode();
+    startupTrace("mode detected");
     if (f.earlyQuit())
         return 0;
     f.init();
+    startupTrace("initialized");
     return f.run();
 }
 
@@ -114,6 +193,21 @@ Flow::Flow(QObject *owner) :
 
 Flow::~Flow()
 {
+    if (mainWindow && wakeupClock.isValid()) {
+        setLowPower(false);
+        logWakeups("overall", wakeupClock.elapsed(), guiWakeups,
+                   mainWindow->mpvObject()->workerWakeups());
+    }
+    if (configLoader) {
+        configLoader->wait();
+        delete configLoader;
+        configLoader = nullptr;
+    }
+    if (playlistLoader) {
+        playlistLoader->wait();
+        delete playlistLoader;
+        playlistLoader = nullptr;
+    }
     if (server) {
         delete server;
         server = nullptr;
@@ -123,9 +217,27 @@ Flow::~Flow()
         mpvServer = nullptr;
     }
     if (mainWindow) {
-        if (programMode == PrimaryMode) {
-            storage.writeVList(filePlaylists, mainWindow->playlistWindow()->tabsToVList());
-            storage.writeVList(filePlaylistsBackup, PlaylistCollection::getBackup()->toVList());
+        // The journal already holds every change, so there is nothing left
+        // to save unless it couldn't be opened, or the playlists are to be
+        // exported for an older build.
+        bool hadJournal = !journal.isNull();
+        if (journal) {
+            PlaylistJournal::setJournal(QSharedPointer<Journal>());
+            journal.reset();
+        }
+        storage.waitForBackgroundWrites();
+        if ((!hadJournal || cliExportPlaylists) && programMode == PrimaryMode
+                && !cliNoFiles && playlistsRestored) {
+            QList<QByteArray> tabs = mainWindow->playlistWindow()->tabsToRecords();
+            QList<QByteArray> backup = PlaylistCollection::getBackup()->toRecords();
+            int generation = storage.nextJournalGeneration(filePlaylists);
+            Storage::RecordExporter exporter;
+            if (cliExportPlaylists)
+                exporter = playlistExporter;
+            storage.writeRecords(filePlaylists, PlaylistCollection::recordVersion,
+                                 tabs, generation, exporter);
+            storage.writeRecords(filePlaylistsBackup, PlaylistCollection::recordVersion,
+                                 backup, generation, exporter);
         }
         delete mainWindow;
         mainWindow = nullptr;
@@ -179,12 +291,40 @@ void Flow::parseArgs()
     QCommandLineOption noFilesOpt("no-files", tr("Do not load file history, playlists, or favorites."));
     QCommandLineOption sizeOpt("size", tr("Main window size."), "w,h");
     QCommandLineOption posOpt("pos", tr("Main window position."), "x,y");
+    QCommandLineOption renderThreadOpt("render-thread", tr("Render video on a thread of its own."));
+    QCommandLineOption embedVideoOpt("embed-video", tr("Let mpv present video into the window by itself."));
+    QCommandLineOption exportPlaylistsOpt("export-playlists", tr("Save playlists for older versions as well on exit."));
+    QCommandLineOption startupTraceOpt("startup-trace", tr("Print how long each phase of startup takes."));
+    QCommandLineOption benchmarkOpt("benchmark", tr("Run a built-in benchmark and quit. One of: %1.").arg(Benchmarks::names().join(", ")), "name[:size]");
+    QCommandLineOption thumbnailsOpt("thumbnails", tr("Make thumbnail sheets for a folder, or a file listing one file or url per line, and quit."), "path");
+    QCommandLineOption thumbnailColsOpt("thumbnail-cols", tr("Columns of a thumbnail sheet."), "n", "4");
+    QCommandLineOption thumbnailRowsOpt("thumbnail-rows", tr("Rows of a thumbnail sheet."), "n", "4");
+    QCommandLineOption thumbnailWidthOpt("thumbnail-width", tr("Width of a thumbnail sheet."), "pixels", "800");
+    QCommandLineOption thumbnailQualityOpt("thumbnail-quality", tr("Image quality of a thumbnail sheet."), "percent", "97");
+    QCommandLineOption thumbnailFormatOpt("thumbnail-format", tr("Image format of a thumbnail sheet."), "ext", "jpg");
+    QCommandLineOption thumbnailOutputOpt("thumbnail-output", tr("Folder to write thumbnail sheets to, instead of next to each file."), "folder");
+    QCommandLineOption thumbnailJobsOpt("thumbnail-jobs", tr("Files to make thumbnail sheets of at once."), "n", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption thumbnailDecodersOpt("thumbnail-decoders", tr("Decoders to use for each file."), "n", "1");
 
     parser.addOption(freestandingOpt);
     parser.addOption(noConfigOpt);
     parser.addOption(noFilesOpt);
     parser.addOption(sizeOpt);
     parser.addOption(posOpt);
+    parser.addOption(renderThreadOpt);
+    parser.addOption(embedVideoOpt);
+    parser.addOption(exportPlaylistsOpt);
+    parser.addOption(startupTraceOpt);
+    parser.addOption(benchmarkOpt);
+    parser.addOption(thumbnailsOpt);
+    parser.addOption(thumbnailColsOpt);
+    parser.addOption(thumbnailRowsOpt);
+    parser.addOption(thumbnailWidthOpt);
+    parser.addOption(thumbnailQualityOpt);
+    parser.addOption(thumbnailFormatOpt);
+    parser.addOption(thumbnailOutputOpt);
+    parser.addOption(thumbnailJobsOpt);
+    parser.addOption(thumbnailDecodersOpt);
     parser.addPositionalArgument("urls", tr("URLs to open, optionally."), "[urls...]");
 
     parser.process(QCoreApplication::arguments());
@@ -192,9 +332,34 @@ void Flow::parseArgs()
     programMode = parser.isSet(freestandingOpt) ? FreestandingMode : UnknownMode;
     cliNoConfig = parser.isSet(noConfigOpt);
     cliNoFiles = parser.isSet(noFilesOpt);
+    cliExportPlaylists = parser.isSet(exportPlaylistsOpt);
     validCliSize = parser.isSet(sizeOpt) && Helpers::sizeFromString(cliSize, parser.value(sizeOpt));
     validCliPos = parser.isSet(posOpt) && Helpers::pointFromString(cliPos, parser.value(posOpt));
     customFiles = parser.positionalArguments();
+    if (parser.isSet(embedVideoOpt))
+        cliWidgetType = Helpers::EmbedWidget;
+    else if (parser.isSet(renderThreadOpt))
+        cliWidgetType = Helpers::GlThreadWidget;
+    if (parser.isSet(startupTraceOpt))
+        startupTraceEnable();
+    if (parser.isSet(benchmarkOpt)) {
+        QStringList parts = parser.value(benchmarkOpt).split(':');
+        benchmarkName = parts.value(0);
+        benchmarkSize = parts.value(1).toInt();
+    }
+    if (parser.isSet(thumbnailsOpt)) {
+        thumbnailSource = parser.value(thumbnailsOpt);
+        MpvThumbnailer::Params &sheet = thumbnailParams.sheet;
+        sheet.cols = qBound(1, parser.value(thumbnailColsOpt).toInt(), 12);
+        sheet.rows = qBound(1, parser.value(thumbnailRowsOpt).toInt(), 12);
+        sheet.imageWidth = qBound(800, parser.value(thumbnailWidthOpt).toInt(), 8192);
+        sheet.jpegQuality = qBound(1, parser.value(thumbnailQualityOpt).toInt(), 100);
+        sheet.instances = qMax(1, parser.value(thumbnailDecodersOpt).toInt());
+        sheet.rawCapture = true;
+        thumbnailParams.outputDirectory = parser.value(thumbnailOutputOpt);
+        thumbnailParams.outputFormat = parser.value(thumbnailFormatOpt);
+        thumbnailParams.jobs = qMax(1, parser.value(thumbnailJobsOpt).toInt());
+    }
 }
 
 void Flow::detectMode() {
@@ -224,16 +389,32 @@ void Flow::init() {
     connect(logThread, &QThread::finished,
             logger, &QObject::deleteLater);
 
-    mainWindow = new MainWindow();
+    // Read the rest of the config and the playlists while the windows are
+    // built.  The playlists are replayed on the loader without touching the
+    // shared collections, and handed to the gui thread once it is done.
+    // The item collection has to exist before the loader uses it from its
+    // thread.
+    ItemCollection::getSingleton();
+    configLoader = new LoaderThread([this]() { readFiles(); });
+    configLoader->start();
+    playlistLoader = new LoaderThread([this]() { readPlaylists(); });
+    connect(playlistLoader, &QThread::finished,
+            this, &Flow::restorePlaylists, Qt::QueuedConnection);
+    playlistLoader->start();
+
+    // The properties, favorites and thumbnailer windows are made when they
+    // are first needed.  The log window has to exist from the start, as it
+    // collects messages, and so does the settings window, as the settings
+    // live in its widgets.
+    mainWindow = new MainWindow(nullptr, cliWidgetType);
+    startupTrace("main window constructed");
     playbackManager = new PlaybackManager(this);
     playbackManager->setMpvObject(mainWindow->mpvObject(), true);
     playbackManager->setPlaylistWindow(mainWindow->playlistWindow());
     settingsWindow = new SettingsWindow();
     settingsWindow->setWindowModality(Qt::WindowModal);
-    propertiesWindow = new PropertiesWindow();
-    favoritesWindow = new FavoritesWindow();
     logWindow = new LogWindow();
-    thumbnailerWindow = new ThumbnailerWindow();
+    startupTrace("settings and log windows constructed");
 
     server = new MpcQtServer(mainWindow, playbackManager, this);
     server->setMainWindow(mainWindow);
@@ -272,11 +453,11 @@ void Flow::init() {
         setupMpris();
 
     // update player framework
+    configLoader->wait();
+    startupTrace("config files read");
     settingsWindow->takeActions(mainWindow->editableActions());
     mainWindow->setRecentDocuments(recentFiles);
     mainWindow->setFavoriteTracks(favoriteFiles, favoriteStreams);
-    favoritesWindow->setFiles(favoriteFiles);
-    favoritesWindow->setStreams(favoriteStreams);
 
     settingsWindow->setAudioDevices(mainWindow->mpvObject()->audioDevices());
     settingsWindow->takeSettings(settings);
@@ -284,8 +465,14 @@ void Flow::init() {
     settingsWindow->takeKeyMap(keyMap);
     settingsWindow->sendSignals();
     settingsWindow->sendAcceptedSettings();
+    startupTrace("settings applied");
 
     if (programMode == PrimaryMode) {
+        // Claim the socket names now, so that other instances hand over to
+        // this one, but leave the clients waiting until there are
+        // playlists for them to work on.
+        server->setAccepting(false);
+        mpvServer->setAccepting(false);
         server->listen();
         mpvServer->listen();
     }
@@ -298,11 +485,11 @@ void Flow::init() {
 
 int Flow::run()
 {
-    auto playlist = cliNoFiles ? QVariantList() : storage.readVList(filePlaylists);
-    auto backup = cliNoFiles ? QVariantList() : storage.readVList(filePlaylistsBackup);
+    // The config loader was waited on by init.  The playlists turn up on
+    // their own once the event loop is running.
+    delete configLoader;
+    configLoader = nullptr;
     auto geometry = cliNoConfig ? QVariantMap() : storage.readVMap(fileGeometry);
-    mainWindow->playlistWindow()->tabsFromVList(playlist);
-    PlaylistCollection::getBackup()->fromVList(backup);
     restoreWindows(geometry);
     return qApp->exec();
 }
@@ -312,12 +499,239 @@ bool Flow::earlyQuit()
     return programMode == EarlyQuitMode;
 }
 
+bool Flow::benchmarkRequested()
+{
+    return !benchmarkName.isEmpty();
+}
+
+int Flow::runBenchmark()
+{
+    return Benchmarks::run(benchmarkName, benchmarkSize);
+}
+
+bool Flow::thumbnailsRequested()
+{
+    return !thumbnailSource.isEmpty();
+}
+
+int Flow::runThumbnails()
+{
+    // A folder is searched for video files.  Anything else is read as a list
+    // of files or urls, one to a line.
+    QList<QUrl> sources;
+    QFileInfo info(thumbnailSource);
+    if (info.isDir()) {
+        sources = Helpers::filterUrls({ QUrl::fromLocalFile(info.absoluteFilePath()) },
+                                      Helpers::videoExtensions);
+    } else {
+        QFile list(thumbnailSource);
+        if (!list.open(QFile::ReadOnly | QFile::Text)) {
+            QTextStream(stderr) << "thumbnails: could not read " << thumbnailSource << "\n";
+            return 1;
+        }
+        QTextStream in(&list);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (!line.isEmpty())
+                sources << QUrl::fromUserInput(line, QDir::currentPath(), QUrl::AssumeLocalFile);
+        }
+    }
+
+    // Frames are taken with screenshot-raw, so no window or render context
+    // is ever made.
+    ThumbnailBatch batch;
+    QEventLoop loop;
+    connect(&batch, &ThumbnailBatch::finished,
+            &loop, &QEventLoop::quit);
+    batch.execute(sources, thumbnailParams);
+    loop.exec();
+    return batch.failures() ? 1 : 0;
+}
+
+void Flow::readPlaylists()
+{
+    // Playlists are kept in binary record files, with every change since
+    // they were written in the journal.  The JSON files are still read when
+    // there is no binary one, e.g. on the first run after an upgrade, or an
+    // older build has written them since.
+    // Journals written before then don't apply to those.  This runs on the
+    // playlist loader, and only touches the loaded* members.
+    if (cliNoFiles)
+        return;
+    QList<QByteArray> changes;
+    int tabsGeneration = INT_MAX;
+    auto file = storage.readRecords(filePlaylists, PlaylistCollection::recordVersion);
+    if (file) {
+        loadedRecords = true;
+        for (int i = 0; i < file->count(); i++) {
+            QSharedPointer<Playlist> p(new Playlist);
+            p->fromBinary(file->record(i));
+            loadedTabs.append(p);
+        }
+        tabsGeneration = file->journalGeneration();
+        changes = storage.readJournal(filePlaylists, PlaylistJournal::version,
+                                      tabsGeneration);
+    } else {
+        for (const QVariant &v : storage.readVList(filePlaylists)) {
+            QSharedPointer<Playlist> p(new Playlist);
+            p->fromVMap(v.toMap());
+            loadedTabs.append(p);
+        }
+    }
+
+    loadedBackupFile = storage.readRecords(filePlaylistsBackup, PlaylistCollection::recordVersion);
+    if (!loadedBackupFile)
+        loadedBackupList = storage.readVList(filePlaylistsBackup);
+
+    // Only the journal files newer than the records are replayed, so that a
+    // change is never applied twice.  The tabs are saved before the backup,
+    // so a backup file left behind by a crash in between takes the journal
+    // files it lacks, without them touching the tabs.
+    int backupGeneration = loadedBackupFile ? loadedBackupFile->journalGeneration()
+                                            : INT_MAX;
+    if (backupGeneration < tabsGeneration) {
+        QList<QSharedPointer<Playlist>> savedTabs;
+        QList<QByteArray> missed = storage.readJournal(filePlaylists, PlaylistJournal::version,
+                                                       backupGeneration, tabsGeneration);
+        for (const QByteArray &change : missed)
+            PlaylistJournal::replay(change, savedTabs, loadedBackups);
+    }
+    for (const QByteArray &change : changes)
+        PlaylistJournal::replay(change, loadedTabs, loadedBackups);
+    loadedChanges = changes.count();
+
+    // Hand the playlists over to the gui thread, which owns them from here.
+    for (auto &p : loadedTabs)
+        p->moveToThread(qApp->thread());
+    for (auto &p : loadedBackups)
+        p->moveToThread(qApp->thread());
+}
+
+void Flow::restorePlaylists()
+{
+    // Called once the loader has finished, so this doesn't block.
+    playlistLoader->wait();
+    delete playlistLoader;
+    playlistLoader = nullptr;
+    playlistsRestored = true;
+    if (!cliNoFiles)
+        LogStream("main") << "replayed " << loadedChanges << " playlist changes";
+
+    mainWindow->playlistWindow()->tabsFromPlaylists(loadedTabs);
+    auto backup = PlaylistCollection::getBackup();
+    if (loadedBackupFile)
+        backup->fromRecords(loadedBackupFile);
+    else
+        backup->fromVList(loadedBackupList);
+    for (const QSharedPointer<Playlist> &p : loadedBackups)
+        if (!backup->playlistOf(p->uuid()))
+            backup->addPlaylist(p);
+    loadedTabs.clear();
+    loadedBackups.clear();
+    loadedBackupFile.reset();
+    loadedBackupList.clear();
+    startupTrace("playlists restored");
+
+    server->setAccepting(true);
+    mpvServer->setAccepting(true);
+    if (windowsShown)
+        self_windowsRestored();
+
+    if (programMode != PrimaryMode || cliNoFiles)
+        return;
+    journal = storage.openJournal(filePlaylists, PlaylistJournal::version);
+    if (!journal)
+        return;
+    PlaylistJournal::setJournal(journal);
+    if (!loadedRecords || loadedChanges > 0)
+        compactPlaylists();
+
+    compactTimer = new QTimer(this);
+    connect(compactTimer, &QTimer::timeout, this, [this]() {
+        if (journal && journal->size() > journalCompactSize)
+            compactPlaylists();
+    });
+    compactTimer->start(journalCheckInterval);
+    if (lowPower)
+        compactTimer->stop();
+}
+
+void Flow::compactPlaylists()
+{
+    // Take the records and start a new journal file in one go, so that the
+    // records hold exactly the changes in the journal files being retired.
+    if (!journal || storage.writingInBackground())
+        return;
+    QMap<QString, QList<QByteArray>> files;
+    files.insert(filePlaylists, mainWindow->playlistWindow()->tabsToRecords());
+    files.insert(filePlaylistsBackup, PlaylistCollection::getBackup()->toRecords());
+    QStringList obsolete = journal->rotate();
+    storage.writeRecordsInBackground(files, PlaylistCollection::recordVersion,
+                                     journal->currentGeneration(), obsolete);
+}
+
+void Flow::updateLowPower()
+{
+    // A playing video still has its frames taken when the window cannot be
+    // seen, as mpv waits on them being presented or skipped.
+    bool videoPlaying = playbackState == PlaybackManager::PlayingState
+            && nowPlayingHasVideo;
+    setLowPower(!windowShown && !videoPlaying);
+}
+
+void Flow::setLowPower(bool enabled)
+{
+    // Stretch or stop every periodic wakeup that only serves what is shown.
+    if (lowPower == enabled || !mainWindow)
+        return;
+    lowPower = enabled;
+    MpvObject *mpvObject = mainWindow->mpvObject();
+    if (enabled) {
+        lowPowerClock.start();
+        lowPowerGuiWakeups = guiWakeups;
+        lowPowerWorkerWakeups = mpvObject->workerWakeups();
+    } else {
+        logWakeups("low power", lowPowerClock.elapsed(),
+                   guiWakeups - lowPowerGuiWakeups,
+                   mpvObject->workerWakeups() - lowPowerWorkerWakeups);
+    }
+    QMetaObject::invokeMethod(Logger::singleton(), "setParked",
+                              Qt::QueuedConnection, Q_ARG(bool, enabled));
+    mainWindow->setLowPowerMode(enabled);
+    mpvObject->setRenderingParked(enabled);
+#ifdef QT_DBUS_LIB
+    if (mpris)
+        mpris->setLowPower(enabled);
+#endif
+    if (compactTimer) {
+        if (enabled)
+            compactTimer->stop();
+        else
+            compactTimer->start(journalCheckInterval);
+    }
+}
+
+void Flow::logWakeups(const QString &what, qint64 msec, quint64 gui, quint64 worker)
+{
+    double seconds = std::max(qint64(1), msec) / 1000.0;
+    Logger::log("main", QString("%1: %2 s, %3 gui and %4 mpv wakeups per second")
+                .arg(what).arg(seconds, 0, 'f', 1)
+                .arg(gui / seconds, 0, 'f', 1).arg(worker / seconds, 0, 'f', 1));
+}
+
 void Flow::readConfig()
 {
-    if (!cliNoConfig) {
+    // Only the settings are needed to pick a mode, so the rest is left to
+    // readFiles.
+    if (!cliNoConfig)
         settings = storage.readVMap(fileSettings);
+}
+
+void Flow::readFiles()
+{
+    // This runs on the config loader while the windows are being made.
+    if (!cliNoConfig)
         keyMap = storage.readVMap(fileKeys);
-    }
 
     if (!cliNoFiles) {
         QVariantMap favoriteMap = storage.readVMap(fileFavorites);
@@ -456,15 +870,11 @@ void Flow::setupMainWindowConnections()
 
     // mainwindow -> favorites
     connect(mainWindow, &MainWindow::organizeFavorites,
-            favoritesWindow, &FavoritesWindow::show);
-
-    // favorites -> mainwindow
-    connect(favoritesWindow, &FavoritesWindow::favoriteTracks,
-            mainWindow, &MainWindow::setFavoriteTracks);
+            this, [this]() { favorites()->show(); });
 
     // mainwindow -> properties
     connect(mainWindow, &MainWindow::showFileProperties,
-            propertiesWindow, &QWidget::show);
+            this, [this]() { properties()->show(); });
 
     // mainwindow -> log
     connect(mainWindow, &MainWindow::showLogWindow,
@@ -479,7 +889,7 @@ void Flow::setupManagerConnections()
 {
     // manager -> favorites
     connect(playbackManager, &PlaybackManager::currentTrackInfo,
-            favoritesWindow, &FavoritesWindow::addTrack);
+            this, [this](const TrackInfo &track) { favorites()->addTrack(track); });
 }
 
 void Flow::setupSettingsConnections()
@@ -559,12 +969,6 @@ void Flow::setupSettingsConnections()
     connect(settingsWindow, &SettingsWindow::subsIgnoreEmbeded,
             playbackManager, &PlaybackManager::setSubtitlesIgnoreEmbedded);
 
-    // settings -> thumbnailer
-    connect(settingsWindow, &SettingsWindow::screenshotDirectory,
-            thumbnailerWindow, &ThumbnailerWindow::setScreenshotDirectory);
-    connect(settingsWindow, &SettingsWindow::screenshotFormat,
-            thumbnailerWindow, &ThumbnailerWindow::setScreenshotFormat);
-
     // settings -> application
     connect(settingsWindow, &SettingsWindow::applicationPalette,
             qApp, [](const QPalette &pal) { qApp->setPalette(pal); });
@@ -591,30 +995,6 @@ void Flow::setupMpvObjectConnections()
     connect(mpvObject, &MpvObject::audioDeviceList,
             settingsWindow, &SettingsWindow::setAudioDevices);
 
-    // mpvwidget -> properties
-    connect(mpvObject, &MpvObject::fileNameChanged,
-            propertiesWindow, &PropertiesWindow::setFileName);
-    connect(mpvObject, &MpvObject::fileFormatChanged,
-            propertiesWindow, &PropertiesWindow::setFileFormat);
-    connect(mpvObject, &MpvObject::fileSizeChanged,
-            propertiesWindow, &PropertiesWindow::setFileSize);
-    connect(mpvObject, &MpvObject::playLengthChanged,
-            propertiesWindow, &PropertiesWindow::setMediaLength);
-    connect(mpvObject, &MpvObject::videoSizeChanged,
-            propertiesWindow, &PropertiesWindow::setVideoSize);
-    connect(mpvObject, &MpvObject::fileCreationTimeChanged,
-            propertiesWindow, &PropertiesWindow::setFileCreationTime);
-    connect(mpvObject, &MpvObject::tracksChanged,
-            propertiesWindow, &PropertiesWindow::setTracks);
-    connect(mpvObject, &MpvObject::mediaTitleChanged,
-            propertiesWindow, &PropertiesWindow::setMediaTitle);
-    connect(mpvObject, &MpvObject::filePathChanged,
-            propertiesWindow, &PropertiesWindow::setFilePath);
-    connect(mpvObject, &MpvObject::metaDataChanged,
-            propertiesWindow, &PropertiesWindow::setMetaData);
-    connect(mpvObject, &MpvObject::chaptersChanged,
-            propertiesWindow, &PropertiesWindow::setChapters);
-
     // settingswindow -> log
     auto logger = Logger::singleton();
     connect(settingsWindow, &SettingsWindow::loggingEnabled,
@@ -644,6 +1024,8 @@ void Flow::setupFlowConnections()
             this, &Flow::mainwindow_optionsOpenRequested);
     connect(mainWindow, &MainWindow::instanceShouldQuit,
             this, &Flow::mainwindow_instanceShouldQuit);
+    connect(mainWindow, &MainWindow::windowShownChanged,
+            this, &Flow::mainwindow_windowShownChanged);
 
     // manager -> this
     connect(playbackManager, &PlaybackManager::nowPlayingChanged,
@@ -656,6 +1038,8 @@ void Flow::setupFlowConnections()
             this, &Flow::manager_subtitlesVisibile);
     connect(playbackManager, &PlaybackManager::hasNoSubtitles,
             this, &Flow::manager_hasNoSubtitles);
+    connect(playbackManager, &PlaybackManager::hasNoVideo,
+            this, &Flow::manager_hasNoVideo);
 
     // settings -> this
     connect(settingsWindow, &SettingsWindow::settingsData,
@@ -697,10 +1081,6 @@ void Flow::setupFlowConnections()
     connect(playbackManager, &PlaybackManager::systemShouldStandby,
             screenSaver, &ScreenSaver::suspendSystem);
 
-    // favorites -> this.favorite*
-    connect(favoritesWindow, &FavoritesWindow::favoriteTracks,
-            this, &Flow::favoriteswindow_favoriteTracks);
-
     // this.screensaver -> this
     connect(screenSaver, &ScreenSaver::systemShutdown,
             this, &Flow::endProgram);
@@ -714,6 +1094,96 @@ void Flow::setupFlowConnections()
     // this -> this
     connect(this, &Flow::windowsRestored,
             this, &Flow::self_windowsRestored);
+
+    // Count how often the gui thread wakes up, so that the effect of low
+    // power mode can be seen in the log.
+    wakeupClock.start();
+    connect(QAbstractEventDispatcher::instance(), &QAbstractEventDispatcher::awake,
+            this, [this]() { ++guiWakeups; });
+}
+
+PropertiesWindow *Flow::properties()
+{
+    if (propertiesWindow)
+        return propertiesWindow;
+    propertiesWindow = new PropertiesWindow();
+    if (!propertiesGeometry.isEmpty())
+        applyWindowGeometry(propertiesWindow, propertiesGeometry);
+
+    // mpvwidget -> properties
+    auto mpvObject = mainWindow->mpvObject();
+    connect(mpvObject, &MpvObject::fileNameChanged,
+            propertiesWindow, &PropertiesWindow::setFileName);
+    connect(mpvObject, &MpvObject::fileFormatChanged,
+            propertiesWindow, &PropertiesWindow::setFileFormat);
+    connect(mpvObject, &MpvObject::fileSizeChanged,
+            propertiesWindow, &PropertiesWindow::setFileSize);
+    connect(mpvObject, &MpvObject::playLengthChanged,
+            propertiesWindow, &PropertiesWindow::setMediaLength);
+    connect(mpvObject, &MpvObject::videoSizeChanged,
+            propertiesWindow, &PropertiesWindow::setVideoSize);
+    connect(mpvObject, &MpvObject::fileCreationTimeChanged,
+            propertiesWindow, &PropertiesWindow::setFileCreationTime);
+    connect(mpvObject, &MpvObject::tracksChanged,
+            propertiesWindow, &PropertiesWindow::setTracks);
+    connect(mpvObject, &MpvObject::mediaTitleChanged,
+            propertiesWindow, &PropertiesWindow::setMediaTitle);
+    connect(mpvObject, &MpvObject::filePathChanged,
+            propertiesWindow, &PropertiesWindow::setFilePath);
+    connect(mpvObject, &MpvObject::metaDataChanged,
+            propertiesWindow, &PropertiesWindow::setMetaData);
+    connect(mpvObject, &MpvObject::chaptersChanged,
+            propertiesWindow, &PropertiesWindow::setChapters);
+
+    // The window is made on first use, so catch it up with what the player
+    // has reported so far.
+    propertiesWindow->setFileName(mpvObject->mirroredMpvProperty("filename").toString());
+    propertiesWindow->setFileFormat(mpvObject->mirroredMpvProperty("file-format").toString());
+    propertiesWindow->setFileSize(mpvObject->mirroredMpvProperty("file-size").toLongLong());
+    propertiesWindow->setMediaLength(mpvObject->playLength());
+    propertiesWindow->setVideoSize(mpvObject->videoSize());
+    propertiesWindow->setFileCreationTime(mpvObject->mirroredMpvProperty("file-date-created").toLongLong());
+    propertiesWindow->setTracks(mpvObject->mirroredMpvProperty("track-list").toList());
+    propertiesWindow->setMediaTitle(mpvObject->mirroredMpvProperty("media-title").toString());
+    propertiesWindow->setFilePath(mpvObject->mirroredMpvProperty("path").toString());
+    propertiesWindow->setMetaData(mpvObject->metaData());
+    propertiesWindow->setChapters(mpvObject->mirroredMpvProperty("chapter-list").toList());
+    startupTrace("properties window constructed");
+    return propertiesWindow;
+}
+
+FavoritesWindow *Flow::favorites()
+{
+    if (favoritesWindow)
+        return favoritesWindow;
+    favoritesWindow = new FavoritesWindow();
+    favoritesWindow->setFiles(favoriteFiles);
+    favoritesWindow->setStreams(favoriteStreams);
+
+    // favorites -> mainwindow
+    connect(favoritesWindow, &FavoritesWindow::favoriteTracks,
+            mainWindow, &MainWindow::setFavoriteTracks);
+
+    // favorites -> this.favorite*
+    connect(favoritesWindow, &FavoritesWindow::favoriteTracks,
+            this, &Flow::favoriteswindow_favoriteTracks);
+    return favoritesWindow;
+}
+
+ThumbnailerWindow *Flow::thumbnailer()
+{
+    if (thumbnailerWindow)
+        return thumbnailerWindow;
+    thumbnailerWindow = new ThumbnailerWindow();
+    thumbnailerWindow->setScreenshotDirectory(screenshotDirectory);
+    thumbnailerWindow->setScreenshotFormat(screenshotFormat);
+
+    // settings -> thumbnailer
+    connect(settingsWindow, &SettingsWindow::screenshotDirectory,
+            thumbnailerWindow, &ThumbnailerWindow::setScreenshotDirectory);
+    connect(settingsWindow, &SettingsWindow::screenshotFormat,
+            thumbnailerWindow, &ThumbnailerWindow::setScreenshotFormat);
+    return thumbnailerWindow;
 }
 
 void Flow::setupMpris()
@@ -844,7 +1314,11 @@ QVariantMap Flow::windowsToVMap()
         },
         {
             keyPropertiesWindow, QVariantMap {
-                { keyGeometry, Helpers::rectToVmap(propertiesWindow->geometry()) }
+                // An empty rect is centered when it is read back.
+                { keyGeometry, propertiesWindow
+                               ? Helpers::rectToVmap(propertiesWindow->geometry())
+                               : propertiesGeometry.value(keyGeometry,
+                                                          Helpers::rectToVmap(QRect())) }
             }
         },
         {
@@ -878,7 +1352,6 @@ void Flow::restoreWindows(const QVariantMap &geometryMap)
         return;
     }
     QRect geometry;
-    QDesktopWidget desktop;
 
     if (restoreGeometry && playlistMap[keyFloating].toBool()) {
         // the playlist window starts off floating, so restore it
@@ -912,26 +1385,42 @@ void Flow::restoreWindows(const QVariantMap &geometryMap)
 
     mainWindow->setGeometry(QRect(desiredPlace, desiredSize));
 
-    // helper: fetch geometry from map and center if not exists
-    auto applyVariantToWindow = [&](QWidget *window, const QVariantMap &map) {
-        geometry = Helpers::vmapToRect(map[keyGeometry].toMap());
-        if (geometry.isEmpty()) {
-            int mouseScreenNumber = desktop.screenNumber(QCursor::pos());
-            QRect available = desktop.availableGeometry(mouseScreenNumber);
-            geometry = QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter,
-                                           window->size(), available);
-        }
-        window->setGeometry(geometry);
-    };
-    // restore settings and properties window
-    applyVariantToWindow(settingsWindow, settingsMap);
-    applyVariantToWindow(propertiesWindow, propertiesMap);
-    applyVariantToWindow(logWindow, logMap);
+    // restore settings and properties window.  The properties window is
+    // made later on, so it picks up its geometry then.
+    applyWindowGeometry(settingsWindow, settingsMap);
+    propertiesGeometry = propertiesMap;
+    if (propertiesWindow)
+        applyWindowGeometry(propertiesWindow, propertiesMap);
+    applyWindowGeometry(logWindow, logMap);
     showWindows(mainMap);
 }
 
+void Flow::applyWindowGeometry(QWidget *window, const QVariantMap &map)
+{
+    // fetch geometry from map and center if not exists
+    QRect geometry = Helpers::vmapToRect(map[keyGeometry].toMap());
+    if (geometry.isEmpty()) {
+        QDesktopWidget desktop;
+        int mouseScreenNumber = desktop.screenNumber(QCursor::pos());
+        QRect available = desktop.availableGeometry(mouseScreenNumber);
+        geometry = QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter,
+                                       window->size(), available);
+    }
+    window->setGeometry(geometry);
+}
+
 void Flow::showWindows(const QVariantMap &mainWindowMap)
 {
+    // The trace also marks the main window first being shown and painted,
+    // and the video widget first presenting a frame, be it of the logo.
+    mainWindow->installEventFilter(this);
+    if (auto gl = qobject_cast<QOpenGLWidget*>(mainWindow->mpvObject()->mpvWidget())) {
+        auto presented = QSharedPointer<QMetaObject::Connection>::create();
+        *presented = connect(gl, &QOpenGLWidget::frameSwapped, this, [presented]() {
+            QObject::disconnect(*presented);
+            startupTrace("first frame presented");
+        });
+    }
     if (mainWindowMap.value(keyMinimized, false).toBool()) {
         mainWindow->showMinimized();
     } else {
@@ -944,12 +1433,32 @@ void Flow::showWindows(const QVariantMap &mainWindowMap)
     if (mainWindowMap.contains(keyState))
         mainWindow->setState(mainWindowMap[keyState].toMap());
     mainWindow->unfreezeWindow();
+    startupTrace("windows shown");
     QTimer::singleShot(50, this, &Flow::windowsRestored);
 }
 
+bool Flow::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == mainWindow && event->type() == QEvent::Show
+            && !mainWindowShown) {
+        mainWindowShown = true;
+        startupTrace("main window shown");
+    } else if (watched == mainWindow && event->type() == QEvent::Paint) {
+        mainWindow->removeEventFilter(this);
+        startupTrace("main window painted");
+    }
+    return QObject::eventFilter(watched, event);
+}
+
 void Flow::self_windowsRestored()
 {
+    // The files given on the command line go into the restored playlists,
+    // so they wait for those when the loader is still busy.
+    windowsShown = true;
+    if (!playlistsRestored)
+        return;
     server->fakePayload(makePayload());
+    startupTrace("files opened");
 }
 
 void Flow::mainwindow_instanceShouldQuit()
@@ -1026,7 +1535,7 @@ void Flow::mainwindow_takeImageAutomatically(Helpers::ScreenshotRender render)
 
 void Flow::mainwindow_takeThumbnails()
 {
-    thumbnailerWindow->open(playbackManager->nowPlaying());
+    thumbnailer()->open(playbackManager->nowPlaying());
 }
 
 void Flow::mainwindow_optionsOpenRequested()
@@ -1037,6 +1546,12 @@ void Flow::mainwindow_optionsOpenRequested()
     settingsWindow->raise();
 }
 
+void Flow::mainwindow_windowShownChanged(bool shown)
+{
+    windowShown = shown;
+    updateLowPower();
+}
+
 void Flow::manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid)
 {
     TrackInfo track(url, listUuid, itemUuid, QString(), 0, 0);
@@ -1052,6 +1567,11 @@ void Flow::manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid)
 
 void Flow::manager_stateChanged(PlaybackManager::PlaybackState state)
 {
+    if (playbackState != state) {
+        playbackState = state;
+        updateLowPower();
+    }
+
     if (!manipulateScreensaver)
         return;
 
@@ -1072,6 +1592,12 @@ void Flow::manager_hasNoSubtitles(bool none)
     nowPlayingNoSubtitleTracks = none;
 }
 
+void Flow::manager_hasNoVideo(bool empty)
+{
+    nowPlayingHasVideo = !empty;
+    updateLowPower();
+}
+
 void Flow::settingswindow_settingsData(const QVariantMap &settings)
 {
     this->settings = settings;
@@ -1,6 +1,7 @@
 #ifndef MAIN_H
 #define MAIN_H
 #include <QHash>
+#include <QElapsedTimer>
 #include <QMetaMethod>
 #include "ipcjson.h"
 #include "helpers.h"
@@ -16,7 +17,9 @@
 #include "platform/devicemanager.h"
 
 class MprisInstance;
+class Playlist;
 class QThread;
+class QTimer;
 
 // a simple class to control program exection and own application objects
 class Flow : public QObject {
@@ -32,6 +35,10 @@ public:
     void init();
     int run();
     bool earlyQuit();
+    bool benchmarkRequested();
+    int runBenchmark();
+    bool thumbnailsRequested();
+    int runThumbnails();
 
 signals:
     void recentFilesChanged(QList<TrackInfo> urls);
@@ -39,6 +46,8 @@ signals:
 
 private:
     void readConfig();
+    void readFiles();
+    void readPlaylists();
     void writeConfig(bool onlySettings = false);
     void setupMainWindowConnections();
     void setupManagerConnections();
@@ -46,6 +55,10 @@ private:
     void setupMpvObjectConnections();
     void setupFlowConnections();
     void setupMpris();
+    PropertiesWindow *properties();
+    FavoritesWindow *favorites();
+    ThumbnailerWindow *thumbnailer();
+    static void applyWindowGeometry(QWidget *window, const QVariantMap &map);
     QByteArray makePayload() const;
     QString pictureTemplate(Helpers::DisabledTrack tracks, Helpers::Subtitles subs) const;
     QVariantList recentToVList() const;
@@ -53,6 +66,14 @@ private:
     QVariantMap windowsToVMap();
     void restoreWindows(const QVariantMap &geometryMap);
     void showWindows(const QVariantMap &mainWindowMap);
+    void restorePlaylists();
+    void compactPlaylists();
+    void updateLowPower();
+    void setLowPower(bool enabled);
+    void logWakeups(const QString &what, qint64 msec, quint64 gui, quint64 worker);
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
 
 private slots:
     void self_windowsRestored();
@@ -63,10 +84,12 @@ private slots:
     void mainwindow_takeImageAutomatically(Helpers::ScreenshotRender render);
     void mainwindow_takeThumbnails();
     void mainwindow_optionsOpenRequested();
+    void mainwindow_windowShownChanged(bool shown);
     void manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid);
     void manager_stateChanged(PlaybackManager::PlaybackState state);
     void manager_subtitlesVisibile(bool visible);
     void manager_hasNoSubtitles(bool none);
+    void manager_hasNoVideo(bool empty);
     void settingswindow_settingsData(const QVariantMap &settings);
     void settingswindow_inhibitScreensaver(bool yes);
     void settingswindow_rememberWindowGeometry(bool yes);
@@ -96,27 +119,60 @@ private:
     LogWindow *logWindow = nullptr;
     ThumbnailerWindow *thumbnailerWindow = nullptr;
     QThread *logThread = nullptr;
+    QThread *configLoader = nullptr;
+    QThread *playlistLoader = nullptr;
+    QTimer *compactTimer = nullptr;
     Storage storage;
+    QSharedPointer<Journal> journal;
     QVariantMap settings;
     QVariantMap keyMap;
     QList<TrackInfo> recentFiles;
     QList<TrackInfo> favoriteFiles;
     QList<TrackInfo> favoriteStreams;
+    QVariantMap propertiesGeometry;
+
+    // Filled in by readPlaylists on the playlist loader.
+    QList<QSharedPointer<Playlist>> loadedTabs;
+    QList<QSharedPointer<Playlist>> loadedBackups;
+    QSharedPointer<RecordFile> loadedBackupFile;
+    QVariantList loadedBackupList;
+    int loadedChanges = 0;
+    bool loadedRecords = false;
+    bool playlistsRestored = false;
+    bool windowsShown = false;
+    bool mainWindowShown = false;
 
     ProgramMode programMode = UnknownMode;
     bool cliNoConfig = false;
     bool cliNoFiles = false;
+    bool cliExportPlaylists = false;
     QSize cliSize;
     QPoint cliPos;
     bool validCliSize = false;
     bool validCliPos = false;
+    Helpers::MpvWidgetType cliWidgetType = Helpers::GlCbWidget;
     QStringList customFiles;
+    QString benchmarkName;
+    int benchmarkSize = 0;
+    QString thumbnailSource;
+    ThumbnailBatch::Params thumbnailParams;
 
     bool inhibitScreensaver = false;
     bool manipulateScreensaver = false;
     bool rememberWindowGeometry = false;
     bool nowPlayingDisplayingSubtitles = true;
     bool nowPlayingNoSubtitleTracks = false;
+
+    // Low power mode is entered when nothing is shown, and no video plays.
+    bool lowPower = false;
+    bool windowShown = false;
+    bool nowPlayingHasVideo = false;
+    PlaybackManager::PlaybackState playbackState = PlaybackManager::StoppedState;
+    quint64 guiWakeups = 0;
+    QElapsedTimer wakeupClock;
+    QElapsedTimer lowPowerClock;
+    quint64 lowPowerGuiWakeups = 0;
+    quint64 lowPowerWorkerWakeups = 0;
     QString screenshotDirectory;
     QString encodeDirectory;
     QString screenshotTemplate;
@@ -14,6 +14,7 @@
 #include <QSizeGrip>
 #include <QMimeData>
 #include <QJsonDocument>
+#include <QFile>
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QTime>
@@ -22,12 +23,24 @@
 #include <QLibraryInfo>
 #include <QToolTip>
 #include <QStyle>
+#include <QScreen>
 
 using namespace Helpers;
 static const char SKIPACTION[] = "Skip";
 
+// How often mpv reports the play time to the window when the seekbar is not
+// showing, when the window is minimized or hidden, and when nothing at all is
+// being shown or played.  The seekbar follows the refresh rate of the screen.
+static const int timeInterval = 1000/12;
+static const int backgroundTimeInterval = 1000;
+static const int statisticsInterval = 1000/12;
+static const char *const statisticsProperties[] = {
+    "estimated-vf-fps", "avsync", "frame-drop-count",
+    "decoder-frame-drop-count", "audio-bitrate", "video-bitrate"
+};
 
-MainWindow::MainWindow(QWidget *parent) :
+
+MainWindow::MainWindow(QWidget *parent, Helpers::MpvWidgetType widgetType) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
 {
@@ -38,7 +51,7 @@ MainWindow::MainWindow(QWidget *parent) :
     setupPositionSlider();
     setupVolumeSlider();
     setupMpvHost();
-    setupMpvObject();
+    setupMpvObject(widgetType);
     setupPlaylist();
     setupStatus();
     setupSizing();
@@ -48,6 +61,8 @@ MainWindow::MainWindow(QWidget *parent) :
 
     mpvw->installEventFilter(this);
     playlistWindow_->installEventFilter(this);
+    positionSlider_->installEventFilter(this);
+    ui->infoStats->installEventFilter(this);
 
     connectActionsToSignals();
     connectActionsToSlots();
@@ -295,9 +310,31 @@ bool MainWindow::eventFilter(QObject *object, QEvent *event)
     if ((insideMpv || object == playlistWindow_) && event->type() == QEvent::MouseMove) {
         this->mouseMoveEvent(static_cast<QMouseEvent*>(event));
     }
+    if ((object == positionSlider_ || object == ui->infoStats)
+            && (event->type() == QEvent::Show || event->type() == QEvent::Hide))
+        updatePropertyDemands();
     return QMainWindow::eventFilter(object, event);
 }
 
+void MainWindow::changeEvent(QEvent *event)
+{
+    if (event->type() == QEvent::WindowStateChange)
+        updatePropertyDemands();
+    QMainWindow::changeEvent(event);
+}
+
+void MainWindow::showEvent(QShowEvent *event)
+{
+    updatePropertyDemands();
+    QMainWindow::showEvent(event);
+}
+
+void MainWindow::hideEvent(QHideEvent *event)
+{
+    updatePropertyDemands();
+    QMainWindow::hideEvent(event);
+}
+
 void MainWindow::closeEvent(QCloseEvent *event)
 {
     event->accept();
@@ -524,6 +561,7 @@ void MainWindow::setupActionGroups()
     ag->addAction(ui->actionViewOSDMessages);
     ag->addAction(ui->actionViewOSDStatistics);
     ag->addAction(ui->actionViewOSDFrameTimings);
+    ag->addAction(ui->actionViewOSDRenderTimings);
 
     ag = new QActionGroup(this);
     ag->addAction(ui->actionViewZoom025);
@@ -594,11 +632,11 @@ void MainWindow::setupMpvHost()
     ui->mpvWidget->layout()->addWidget(mpvHost_);
 }
 
-void MainWindow::setupMpvObject()
+void MainWindow::setupMpvObject(Helpers::MpvWidgetType widgetType)
 {
     mpvObject_ = new MpvObject(this, "Media Player Classic Qute Theater");
     mpvObject_->setHostWindow(mpvHost_);
-    setupMpvWidget(Helpers::GlCbWidget);
+    setupMpvWidget(widgetType);
     connect(mpvObject_, &MpvObject::logoSizeChanged,
             this, &MainWindow::setNoVideoSize);
 }
@@ -810,6 +848,7 @@ void MainWindow::setOSDPage(int page)
     ui->actionViewOSDMessages->setChecked(page == 0);
     ui->actionViewOSDStatistics->setChecked(page == 1);
     ui->actionViewOSDFrameTimings->setChecked(page == 2);
+    ui->actionViewOSDRenderTimings->setChecked(page == MpvObject::RenderTimingsPage);
     mpvObject_->showStatsPage(page);
 }
 
@@ -1016,6 +1055,40 @@ void MainWindow::updateInfostats()
     ui->bitrateLabel->setVisible(statShow);
 
     ui->infoStats->setVisible(infoShow || statShow);
+    updatePropertyDemands();
+}
+
+void MainWindow::updatePropertyDemands()
+{
+    // Only ask mpv for what can be seen, so that playing in the background
+    // wakes us up as little as possible.
+    if (!mpvObject_ || !positionSlider_)
+        return;
+    bool shown = isVisible() && !isMinimized();
+    bool seekbarShown = shown && positionSlider_->isVisible();
+    bool statisticsShown = shown && ui->infoStats->isVisible()
+            && ui->actionViewHideStatistics->isChecked();
+    if (shown != windowShown_) {
+        windowShown_ = shown;
+        emit windowShownChanged(shown);
+    }
+
+    int seekbarInterval = MpvPropertyPolicy::Unwanted;
+    if (seekbarShown) {
+        QScreen *screen = windowHandle() ? windowHandle()->screen()
+                                         : QGuiApplication::primaryScreen();
+        qreal rate = screen ? screen->refreshRate() : 60.0;
+        seekbarInterval = std::max(1, int(1000 / (rate > 0 ? rate : 60.0)));
+    }
+    mpvObject_->setPropertyDemand("seekbar", "time-pos", seekbarInterval);
+    // Nothing shows the time while hidden, but MPRIS, the A-B loop and the
+    // playback manager still read it, so it keeps coming in slowly then.
+    mpvObject_->setPropertyDemand("window", "time-pos",
+                                  shown ? timeInterval : backgroundTimeInterval);
+    for (const char *property : statisticsProperties)
+        mpvObject_->setPropertyDemand("statistics", property,
+                                      statisticsShown ? statisticsInterval
+                                                      : MpvPropertyPolicy::Unwanted);
 }
 
 void MainWindow::updateOnTop()
@@ -1335,6 +1408,17 @@ void MainWindow::setFullscreenHidePanels(bool hidden)
     }
 }
 
+void MainWindow::setLowPowerMode(bool lowPower)
+{
+    if (lowPowerMode == lowPower)
+        return;
+    lowPowerMode = lowPower;
+    // The time has only been coming in once a second, so read it again on
+    // the way out.
+    if (!lowPowerMode)
+        mpvObject_->refreshPlayTime();
+}
+
 void MainWindow::setPlaybackState(PlaybackManager::PlaybackState state)
 {
     ui->status->setText(state==PlaybackManager::StoppedState ? tr("Stopped") :
@@ -1819,6 +1903,30 @@ void MainWindow::on_actionViewOSDFrameTimings_triggered()
     mpvObject_->showStatsPage(2);
 }
 
+void MainWindow::on_actionViewOSDRenderTimings_triggered()
+{
+    mpvObject_->showStatsPage(MpvObject::RenderTimingsPage);
+}
+
+void MainWindow::on_actionViewOSDExportTimings_triggered()
+{
+    FrameTimings *timings = mpvObject_->frameTimings();
+    if (!timings)
+        return;
+    QString csv = timings->toCsv();
+    QString file = QFileDialog::getSaveFileName(this, tr("Export Render Timings"),
+                                                QString(), tr("CSV files (*.csv)"));
+    if (file.isEmpty())
+        return;
+    QFile f(file);
+    QByteArray data = csv.toUtf8();
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text)
+            || f.write(data) != data.size() || !f.flush()) {
+        QMessageBox::warning(this, tr("Export Render Timings"),
+                             tr("Could not write %1: %2").arg(file, f.errorString()));
+    }
+}
+
 void MainWindow::on_actionViewOSDCycle_triggered()
 {
     QActionGroup *osdActionGroup = ui->actionViewOSDMessages->actionGroup();
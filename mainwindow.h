@@ -28,7 +28,8 @@ private:
                      OnTopForVideos };
 
 public:
-    explicit MainWindow(QWidget *parent = nullptr);
+    explicit MainWindow(QWidget *parent = nullptr,
+                        Helpers::MpvWidgetType widgetType = Helpers::GlCbWidget);
     ~MainWindow();
 
     MpvObject *mpvObject();
@@ -46,6 +47,9 @@ public:
 protected:
     void resizeEvent(QResizeEvent *event);
     bool eventFilter(QObject *object, QEvent *event);
+    void changeEvent(QEvent *event);
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
     void closeEvent(QCloseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mousePressEvent(QMouseEvent *event);
@@ -74,7 +78,7 @@ private:
     void setupPositionSlider();
     void setupVolumeSlider();
     void setupMpvHost();
-    void setupMpvObject();
+    void setupMpvObject(Helpers::MpvWidgetType widgetType);
     void setupMpvWidget(Helpers::MpvWidgetType widgetType);
     void setupPlaylist();
     void setupStatus();
@@ -99,6 +103,7 @@ private:
     void updatePlaybackStatus();
     void updateSize(bool first_run = false);
     void updateInfostats();
+    void updatePropertyDemands();
     void updateOnTop();
     void updateWindowFlags();
     void updateMouseHideTime();
@@ -125,6 +130,7 @@ signals:
     void paused();
     void unpaused();
     void stopped();
+    void windowShownChanged(bool shown);
     void stepBackward();
     void stepForward();
     void speedDown();
@@ -177,6 +183,7 @@ public slots:
     void setBottomAreaHideTime(int milliseconds);
     void setTimeTooltip(bool show, bool above);
     void setFullscreenHidePanels(bool hidden);
+    void setLowPowerMode(bool lowPower);
     void setPlaybackState(PlaybackManager::PlaybackState state);
     void setPlaybackType(PlaybackManager::PlaybackType type);
     void setChapters(QList<QPair<double,QString>> chapters);
@@ -231,6 +238,8 @@ private slots:
     void on_actionViewOSDMessages_triggered();
     void on_actionViewOSDStatistics_triggered();
     void on_actionViewOSDFrameTimings_triggered();
+    void on_actionViewOSDRenderTimings_triggered();
+    void on_actionViewOSDExportTimings_triggered();
     void on_actionViewOSDCycle_triggered();
 
     void on_actionViewPresetsMinimal_triggered();
@@ -353,6 +362,8 @@ private:
     bool hasVideo = false;
     bool hasAudio = false;
     bool hasSubs = false;
+    bool windowShown_ = false;
+    bool lowPowerMode = false;
     int volumeStep = 10;
     bool frozenWindow = true;
     double sizeFactor_ = 1;
@@ -170,7 +170,9 @@ SOURCES += main.cpp\
     platform/devicemanager.cpp \
     logwindow.cpp \
     logger.cpp \
-    thumbnailerwindow.cpp
+    thumbnailerwindow.cpp \
+    benchmarks.cpp \
+    frametimings.cpp
 
 HEADERS  += \
     mpvwidget.h \
@@ -196,7 +198,9 @@ HEADERS  += \
     platform/devicemanager.h \
     logwindow.h \
     logger.h \
-    thumbnailerwindow.h
+    thumbnailerwindow.h \
+    benchmarks.h \
+    frametimings.h
 
 FORMS    += \
     mainwindow.ui \
@@ -6,16 +6,23 @@
 #include <QtX11Extras/QX11Info>
 #include <qpa/qplatformnativeinterface.h>
 #endif
+#include <QAbstractEventDispatcher>
 #include <QLayout>
 #include <QMainWindow>
 #include <QGuiApplication>
 #include <QThread>
 #include <QTimer>
 #include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOffscreenSurface>
 #include <QMouseEvent>
+#include <QWindow>
+#include <QScreen>
 #include <QMetaObject>
 #include <QDir>
 #include <QDebug>
+#include <algorithm>
 #include <cmath>
 #include <stdexcept>
 #include <mpv/qthelper.hpp>
@@ -70,6 +77,43 @@ MpvObject::PropertyDispatchMap MpvObject::propertyDispatch = {
     HANDLE_PROP("path", filePathChanged, toString, QString())
 };
 
+#define HANDLE_FAST(method, field, dflt) \
+[](MpvObject *self, const MpvFastProperty &p) -> void { \
+    emit self->method(p.ok ? decltype(dflt)(p.field) : dflt); \
+}
+
+// In the order of MpvObject::FastProperty.
+const MpvObject::FastDispatchFunction MpvObject::fastDispatch[] = {
+    HANDLE_FAST(self_playTimeChanged, real, -1.0),
+    HANDLE_FAST(self_playLengthChanged, real, -1.0),
+    HANDLE_FAST(seekableChanged, integer, false),
+    HANDLE_FAST(pausedChanged, integer, true),
+    HANDLE_FAST(fpsChanged, real, 0.0),
+    HANDLE_FAST(avsyncChanged, real, 0.0),
+    HANDLE_FAST(displayFramedropsChanged, integer, int64_t(0)),
+    HANDLE_FAST(decoderFramedropsChanged, integer, int64_t(0)),
+    HANDLE_FAST(audioBitrateChanged, real, 0.0),
+    HANDLE_FAST(videoBitrateChanged, real, 0.0)
+};
+
+// Also in the order of MpvObject::FastProperty, with the type each is
+// answered as when asked for by name.
+static const struct {
+    const char *name;
+    QVariant::Type type;
+} fastMirror[] = {
+    { "time-pos", QVariant::Double },
+    { "duration", QVariant::Double },
+    { "seekable", QVariant::Bool },
+    { "pause", QVariant::Bool },
+    { "estimated-vf-fps", QVariant::Double },
+    { "avsync", QVariant::Double },
+    { "frame-drop-count", QVariant::LongLong },
+    { "decoder-frame-drop-count", QVariant::LongLong },
+    { "audio-bitrate", QVariant::Double },
+    { "video-bitrate", QVariant::Double }
+};
+
 MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
 {
     // Setup threads
@@ -84,6 +128,8 @@ MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
     hideTimer = new QTimer(this);
     hideTimer->setSingleShot(true);
     hideTimer->setInterval(1000);
+    timingsTimer = new QTimer(this);
+    timingsTimer->setInterval(500);
 
     // Wire the basic mpv functions to avoid littering the codebase with
     // QMetaObject::invokeMethod.
@@ -101,20 +147,16 @@ MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
             ctrl, &MpvController::showStatsPage, Qt::QueuedConnection);
 
     // Wire up the event-handling callbacks
-    connect(ctrl, &MpvController::mpvPropertyChanged,
-            this, &MpvObject::ctrl_mpvPropertyChanged, Qt::QueuedConnection);
-    connect(ctrl, &MpvController::hookEvent,
-            this, &MpvObject::ctrl_hookEvent, Qt::QueuedConnection);
-    connect(ctrl, &MpvController::unhandledMpvEvent,
-            this, &MpvObject::ctrl_unhandledMpvEvent, Qt::QueuedConnection);
-    connect(ctrl, &MpvController::videoSizeChanged,
-            this, &MpvObject::ctrl_videoSizeChanged, Qt::QueuedConnection);
+    connect(ctrl, &MpvController::eventBatch,
+            this, &MpvObject::ctrl_eventBatch, Qt::QueuedConnection);
 
     // Wire up the mouse and timer-related callbacks
     connect(this, &MpvObject::mouseMoved,
             this, &MpvObject::self_mouseMoved);
     connect(hideTimer, &QTimer::timeout,
             this, &MpvObject::hideTimer_timeout);
+    connect(timingsTimer, &QTimer::timeout,
+            this, &MpvObject::timingsTimer_timeout);
 
     // Wire up the logging interface
     connect(ctrl, &MpvController::logMessageByParts,
@@ -138,24 +180,33 @@ MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
     QMetaObject::invokeMethod(ctrl, "create", Qt::BlockingQueuedConnection,
                               Q_ARG(MpvController::OptionList, earlyOptions));
 
+    // Count how often the worker thread wakes up.  Its event dispatcher
+    // exists by now, as the thread has just run create.
+    if (auto dispatcher = QAbstractEventDispatcher::instance(worker))
+        connect(dispatcher, &QAbstractEventDispatcher::awake, this, [this]() {
+            workerWakeups_.fetch_add(1, std::memory_order_relaxed);
+        }, Qt::DirectConnection);
+
     // clean up objects when the worker thread is deleted
     connect(worker, &QThread::finished, ctrl, &MpvController::deleteLater);
 
-    // Observe some properties
+    // Observe some properties.  The scalar ones that change often get a
+    // fast id, and skip name lookups and variants on their way here.
+    auto fast = &MpvController::fastPropertyId;
     MpvController::PropertyList options = {
-        { "time-pos", 0, MPV_FORMAT_DOUBLE },
-        { "pause", 0, MPV_FORMAT_FLAG },
+        { "time-pos", fast(FastTimePos), MPV_FORMAT_DOUBLE },
+        { "pause", fast(FastPause), MPV_FORMAT_FLAG },
         { "media-title", 0, MPV_FORMAT_STRING },
         { "chapter-metadata", 0, MPV_FORMAT_NODE },
         { "track-list", 0, MPV_FORMAT_NODE },
         { "chapter-list", 0, MPV_FORMAT_NODE },
-        { "duration", 0, MPV_FORMAT_DOUBLE },
-        { "estimated-vf-fps", 0, MPV_FORMAT_DOUBLE },
-        { "avsync", 0, MPV_FORMAT_DOUBLE },
-        { "frame-drop-count", 0, MPV_FORMAT_INT64 },
-        { "decoder-frame-drop-count", 0, MPV_FORMAT_INT64 },
-        { "audio-bitrate", 0, MPV_FORMAT_DOUBLE },
-        { "video-bitrate", 0, MPV_FORMAT_DOUBLE },
+        { "duration", fast(FastDuration), MPV_FORMAT_DOUBLE },
+        { "estimated-vf-fps", fast(FastFps), MPV_FORMAT_DOUBLE },
+        { "avsync", fast(FastAvsync), MPV_FORMAT_DOUBLE },
+        { "frame-drop-count", fast(FastDisplayDrops), MPV_FORMAT_INT64 },
+        { "decoder-frame-drop-count", fast(FastDecoderDrops), MPV_FORMAT_INT64 },
+        { "audio-bitrate", fast(FastAudioBitrate), MPV_FORMAT_DOUBLE },
+        { "video-bitrate", fast(FastVideoBitrate), MPV_FORMAT_DOUBLE },
         { "paused-for-cache", 0, MPV_FORMAT_FLAG },
         { "metadata", 0, MPV_FORMAT_NODE },
         { "audio-device-list", 0, MPV_FORMAT_NODE },
@@ -164,7 +215,9 @@ MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
         { "file-size", 0, MPV_FORMAT_STRING },
         { "file-date-created", 0, MPV_FORMAT_NODE },
         { "path", 0, MPV_FORMAT_STRING },
-        { "seekable", 0, MPV_FORMAT_FLAG }
+        { "seekable", fast(FastSeekable), MPV_FORMAT_FLAG },
+        { "chapter", 0, MPV_FORMAT_INT64 },
+        { "eof-reached", 0, MPV_FORMAT_FLAG }
     };
     QSet<QString> throttled = {
         "time-pos", "avsync", "estimated-vf-fps", "frame-drop-count",
@@ -175,6 +228,15 @@ MpvObject::MpvObject(QObject *owner, const QString &clientName) : QObject(owner)
                               Q_ARG(MpvController::PropertyList, options),
                               Q_ARG(QSet<QString>, throttled));
 
+    // Let the consumers of the fast properties decide how often they come.
+    policy = new MpvPropertyPolicy(options, this);
+    connect(policy, &MpvPropertyPolicy::observeProperties,
+            ctrl, &MpvController::observeProperties, Qt::QueuedConnection);
+    connect(policy, &MpvPropertyPolicy::unobservePropertiesById,
+            ctrl, &MpvController::unobservePropertiesById, Qt::QueuedConnection);
+    connect(policy, &MpvPropertyPolicy::setFastPropertyInterval,
+            ctrl, &MpvController::setFastPropertyInterval, Qt::QueuedConnection);
+
     QMetaObject::invokeMethod(ctrl, "addHook",
                               Qt::QueuedConnection,
                               Q_ARG(QString, "on_unload"),
@@ -199,6 +261,11 @@ MpvObject::~MpvObject()
         // can be reliably idle when we end it.
         QMetaObject::invokeMethod(ctrl, "stop",
                                   Qt::BlockingQueuedConnection);
+        auto counters = ctrl->eventCounters();
+        LogStream("mpvobject") << counters.events << " mpv events delivered in "
+                               << counters.batches << " batches, "
+                               << counters.coalesced << " property changes coalesced, "
+                               << blockingCalls << " blocking calls";
         ctrl = nullptr;
     }
     worker->quit();
@@ -242,6 +309,9 @@ void MpvObject::setWidgetType(Helpers::MpvWidgetType widgetType, MpvWidgetInterf
     case Helpers::VulkanCbWidget:
         widget = new MpvVulkanCbWidget(this);
         break;
+    case Helpers::GlThreadWidget:
+        widget = new MpvGlThreadWidget(this);
+        break;
     case Helpers::CustomWidget:
         widget = customWidget;
         if (widget == nullptr)
@@ -261,7 +331,7 @@ void MpvObject::setWidgetType(Helpers::MpvWidgetType widgetType, MpvWidgetInterf
 
 QString MpvObject::mpvVersion()
 {
-    return getMpvPropertyVariant("mpv-version").toString();
+    return ctrl->mpvVersion();
 }
 
 MpvController *MpvObject::controller()
@@ -271,7 +341,7 @@ MpvController *MpvObject::controller()
 
 QWidget *MpvObject::mpvWidget()
 {
-    return widget->self();
+    return widget ? widget->self() : nullptr;
 }
 
 QList<AudioDevice> MpvObject::audioDevices()
@@ -293,12 +363,20 @@ void MpvObject::showMessage(QString message)
 void MpvObject::showStatsPage(int page)
 {
     emit ctrlShowStats(page);
+    if (page == RenderTimingsPage) {
+        if (!renderingParked)
+            timingsTimer->start();
+        timingsTimer_timeout();
+    } else if (shownStatsPage == RenderTimingsPage) {
+        timingsTimer->stop();
+        emit ctrlCommand(QVariantList({"show_text", "", "0"}));
+    }
     shownStatsPage = page;
 }
 
 int MpvObject::cycleStatsPage()
 {
-    showStatsPage(shownStatsPage < 2 ? shownStatsPage+1 : -1);
+    showStatsPage(shownStatsPage < RenderTimingsPage ? shownStatsPage+1 : -1);
     return shownStatsPage;
 }
 
@@ -307,6 +385,11 @@ int MpvObject::selectedStatsPage()
     return shownStatsPage;
 }
 
+FrameTimings *MpvObject::frameTimings()
+{
+    return widget ? widget->frameTimings() : nullptr;
+}
+
 void MpvObject::urlOpen(QUrl url)
 {
     fileOpen(url.isLocalFile() ? url.toLocalFile()
@@ -410,6 +493,7 @@ bool MpvObject::setChapter(int64_t chapter)
     // MPV_ERROR_PROPERTY_FORMAT: past-the-end value requested
     // MPV_ERROR_SUCCESS: success
     int r;
+    countBlockingCall("set chapter");
     QMetaObject::invokeMethod(ctrl, "setPropertyVariant",
                               Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(int, r),
@@ -476,6 +560,26 @@ void MpvObject::setDrawLogo(bool yes)
     widget->setDrawLogo(yes);
 }
 
+void MpvObject::setRenderingParked(bool parked)
+{
+    if (widget)
+        widget->setRenderingParked(parked);
+    renderingParked = parked;
+    if (parked)
+        timingsTimer->stop();
+    else if (shownStatsPage == RenderTimingsPage)
+        timingsTimer->start();
+}
+
+void MpvObject::refreshPlayTime()
+{
+    // For when time-pos has not been observed for a while.
+    getMpvPropertyAsync("time-pos", [this](QVariant v) {
+        if (v.type() == QVariant::Double)
+            self_playTimeChanged(v.toDouble());
+    });
+}
+
 void MpvObject::setVolume(int64_t volume)
 {
     static int64_t lastVolume = -1;
@@ -515,6 +619,11 @@ QSize MpvObject::videoSize()
     return videoSize_;
 }
 
+QVariantMap MpvObject::metaData()
+{
+    return metaData_;
+}
+
 bool MpvObject::clientDebuggingMessages()
 {
     return debugMessages;
@@ -531,6 +640,7 @@ void MpvObject::setCachedMpvOption(const QString &option, const QVariant &value)
 QVariant MpvObject::blockingMpvCommand(QVariant params)
 {
     QVariant v;
+    countBlockingCall("command");
     QMetaObject::invokeMethod(ctrl, "command",
                               Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(QVariant, v),
@@ -541,6 +651,7 @@ QVariant MpvObject::blockingMpvCommand(QVariant params)
 QVariant MpvObject::blockingSetMpvPropertyVariant(QString name, QVariant value)
 {
     int v;
+    countBlockingCall("set property " + name);
     QMetaObject::invokeMethod(ctrl, "setPropertyVariant",
                               Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(int, v),
@@ -553,6 +664,7 @@ QVariant MpvObject::blockingSetMpvPropertyVariant(QString name, QVariant value)
 QVariant MpvObject::blockingSetMpvOptionVariant(QString name, QVariant value)
 {
     int v;
+    countBlockingCall("set option " + name);
     QMetaObject::invokeMethod(ctrl, "setOptionVariant",
                               Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(int, v),
@@ -564,7 +676,17 @@ QVariant MpvObject::blockingSetMpvOptionVariant(QString name, QVariant value)
 
 QVariant MpvObject::getMpvPropertyVariant(QString name)
 {
+    // Observed properties are answered from the mirror, which is as fresh
+    // as the last batch of events, and so are the fast ones while they are
+    // observed.  Anything else has to ask mpv.
+    auto it = propertyMirror.constFind(name);
+    if (it != propertyMirror.constEnd())
+        return *it;
+    int fast = fastIndexOf(name);
+    if (fast >= 0 && fastReported[fast] && policy->isObserved(name))
+        return fastValue(fast);
     QVariant v;
+    countBlockingCall("get property " + name);
     QMetaObject::invokeMethod(ctrl, "getPropertyVariant",
                               Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(QVariant, v),
@@ -572,6 +694,129 @@ QVariant MpvObject::getMpvPropertyVariant(QString name)
     return v;
 }
 
+QVariant MpvObject::mirroredMpvProperty(QString name)
+{
+    // Like getMpvPropertyVariant, but never asks mpv.  Properties that have
+    // not been reported yet come back invalid.
+    int fast = fastIndexOf(name);
+    if (fast >= 0)
+        return fastReported[fast] ? fastValue(fast) : QVariant();
+    return propertyMirror.value(name);
+}
+
+int MpvObject::fastIndexOf(const QString &name) const
+{
+    for (int i = 0; i < FastPropertyCount; ++i)
+        if (name == QLatin1String(fastMirror[i].name))
+            return i;
+    return -1;
+}
+
+QVariant MpvObject::fastValue(int index) const
+{
+    const MpvFastProperty &p = fastValues[index];
+    if (!p.ok)
+        return QVariant::fromValue(MpvErrorCode(MPV_ERROR_PROPERTY_UNAVAILABLE));
+    switch (fastMirror[index].type) {
+    case QVariant::Bool:
+        return bool(p.integer);
+    case QVariant::LongLong:
+        return qlonglong(p.integer);
+    default:
+        return p.real;
+    }
+}
+
+void MpvObject::getMpvPropertyAsync(QString name, const std::function<void(QVariant)> &callback)
+{
+    // For when the current value is needed rather than the mirrored one.
+    // The callback is run on this thread.
+    QMetaObject::invokeMethod(ctrl, "getPropertyVariantAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QString, name),
+                              Q_ARG(MpvCallback*, new MpvCallback(callback, this)));
+}
+
+void MpvObject::getMpvPropertyStringAsync(QString name, const std::function<void(QVariant)> &callback)
+{
+    // As above, but mpv formats the value as a string.
+    QMetaObject::invokeMethod(ctrl, "getPropertyStringAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QString, name),
+                              Q_ARG(MpvCallback*, new MpvCallback(callback, this)));
+}
+
+void MpvObject::setMpvPropertyAsync(QString name, QVariant value, const std::function<void(QVariant)> &callback)
+{
+    // The callback gets nothing on success, or the MpvErrorCode.
+    QMetaObject::invokeMethod(ctrl, "setPropertyVariantAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QString, name),
+                              Q_ARG(QVariant, value),
+                              Q_ARG(MpvCallback*, new MpvCallback(callback, this)));
+}
+
+void MpvObject::setMpvOptionAsync(QString name, QVariant value, const std::function<void(QVariant)> &callback)
+{
+    // Options can be set as properties once mpv is running.
+    setMpvPropertyAsync("options/" + name, value, callback);
+}
+
+void MpvObject::mpvCommandAsync(QVariant params, const std::function<void(QVariant)> &callback)
+{
+    // The callback gets the result of the command, or the MpvErrorCode.
+    QMetaObject::invokeMethod(ctrl, "commandAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QVariant, params),
+                              Q_ARG(MpvCallback*, new MpvCallback(callback, this)));
+}
+
+void MpvObject::grabRawFrame(const QSize &size, const std::function<void(QImage)> &callback)
+{
+    // Takes the current video frame from mpv itself, so no widget or render
+    // context is needed.  The callback is run on this thread.
+    auto reply = [callback](QVariant v) { callback(v.value<QImage>()); };
+    QMetaObject::invokeMethod(ctrl, "screenshotRaw", Qt::QueuedConnection,
+                              Q_ARG(QSize, size),
+                              Q_ARG(MpvCallback*, new MpvCallback(reply, this)));
+}
+
+int MpvObject::blockingCallCount()
+{
+    return blockingCalls;
+}
+
+quint64 MpvObject::workerWakeups() const
+{
+    return workerWakeups_.load(std::memory_order_relaxed);
+}
+
+QVariantMap MpvObject::eventStats() const
+{
+    // The controller's counters are atomic, so they can be read from here.
+    if (!ctrl)
+        return QVariantMap();
+    auto counters = ctrl->eventCounters();
+    return QVariantMap {
+        { "events", static_cast<unsigned long long>(counters.events) },
+        { "batches", static_cast<unsigned long long>(counters.batches) },
+        { "coalesced", static_cast<unsigned long long>(counters.coalesced) }
+    };
+}
+
+void MpvObject::setPropertyDemand(const QString &consumer, const QString &property, int msec)
+{
+    if (!policy->setDemand(consumer, property, msec))
+        LogStream("mpvobject") << property << " demanded, but it is not a fast property.";
+}
+
+
+void MpvObject::countBlockingCall(const QString &what)
+{
+    ++blockingCalls;
+    if (debugMessages)
+        LogStream("mpvobject") << "blocking call #" << blockingCalls << ": " << what;
+}
 
 void MpvObject::setMpvPropertyVariant(QString name, QVariant value)
 {
@@ -597,16 +842,61 @@ void MpvObject::hideCursor()
     widget->self()->setCursor(Qt::BlankCursor);
 }
 
+void MpvObject::ctrl_eventBatch(const MpvEventBatch &batch)
+{
+    for (const MpvEventBatch::Entry &e : batch.entries) {
+        if (e.superseded)
+            continue;
+        switch (e.kind) {
+        case MpvEventBatch::PropertyChange:
+            // Our own properties are observed with a zero id.  Anything
+            // else was observed for an IPC client, possibly in another
+            // format, and must not reach the mirror or the handlers.
+            if (e.userData == 0)
+                ctrl_mpvPropertyChanged(e.name, e.value);
+            break;
+        case MpvEventBatch::FastPropertyChange:
+            ctrl_mpvFastPropertyChanged(e.fast);
+            break;
+        case MpvEventBatch::VideoSizeChange:
+            ctrl_videoSizeChanged(e.detail->size);
+            break;
+        case MpvEventBatch::Hook:
+            ctrl_hookEvent(e.name, e.userData, e.detail->mpvId);
+            break;
+        case MpvEventBatch::ClientMessage:
+            break;
+        case MpvEventBatch::Unhandled:
+            ctrl_unhandledMpvEvent(e.eventId);
+            break;
+        }
+    }
+}
+
 void MpvObject::ctrl_mpvPropertyChanged(QString name, QVariant v)
 {
     if (debugMessages)
         LogStream("mpvobject") << name << " property changed to " << v;
 
+    // Properties without a handler are only observed to keep the mirror
+    // up to date.
+    propertyMirror.insert(name, v);
     bool ok = v.type() < QVariant::UserType;
-    if (propertyDispatch.contains(name))
-        propertyDispatch[name](this, ok, v);
-    else
-        LogStream("mpvobject") << name << " property changed, but was not in dispatch list.";
+    auto it = propertyDispatch.constFind(name);
+    if (it != propertyDispatch.constEnd())
+        (*it)(this, ok, v);
+}
+
+void MpvObject::ctrl_mpvFastPropertyChanged(const MpvFastProperty &p)
+{
+    if (p.index < 0 || p.index >= FastPropertyCount)
+        return;
+    if (debugMessages)
+        LogStream("mpvobject") << "fast property " << p.index << " changed to "
+                               << p.real << "/" << p.integer << (p.ok ? "" : " (error)");
+    fastValues[p.index] = p;
+    fastReported[p.index] = true;
+    fastDispatch[p.index](this, p);
 }
 
 void MpvObject::ctrl_hookEvent(QString name, uint64_t selfId, uint64_t mpvId)
@@ -614,12 +904,18 @@ void MpvObject::ctrl_hookEvent(QString name, uint64_t selfId, uint64_t mpvId)
     if (reinterpret_cast<MpvObject*>(selfId) != this)
         return;
 
-    if (name == "on_unload") {
-        QVariantList playlist = getMpvPropertyVariant("playlist").toList();
+    if (name != "on_unload") {
+        emit ctrlContinueHook(mpvId);
+        return;
+    }
+    // mpv waits for the hook to be continued, so the playlist it has now is
+    // the one about to be unloaded.
+    getMpvPropertyAsync("playlist", [this, mpvId](QVariant v) {
+        QVariantList playlist = v.toList();
         if (playlist.count() > 1)
             emit playlistChanged(playlist);
-    }
-    emit ctrlContinueHook(mpvId);
+        emit ctrlContinueHook(mpvId);
+    });
 }
 
 void MpvObject::ctrl_unhandledMpvEvent(int eventLevel)
@@ -634,6 +930,9 @@ void MpvObject::ctrl_unhandledMpvEvent(int eventLevel)
     case MPV_EVENT_FILE_LOADED: {
         if (debugMessages)
             Logger::log("mpvobject", "file loaded");
+        // Timings are kept for one file at a time.
+        if (FrameTimings *timings = frameTimings())
+            timings->clear();
         emit playbackStarted();
         break;
     }
@@ -681,6 +980,7 @@ void MpvObject::self_metadata(QVariantMap metadata)
     QVariantMap map;
     for (auto it = metadata.begin(); it != metadata.end(); it++)
         map.insert(it.key().toLower(), it.value());
+    metaData_ = map;
     emit metaDataChanged(map);
 }
 
@@ -701,6 +1001,16 @@ void MpvObject::hideTimer_timeout()
     hideCursor();
 }
 
+void MpvObject::timingsTimer_timeout()
+{
+    // Shown for a little longer than the timer interval, so that the text
+    // does not flicker between refreshes.
+    FrameTimings *timings = frameTimings();
+    QString text = timings ? timings->summary()
+                           : tr("Render timings are not available for this widget");
+    emit ctrlCommand(QVariantList({"show_text", text, "1000"}));
+}
+
 //----------------------------------------------------------------------------
 
 MpvWidgetInterface::MpvWidgetInterface(MpvObject *object)
@@ -734,6 +1044,32 @@ void MpvWidgetInterface::setDrawLogo(bool yes)
     Q_UNUSED(yes)
 }
 
+void MpvWidgetInterface::setRenderingParked(bool parked)
+{
+    Q_UNUSED(parked)
+}
+
+bool MpvWidgetInterface::windowShowsFrames(QWidget *widget)
+{
+    // Hidden and minimized windows show nothing.  Qt repaints the widget
+    // when it can be seen again, which draws a fresh frame.  Only some
+    // window systems tell Qt that a window is covered entirely, e.g. macOS,
+    // by unexposing it.  X11 and Wayland don't, so frames are still drawn
+    // for covered windows there.
+    QWindow *handle = widget->window()->windowHandle();
+    if (!handle || widget->window()->isMinimized())
+        return false;
+    QWindow::Visibility visibility = handle->visibility();
+    if (visibility == QWindow::Hidden || visibility == QWindow::Minimized)
+        return false;
+    return handle->isExposed();
+}
+
+FrameTimings *MpvWidgetInterface::frameTimings()
+{
+    return nullptr;
+}
+
 
 //----------------------------------------------------------------------------
 
@@ -753,6 +1089,32 @@ static void* GLAPIENTRY glMPGetNativeDisplay(const char* name)
     return nullptr;
 }
 
+static mpv_render_param nativeDisplayParam(QWidget *widget)
+{
+    mpv_render_param param { MPV_RENDER_PARAM_INVALID, nullptr };
+    QWidget *nativeParent = widget->nativeParentWidget();
+    if (nativeParent == nullptr) {
+        Logger::log("glwidget", "no native parent handle");
+    }
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+    else if (QGuiApplication::platformName().contains("xcb")) {
+        Logger::log("glwidget", "assigning x11 display");
+        param.type = MPV_RENDER_PARAM_X11_DISPLAY;
+        param.data = QX11Info::display();
+    } else if (QGuiApplication::platformName().contains("wayland")) {
+        Logger::log("glwidget", "assigning wayland display");
+        QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
+        param.type = MPV_RENDER_PARAM_WL_DISPLAY;
+        param.data = native->nativeResourceForWindow("display", nullptr);
+    } else
+#endif
+    {
+        Logger::log("glwidget", "unknown display mode (eglfs et al)");
+    }
+    return param;
+}
+
+
  void *MpvGlWidget::get_proc_address(void *ctx, const char *name)
  {
     (void)ctx;
@@ -801,6 +1163,8 @@ MpvGlWidget::MpvGlWidget(MpvObject *object, QWidget *parent) :
 
 MpvGlWidget::~MpvGlWidget()
 {
+    LogStream("glwidget") << framesRendered << " frames rendered, "
+                          << framesSkipped << " skipped while hidden";
     makeCurrent();
     if (render) {
         ctrl->destroyRenderContext(render);
@@ -818,6 +1182,21 @@ QWidget *MpvGlWidget::self()
     return this;
 }
 
+FrameTimings *MpvGlWidget::frameTimings()
+{
+    return &timings;
+}
+
+quint64 MpvGlWidget::renderedFrames() const
+{
+    return framesRendered;
+}
+
+quint64 MpvGlWidget::skippedFrames() const
+{
+    return framesSkipped;
+}
+
 void MpvGlWidget::initMpv()
 {
     // this takes place in initializeGL
@@ -850,6 +1229,16 @@ void MpvGlWidget::setDrawLogo(bool yes)
     update();
 }
 
+void MpvGlWidget::setRenderingParked(bool parked)
+{
+    // Redraws requested while parked are folded into one, made on unparking.
+    renderingParked = parked;
+    if (!parked && updatePending) {
+        updatePending = false;
+        update();
+    }
+}
+
 void MpvGlWidget::initializeGL()
 {
     if (!logo)
@@ -859,28 +1248,9 @@ void MpvGlWidget::initializeGL()
     mpv_render_param params[] {
         { MPV_RENDER_PARAM_API_TYPE, const_cast<char*>(MPV_RENDER_API_TYPE_OPENGL) },
         { MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &glInit },
-        { MPV_RENDER_PARAM_INVALID, nullptr },
+        nativeDisplayParam(this),
         { MPV_RENDER_PARAM_INVALID, nullptr }
     };
-    QWidget *nativeParent = nativeParentWidget();
-    if (nativeParent == nullptr) {
-        Logger::log("glwidget", "no native parent handle");
-    }
-#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
-    else if (QGuiApplication::platformName().contains("xcb")) {
-        Logger::log("glwidget", "assigning x11 display");
-        params[2].type = MPV_RENDER_PARAM_X11_DISPLAY;
-        params[2].data = QX11Info::display();
-    } else if (QGuiApplication::platformName().contains("wayland")) {
-        Logger::log("glwidget", "assigning wayland display");
-        QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
-        params[2].type = MPV_RENDER_PARAM_WL_DISPLAY;
-        params[2].data = native->nativeResourceForWindow("display", nullptr);
-    } else
-#endif
-    {
-        Logger::log("glwidget", "unknown display mode (eglfs et al)");
-    }
     render = ctrl->createRenderContext(params);
     mpv_render_context_set_update_callback(render, MpvGlWidget::render_update, this);
 }
@@ -894,6 +1264,7 @@ void MpvGlWidget::paintGL()
             logo->paintGL(this);
         return;
     }
+    timings.paintStarted();
 
     bool yes = true;
     mpv_opengl_fbo fbo { static_cast<int>(defaultFramebufferObject()), glWidth, glHeight, 0 };
@@ -901,7 +1272,10 @@ void MpvGlWidget::paintGL()
         {MPV_RENDER_PARAM_OPENGL_FBO, &fbo },
         {MPV_RENDER_PARAM_FLIP_Y, &yes}
     };
+    timings.renderStarted();
     mpv_render_context_render(render, params);
+    timings.renderFinished();
+    ++framesRendered;
 }
 
 void MpvGlWidget::resizeGL(int w, int h)
@@ -926,26 +1300,57 @@ void MpvGlWidget::mousePressEvent(QMouseEvent *event)
 
 void MpvGlWidget::render_update(void *ctx)
 {
-    QMetaObject::invokeMethod(reinterpret_cast<MpvGlWidget*>(ctx), "maybeUpdate");
+    auto self = reinterpret_cast<MpvGlWidget*>(ctx);
+    self->timings.callback();
+    QMetaObject::invokeMethod(self, "maybeUpdate");
 }
 
 void MpvGlWidget::maybeUpdate()
 {
-    if (window()->isMinimized()) {
-        makeCurrent();
-        paintGL();
-        context()->swapBuffers(context()->surface());
-        self_frameSwapped();
-        doneCurrent();
-    } else {
-        update();
+    timings.delivered();
+    if (renderingParked) {
+        updatePending = true;
+        return;
     }
+    if (!framesVisible())
+        skipFrame();
+    else
+        update();
+}
+
+bool MpvGlWidget::framesVisible()
+{
+    return windowShowsFrames(this);
+}
+
+void MpvGlWidget::skipFrame()
+{
+    // Let mpv take the frame as presented without drawing it, so that its
+    // timing and A/V sync carry on as if the window could be seen.
+    if (drawLogo || !render)
+        return;
+    int yes = 1;
+    mpv_opengl_fbo fbo { static_cast<int>(defaultFramebufferObject()), glWidth, glHeight, 0 };
+    mpv_render_param params[] {
+        { MPV_RENDER_PARAM_OPENGL_FBO, &fbo },
+        { MPV_RENDER_PARAM_SKIP_RENDERING, &yes },
+        { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    makeCurrent();
+    mpv_render_context_render(render, params);
+    doneCurrent();
+    timings.frameSkipped();
+    ++framesSkipped;
 }
 
 void MpvGlWidget::self_frameSwapped()
 {
-    if (!drawLogo)
-        mpv_render_context_report_swap(render);
+    if (drawLogo)
+        return;
+    mpv_render_context_report_swap(render);
+    QScreen *screen = window()->windowHandle() ? window()->windowHandle()->screen()
+                                               : nullptr;
+    timings.swapped(screen ? screen->refreshRate() : 0.0);
 }
 
 void MpvGlWidget::self_playbackStarted()
@@ -959,6 +1364,472 @@ void MpvGlWidget::self_playbackFinished()
     update();
 }
 
+//----------------------------------------------------------------------------
+
+MpvGlThreadRenderer::MpvGlThreadRenderer(MpvController *ctrl, QOpenGLContext *context,
+                                         QWindow *window, QOffscreenSurface *surface,
+                                         const mpv_render_param &displayParam)
+    : QObject(nullptr), ctrl(ctrl), context(context), window(window),
+      surface(surface), displayParam(displayParam)
+{
+}
+
+MpvGlThreadRenderer::~MpvGlThreadRenderer()
+{
+}
+
+void MpvGlThreadRenderer::setTargetSize(const QSize &size)
+{
+    QMutexLocker locker(&lock);
+    targetSize = size.expandedTo(QSize(1, 1));
+}
+
+void MpvGlThreadRenderer::setRefreshRate(double rate)
+{
+    QMutexLocker locker(&lock);
+    refreshRate = rate;
+}
+
+void MpvGlThreadRenderer::setSkipping(bool skipping)
+{
+    this->skipping = skipping;
+}
+
+FrameTimings *MpvGlThreadRenderer::frameTimings()
+{
+    return &timings;
+}
+
+void MpvGlThreadRenderer::initialize()
+{
+    context->makeCurrent(surface);
+    mpv_opengl_init_params glInit { &MpvGlWidget::get_proc_address, this, nullptr };
+    mpv_render_param params[] {
+        { MPV_RENDER_PARAM_API_TYPE, const_cast<char*>(MPV_RENDER_API_TYPE_OPENGL) },
+        { MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &glInit },
+        displayParam,
+        { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    mpvRender = ctrl->createRenderContext(params);
+    mpv_render_context_set_update_callback(mpvRender, MpvGlThreadRenderer::render_update, this);
+}
+
+void MpvGlThreadRenderer::render(bool force)
+{
+    renderQueued = false;
+    if (!mpvRender)
+        return;
+    timings.delivered();
+    uint64_t flags = mpv_render_context_update(mpvRender);
+    if (!(flags & MPV_RENDER_UPDATE_FRAME) && !force)
+        return;
+
+    QSize size;
+    double rate;
+    {
+        QMutexLocker locker(&lock);
+        size = targetSize;
+        rate = refreshRate;
+    }
+
+    // Skipped frames are still handed to mpv, so that its timing carries on.
+    // The window may not be there to draw to, so they get the offscreen
+    // surface.
+    if (skipping || !context->makeCurrent(window)) {
+        context->makeCurrent(surface);
+        int yes = 1;
+        mpv_opengl_fbo mpvFbo { static_cast<int>(context->defaultFramebufferObject()), 1, 1, 0 };
+        mpv_render_param params[] {
+            { MPV_RENDER_PARAM_OPENGL_FBO, &mpvFbo },
+            { MPV_RENDER_PARAM_SKIP_RENDERING, &yes },
+            { MPV_RENDER_PARAM_INVALID, nullptr }
+        };
+        mpv_render_context_render(mpvRender, params);
+        timings.frameSkipped();
+        emit frameDone(false);
+        return;
+    }
+
+    int flip = 1;
+    mpv_opengl_fbo mpvFbo { static_cast<int>(context->defaultFramebufferObject()),
+                            size.width(), size.height(), 0 };
+    mpv_render_param params[] {
+        { MPV_RENDER_PARAM_OPENGL_FBO, &mpvFbo },
+        { MPV_RENDER_PARAM_FLIP_Y, &flip },
+        { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    timings.paintStarted();
+    timings.renderStarted();
+    mpv_render_context_render(mpvRender, params);
+    timings.renderFinished();
+
+    // The swap is what puts the frame on screen, so mpv hears of it only
+    // afterwards.  Nothing else reads the frame, so there is nothing to
+    // wait for before it.
+    context->swapBuffers(window);
+    mpv_render_context_report_swap(mpvRender);
+    timings.swapped(rate);
+    emit frameDone(true);
+}
+
+void MpvGlThreadRenderer::shutdown()
+{
+    context->makeCurrent(surface);
+    if (mpvRender) {
+        ctrl->destroyRenderContext(mpvRender);
+        mpvRender = nullptr;
+    }
+    context->doneCurrent();
+    delete context;
+    context = nullptr;
+}
+
+void MpvGlThreadRenderer::render_update(void *ctx)
+{
+    // Callbacks that arrive before the last one was served are folded in.
+    auto self = reinterpret_cast<MpvGlThreadRenderer*>(ctx);
+    self->timings.callback();
+    if (!self->renderQueued.exchange(true))
+        QMetaObject::invokeMethod(self, "render", Qt::QueuedConnection,
+                                  Q_ARG(bool, false));
+}
+
+//----------------------------------------------------------------------------
+
+MpvGlThreadWidget::MpvGlThreadWidget(MpvObject *object, QWidget *parent) :
+    QWidget(parent), MpvWidgetInterface(object)
+{
+    // The video window covers us while something plays, and the logo is
+    // painted straight over the whole widget otherwise.
+    setAttribute(Qt::WA_NativeWindow);
+    setAttribute(Qt::WA_DontCreateNativeAncestors);
+    setAttribute(Qt::WA_NoSystemBackground);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    connect(mpvObject, &MpvObject::playbackStarted,
+            this, &MpvGlThreadWidget::self_playbackStarted);
+    connect(mpvObject, &MpvObject::playbackFinished,
+            this, &MpvGlThreadWidget::self_playbackFinished);
+    setContextMenuPolicy(Qt::CustomContextMenu);
+    logo = new LogoDrawer(this);
+    connect(logo, &LogoDrawer::logoSize,
+            mpvObject, &MpvObject::logoSizeChanged);
+}
+
+MpvGlThreadWidget::~MpvGlThreadWidget()
+{
+    LogStream("glthreadwidget") << framesRendered << " frames rendered, "
+                                << framesSkipped << " skipped";
+    if (renderer) {
+        QMetaObject::invokeMethod(renderer, "shutdown",
+                                  Qt::BlockingQueuedConnection);
+        renderThread->quit();
+        renderThread->wait();
+        delete renderer;
+        renderer = nullptr;
+        delete renderThread;
+        renderThread = nullptr;
+    }
+    delete videoContainer;
+    videoContainer = nullptr;
+    videoWindow = nullptr;
+    delete surface;
+    surface = nullptr;
+}
+
+QWidget *MpvGlThreadWidget::self()
+{
+    return this;
+}
+
+void MpvGlThreadWidget::initMpv()
+{
+    // The video window takes no input, so that mouse events reach us and
+    // then the main window as they do with the other widgets.  It, the
+    // render context and the offscreen surface have to be made on the gui
+    // thread.
+    winId();
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    videoWindow = new QWindow();
+    videoWindow->setSurfaceType(QSurface::OpenGLSurface);
+    videoWindow->setFormat(format);
+    videoWindow->setFlags(Qt::WindowTransparentForInput);
+    videoWindow->installEventFilter(this);
+    videoContainer = QWidget::createWindowContainer(videoWindow, this);
+    videoContainer->setAttribute(Qt::WA_TransparentForMouseEvents);
+    videoContainer->setGeometry(rect());
+    videoContainer->setVisible(!drawLogo);
+
+    QOpenGLContext *renderContext = new QOpenGLContext();
+    renderContext->setFormat(format);
+    if (!renderContext->create())
+        throw std::runtime_error("Could not create render thread context");
+    surface = new QOffscreenSurface();
+    surface->setFormat(renderContext->format());
+    surface->create();
+
+    renderThread = new QThread();
+    renderThread->start();
+    renderer = new MpvGlThreadRenderer(ctrl, renderContext, videoWindow, surface,
+                                       nativeDisplayParam(videoContainer));
+    renderContext->moveToThread(renderThread);
+    renderer->moveToThread(renderThread);
+    connect(renderer, &MpvGlThreadRenderer::frameDone,
+            this, &MpvGlThreadWidget::renderer_frameDone, Qt::QueuedConnection);
+    QMetaObject::invokeMethod(renderer, "initialize",
+                              Qt::BlockingQueuedConnection);
+    updateTarget();
+    updateSkipping();
+}
+
+void MpvGlThreadWidget::setLogoUrl(const QString &filename)
+{
+    logo->setLogoUrl(filename);
+    logo->resizeGL(width(), height());
+    if (drawLogo)
+        update();
+}
+
+void MpvGlThreadWidget::setLogoBackground(const QColor &color)
+{
+    logo->setLogoBackground(color);
+}
+
+void MpvGlThreadWidget::setDrawLogo(bool yes)
+{
+    drawLogo = yes;
+    if (videoContainer)
+        videoContainer->setVisible(!drawLogo);
+    updateSkipping();
+    update();
+}
+
+void MpvGlThreadWidget::setRenderingParked(bool parked)
+{
+    // Parked frames are skipped rather than held back, as the renderer has
+    // no way to fold them into one.
+    renderingParked = parked;
+    bool wasSkipping = skippingFrames;
+    updateSkipping();
+    if (wasSkipping && !skippingFrames)
+        requestRender();
+}
+
+FrameTimings *MpvGlThreadWidget::frameTimings()
+{
+    return renderer ? renderer->frameTimings() : nullptr;
+}
+
+bool MpvGlThreadWidget::eventFilter(QObject *watched, QEvent *event)
+{
+    // A paused video gets no new frames, so one is drawn when the video
+    // window can be seen again.
+    if (watched == videoWindow && event->type() == QEvent::Expose) {
+        bool wasSkipping = skippingFrames;
+        updateSkipping();
+        if (wasSkipping && !skippingFrames)
+            requestRender();
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
+void MpvGlThreadWidget::childEvent(QChildEvent *event)
+{
+    // Widgets laid over the video, such as the bottom area in fullscreen,
+    // need windows of their own to be seen above it.
+    if (event->added() && event->child()->isWidgetType()
+            && !event->child()->inherits("QWindowContainer")) {
+        QWidget *child = static_cast<QWidget*>(event->child());
+        child->setAttribute(Qt::WA_NativeWindow);
+        child->raise();
+    }
+    QWidget::childEvent(event);
+}
+
+void MpvGlThreadWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event)
+    if (drawLogo)
+        logo->paintGL(this);
+}
+
+void MpvGlThreadWidget::resizeEvent(QResizeEvent *event)
+{
+    logo->resizeGL(width(), height());
+    if (videoContainer)
+        videoContainer->setGeometry(rect());
+    updateTarget();
+    requestRender();
+    QWidget::resizeEvent(event);
+}
+
+void MpvGlThreadWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    emit mpvObject->mouseMoved(event->x(), event->y());
+    QWidget::mouseMoveEvent(event);
+}
+
+void MpvGlThreadWidget::mousePressEvent(QMouseEvent *event)
+{
+    emit mpvObject->mousePress(event->x(), event->y());
+    QWidget::mousePressEvent(event);
+}
+
+void MpvGlThreadWidget::requestRender()
+{
+    // Renders the current frame again, for when it has to be redrawn
+    // without mpv having a new one.
+    if (renderer && !skippingFrames)
+        QMetaObject::invokeMethod(renderer, "render", Qt::QueuedConnection,
+                                  Q_ARG(bool, true));
+}
+
+void MpvGlThreadWidget::updateSkipping()
+{
+    if (!renderer)
+        return;
+    skippingFrames = drawLogo || renderingParked || !windowShowsFrames(this)
+            || !videoWindow->isExposed();
+    renderer->setSkipping(skippingFrames);
+}
+
+void MpvGlThreadWidget::updateTarget()
+{
+    if (!renderer)
+        return;
+    renderer->setTargetSize(size() * devicePixelRatioF());
+    QWindow *handle = window()->windowHandle();
+    QScreen *screen = handle ? handle->screen() : nullptr;
+    renderer->setRefreshRate(screen ? screen->refreshRate() : 0.0);
+}
+
+void MpvGlThreadWidget::renderer_frameDone(bool rendered)
+{
+    if (rendered)
+        ++framesRendered;
+    else
+        ++framesSkipped;
+
+    // Skipped frames still come through here, so that a restored window is
+    // noticed and given a fresh frame.
+    bool wasSkipping = skippingFrames;
+    updateSkipping();
+    if (wasSkipping && !skippingFrames)
+        requestRender();
+}
+
+void MpvGlThreadWidget::self_playbackStarted()
+{
+    setDrawLogo(false);
+}
+
+void MpvGlThreadWidget::self_playbackFinished()
+{
+    setDrawLogo(true);
+}
+
+//----------------------------------------------------------------------------
+
+MpvEmbedWidget::MpvEmbedWidget(MpvObject *object, QWidget *parent) :
+    QWidget(parent), MpvWidgetInterface(object)
+{
+    // mpv draws over us, so there is no background for Qt to paint.
+    setAttribute(Qt::WA_NativeWindow);
+    setAttribute(Qt::WA_DontCreateNativeAncestors);
+    setAttribute(Qt::WA_NoSystemBackground);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    connect(mpvObject, &MpvObject::playbackStarted,
+            this, &MpvEmbedWidget::self_playbackStarted);
+    connect(mpvObject, &MpvObject::playbackFinished,
+            this, &MpvEmbedWidget::self_playbackFinished);
+    setContextMenuPolicy(Qt::CustomContextMenu);
+    logo = new LogoDrawer(this);
+    connect(logo, &LogoDrawer::logoSize,
+            mpvObject, &MpvObject::logoSizeChanged);
+}
+
+MpvEmbedWidget::~MpvEmbedWidget()
+{
+    // Take the video output out of our window before it goes away, and put
+    // back the one the other widgets expect.
+    if (ctrl) {
+        mpvObject->blockingSetMpvOptionVariant("vo", "libmpv");
+        mpvObject->blockingSetMpvOptionVariant("wid", qlonglong(-1));
+    }
+}
+
+QWidget *MpvEmbedWidget::self()
+{
+    return this;
+}
+
+void MpvEmbedWidget::initMpv()
+{
+    // mpv's window is made inside ours when video starts.  It is told to
+    // leave input alone, so that mouse events reach the main window as they
+    // do with the other widgets.
+    mpvObject->blockingSetMpvOptionVariant("input-cursor", false);
+    mpvObject->blockingSetMpvOptionVariant("input-vo-keyboard", false);
+    mpvObject->blockingSetMpvOptionVariant("cursor-autohide", "no");
+    mpvObject->blockingSetMpvOptionVariant("force-window", false);
+    mpvObject->blockingSetMpvOptionVariant("wid", qlonglong(winId()));
+    mpvObject->blockingSetMpvOptionVariant("vo", "gpu");
+}
+
+void MpvEmbedWidget::setLogoUrl(const QString &filename)
+{
+    logo->setLogoUrl(filename);
+    logo->resizeGL(width(), height());
+    if (drawLogo)
+        update();
+}
+
+void MpvEmbedWidget::setLogoBackground(const QColor &color)
+{
+    logo->setLogoBackground(color);
+}
+
+void MpvEmbedWidget::setDrawLogo(bool yes)
+{
+    drawLogo = yes;
+    update();
+}
+
+void MpvEmbedWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event)
+    if (drawLogo)
+        logo->paintGL(this);
+}
+
+void MpvEmbedWidget::resizeEvent(QResizeEvent *event)
+{
+    logo->resizeGL(width(), height());
+    QWidget::resizeEvent(event);
+}
+
+void MpvEmbedWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    emit mpvObject->mouseMoved(event->x(), event->y());
+    QWidget::mouseMoveEvent(event);
+}
+
+void MpvEmbedWidget::mousePressEvent(QMouseEvent *event)
+{
+    emit mpvObject->mousePress(event->x(), event->y());
+    QWidget::mousePressEvent(event);
+}
+
+void MpvEmbedWidget::self_playbackStarted()
+{
+    drawLogo = false;
+}
+
+void MpvEmbedWidget::self_playbackFinished()
+{
+    drawLogo = true;
+    update();
+}
+
 
 
 MpvCallback::MpvCallback(const Callback &callback,
@@ -979,11 +1850,15 @@ void MpvCallback::reply(QVariant value)
 MpvController::MpvController(QObject *parent) : QObject(parent),
     lastVideoSize(0,0)
 {
+    // The throttler only runs while there are values waiting to go out.
     throttler = new QTimer(this);
+    throttler->setSingleShot(true);
     connect(throttler, &QTimer::timeout,
             this, &MpvController::flushProperties);
-    throttler->setInterval(1000/12);
-    throttler->start();
+    throttleClock.start();
+    std::fill_n(batchedFast, fastPropertyLimit, -1);
+    std::fill_n(fastIntervals, fastPropertyLimit, -1);
+    std::fill_n(fastFlushed, fastPropertyLimit, qint64(0));
 }
 
 MpvController::~MpvController()
@@ -1007,6 +1882,7 @@ void MpvController::create(const OptionList &earlyOptions)
         throw std::runtime_error("could not initialize mpv context");
 
     mpv_set_wakeup_callback(mpv, MpvController::mpvWakeup, this);
+    mpvVersion_ = getPropertyVariant("mpv-version").toString();
     protocolList_ = getPropertyVariant("protocol-list").toStringList();
 }
 
@@ -1048,20 +1924,41 @@ int MpvController::observeProperties(const MpvController::PropertyList &properti
     foreach (const MpvProperty &item, properties)
         rval  = std::min(rval, mpv_observe_property(mpv, item.userData, item.name.toUtf8().data(), item.format));
     throttledProperties.unite(throttled);
+    for (const MpvProperty &item : properties) {
+        if (!isFastPropertyId(item.userData) || !throttled.contains(item.name))
+            continue;
+        int index = int(fastPropertyIndex(item.userData));
+        if (index < fastPropertyLimit)
+            throttledFast |= quint64(1) << index;
+    }
     return rval;
 }
 
 int MpvController::unobservePropertiesById(const QSet<uint64_t> &ids)
 {
     int rval = 0;
-    foreach (uint64_t id, ids)
+    foreach (uint64_t id, ids) {
         rval = std::min(rval, mpv_unobserve_property(mpv, id));
+        if (isFastPropertyId(id) && fastPropertyIndex(id) < uint64_t(fastPropertyLimit))
+            pendingFast &= ~(quint64(1) << fastPropertyIndex(id));
+    }
     return rval;
 }
 
 void MpvController::setThrottleTime(int msec)
 {
-    throttler->setInterval(msec);
+    throttleInterval = msec;
+    scheduleFlush();
+}
+
+void MpvController::setFastPropertyInterval(int index, int msec)
+{
+    // A negative interval goes back to the throttle time, and zero reports
+    // every change as it comes.
+    if (index < 0 || index >= fastPropertyLimit)
+        return;
+    fastIntervals[index] = msec;
+    scheduleFlush();
 }
 
 QString MpvController::clientName()
@@ -1069,6 +1966,11 @@ QString MpvController::clientName()
     return QString::fromUtf8(mpv_client_name(mpv));
 }
 
+QString MpvController::mpvVersion()
+{
+    return mpvVersion_;
+}
+
 QStringList MpvController::protocolList()
 {
     return protocolList_;
@@ -1165,8 +2067,9 @@ QString MpvController::getPropertyString(const QString &name)
 void MpvController::commandAsync(const QVariant &params, MpvCallback *callback)
 {
     mpv::qt::node_builder node(params);
-    mpv_command_node_async(mpv, reinterpret_cast<uint64_t>(callback),
-                           node.node());
+    int err = mpv_command_node_async(mpv, reinterpret_cast<uint64_t>(callback),
+                                     node.node());
+    replyOnError(callback, err);
 }
 
 void MpvController::setPropertyVariantAsync(const QString &name,
@@ -1174,27 +2077,107 @@ void MpvController::setPropertyVariantAsync(const QString &name,
                                             MpvCallback *callback)
 {
     mpv::qt::node_builder node(value);
-    mpv_set_property_async(mpv, reinterpret_cast<uint64_t>(callback),
-                           name.toUtf8().data(), MPV_FORMAT_NODE, node.node());
+    int err = mpv_set_property_async(mpv, reinterpret_cast<uint64_t>(callback),
+                                     name.toUtf8().data(), MPV_FORMAT_NODE,
+                                     node.node());
+    replyOnError(callback, err);
 }
 
 void MpvController::getPropertyVariantAsync(const QString &name,
                                             MpvCallback *callback)
 {
-    mpv_get_property_async(mpv, reinterpret_cast<uint64_t>(callback),
-                           name.toUtf8().data(), MPV_FORMAT_NODE);
+    int err = mpv_get_property_async(mpv, reinterpret_cast<uint64_t>(callback),
+                                     name.toUtf8().data(), MPV_FORMAT_NODE);
+    replyOnError(callback, err);
+}
+
+void MpvController::getPropertyStringAsync(const QString &name,
+                                           MpvCallback *callback)
+{
+    int err = mpv_get_property_async(mpv, reinterpret_cast<uint64_t>(callback),
+                                     name.toUtf8().data(), MPV_FORMAT_STRING);
+    replyOnError(callback, err);
+}
+
+void MpvController::replyOnError(MpvCallback *callback, int err)
+{
+    // mpv refused the request outright, so no reply event will ever carry
+    // this callback.  Answer it now so that it does not leak.
+    if (err >= 0)
+        return;
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, QVariant::fromValue<MpvErrorCode>(
+                                        MpvErrorCode(err))));
+}
+
+void MpvController::screenshotRaw(const QSize &size, MpvCallback *callback)
+{
+    // The frame is copied and scaled here, so that the thread asking for it
+    // only gets a finished image.  An empty image means it failed.
+    const char *args[] = { "screenshot-raw", "video", nullptr };
+    mpv_node result;
+    QImage image;
+    if (mpv_command_ret(mpv, args, &result) >= 0) {
+        if (result.format == MPV_FORMAT_NODE_MAP) {
+            int64_t w = 0, h = 0, stride = 0;
+            QByteArray format;
+            mpv_byte_array *data = nullptr;
+            mpv_node_list *list = result.u.list;
+            for (int i = 0; i < list->num; i++) {
+                QByteArray key(list->keys[i]);
+                mpv_node &value = list->values[i];
+                if (key == "w" && value.format == MPV_FORMAT_INT64)
+                    w = value.u.int64;
+                else if (key == "h" && value.format == MPV_FORMAT_INT64)
+                    h = value.u.int64;
+                else if (key == "stride" && value.format == MPV_FORMAT_INT64)
+                    stride = value.u.int64;
+                else if (key == "format" && value.format == MPV_FORMAT_STRING)
+                    format = value.u.string;
+                else if (key == "data" && value.format == MPV_FORMAT_BYTE_ARRAY)
+                    data = value.u.ba;
+            }
+            QImage::Format qFormat = format == "bgr0" ? QImage::Format_RGB32
+                                   : format == "bgra" ? QImage::Format_ARGB32
+                                                      : QImage::Format_Invalid;
+            if (data && qFormat != QImage::Format_Invalid && w > 0 && h > 0
+                    && size_t(stride * h) <= data->size) {
+                QImage frame(static_cast<const uchar*>(data->data), int(w), int(h),
+                             int(stride), qFormat);
+                image = size.isValid()
+                        ? frame.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+                        : frame.copy();
+            }
+        }
+        mpv_free_node_contents(&result);
+    }
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, QVariant::fromValue(image)));
+}
+
+MpvController::EventCounters MpvController::eventCounters() const
+{
+    EventCounters counters;
+    counters.events = countedEvents;
+    counters.batches = countedBatches;
+    counters.coalesced = countedCoalesced;
+    return counters;
 }
 
 void MpvController::parseMpvEvents()
 {
-    // Process all events, until the event queue is empty.
+    // Process all events, until the event queue is empty, then hand them
+    // over in one go.
     while (mpv) {
         mpv_event *event = mpv_wait_event(mpv, 0);
         if (event->event_id == MPV_EVENT_NONE) {
             break;
         }
+        ++countedEvents;
         handleMpvEvent(event);
     }
+    deliverBatch();
+    scheduleFlush();
 }
 
 void MpvController::setThrottledProperty(const QString &name, const QVariant &v, uint64_t userData)
@@ -1204,9 +2187,139 @@ void MpvController::setThrottledProperty(const QString &name, const QVariant &v,
 
 void MpvController::flushProperties()
 {
-    for (auto it = throttledValues.begin(); it != throttledValues.end(); it++)
-        emit mpvPropertyChanged(it.key(), it.value().first, it.value().second);
-    throttledValues.clear();
+    // Send whatever is due, and come back for the rest.
+    qint64 now = throttleClock.elapsed();
+    if (!throttledValues.isEmpty() && now >= slowFlushed + throttleInterval) {
+        for (auto it = throttledValues.begin(); it != throttledValues.end(); it++)
+            batchProperty(it.key(), it.value().first, it.value().second);
+        throttledValues.clear();
+        slowFlushed = now;
+    }
+    for (int i = 0; i < fastPropertyLimit && (pendingFast >> i); i++) {
+        quint64 bit = quint64(1) << i;
+        if (!(pendingFast & bit) || now < fastFlushed[i] + fastInterval(i))
+            continue;
+        pendingFast &= ~bit;
+        fastFlushed[i] = now;
+        batchFastProperty(fastValues[i]);
+    }
+    deliverBatch();
+    scheduleFlush();
+}
+
+int MpvController::fastInterval(int index)
+{
+    return fastIntervals[index] < 0 ? throttleInterval : fastIntervals[index];
+}
+
+void MpvController::scheduleFlush()
+{
+    qint64 due = -1;
+    if (!throttledValues.isEmpty())
+        due = slowFlushed + throttleInterval;
+    for (int i = 0; i < fastPropertyLimit && (pendingFast >> i); i++) {
+        if (!(pendingFast & (quint64(1) << i)))
+            continue;
+        qint64 d = fastFlushed[i] + fastInterval(i);
+        if (due < 0 || d < due)
+            due = d;
+    }
+    if (due < 0) {
+        throttler->stop();
+        return;
+    }
+    int wait = int(std::max(qint64(0), due - throttleClock.elapsed()));
+    if (!throttler->isActive() || throttler->remainingTime() > wait)
+        throttler->start(wait);
+}
+
+MpvEventBatch::Entry &MpvController::batchEntry(MpvEventBatch::Kind kind)
+{
+    // Grown in place, so that no entry is made only to be copied in.
+    batch.entries.resize(batch.entries.count() + 1);
+    MpvEventBatch::Entry &e = batch.entries.last();
+    e.kind = kind;
+    return e;
+}
+
+MpvEventBatch::Detail &MpvController::batchDetail(MpvEventBatch::Kind kind)
+{
+    MpvEventBatch::Entry &e = batchEntry(kind);
+    e.detail.reset(new MpvEventBatch::Detail);
+    return *e.detail;
+}
+
+void MpvController::batchProperty(const QString &name, const QVariant &v, uint64_t userData)
+{
+    auto key = qMakePair(name, userData);
+    auto it = batchedProperties.find(key);
+    if (it != batchedProperties.end()) {
+        MpvEventBatch::Entry &old = batch.entries[*it];
+        old.superseded = true;
+        old.value = QVariant();
+        ++countedCoalesced;
+        *it = batch.entries.count();
+    } else {
+        batchedProperties.insert(key, batch.entries.count());
+    }
+    MpvEventBatch::Entry &e = batchEntry(MpvEventBatch::PropertyChange);
+    e.name = name;
+    e.value = v;
+    e.userData = userData;
+}
+
+void MpvController::batchFastProperty(const MpvFastProperty &p)
+{
+    int &slot = batchedFast[p.index];
+    if (slot >= 0) {
+        batch.entries[slot].superseded = true;
+        ++countedCoalesced;
+    }
+    slot = batch.entries.count();
+    batchEntry(MpvEventBatch::FastPropertyChange).fast = p;
+}
+
+void MpvController::deliverBatch()
+{
+    if (batch.entries.isEmpty())
+        return;
+    ++countedBatches;
+    emit eventBatch(batch);
+    batch = MpvEventBatch();
+    batchedProperties.clear();
+    std::fill_n(batchedFast, fastPropertyLimit, -1);
+}
+
+void MpvController::handleFastProperty(mpv_event_property *prop, uint64_t userData)
+{
+    int index = int(fastPropertyIndex(userData));
+    if (index >= fastPropertyLimit)
+        return;
+    MpvFastProperty p;
+    p.index = index;
+    p.ok = prop->data != nullptr;
+    if (p.ok) {
+        switch (prop->format) {
+        case MPV_FORMAT_DOUBLE:
+            p.real = *reinterpret_cast<double*>(prop->data);
+            break;
+        case MPV_FORMAT_INT64:
+            p.integer = *reinterpret_cast<int64_t*>(prop->data);
+            break;
+        case MPV_FORMAT_FLAG:
+            p.integer = *reinterpret_cast<int*>(prop->data);
+            break;
+        default:
+            p.ok = false;
+        }
+    }
+    quint64 bit = quint64(1) << index;
+    if ((throttledFast & bit) && fastIntervals[index] != 0) {
+        fastValues[index] = p;
+        pendingFast |= bit;
+    } else {
+        batchFastProperty(p);
+    }
 }
 
 void MpvController::handleMpvEvent(mpv_event *event)
@@ -1254,9 +2367,11 @@ void MpvController::handleMpvEvent(mpv_event *event)
 
     switch (event->event_id) {
     case MPV_EVENT_GET_PROPERTY_REPLY: {
-        QVariant v = propertyToVariant(reinterpret_cast<mpv_event_property*>(event->data));
         if (!event->reply_userdata)
             return;
+        QVariant v = event->error < 0
+                ? QVariant::fromValue<MpvErrorCode>(MpvErrorCode(event->error))
+                : propertyToVariant(reinterpret_cast<mpv_event_property*>(event->data));
         QMetaObject::invokeMethod(reinterpret_cast<MpvCallback*>(event->reply_userdata),
                                   "reply", Qt::QueuedConnection,
                                   Q_ARG(QVariant, v));
@@ -1264,21 +2379,32 @@ void MpvController::handleMpvEvent(mpv_event *event)
     }
     case MPV_EVENT_COMMAND_REPLY:
     case MPV_EVENT_SET_PROPERTY_REPLY: {
-        QVariant v = QVariant::fromValue<MpvErrorCode>(MpvErrorCode(event->error));
+        // Failures are passed on as their error code, and successes as the
+        // command's result.  Setting a property has no result.
         if (!event->reply_userdata)
             return;
+        QVariant v;
+        if (event->error < 0)
+            v = QVariant::fromValue<MpvErrorCode>(MpvErrorCode(event->error));
+        else if (event->event_id == MPV_EVENT_COMMAND_REPLY && event->data)
+            v = mpv::qt::node_to_variant(&reinterpret_cast<mpv_event_command*>(event->data)->result);
         QMetaObject::invokeMethod(reinterpret_cast<MpvCallback*>(event->reply_userdata),
                                   "reply", Qt::QueuedConnection,
                                   Q_ARG(QVariant, v));
         break;
     }
     case MPV_EVENT_PROPERTY_CHANGE: {
+        if (isFastPropertyId(event->reply_userdata)) {
+            handleFastProperty(reinterpret_cast<mpv_event_property*>(event->data),
+                               event->reply_userdata);
+            break;
+        }
         QVariant v = propertyToVariant(reinterpret_cast<mpv_event_property*>(event->data));
         QString propname = QString::fromUtf8(reinterpret_cast<mpv_event_property*>(event->data)->name);
         if (throttledProperties.contains(propname))
             setThrottledProperty(propname, v, event->reply_userdata);
         else
-            emit mpvPropertyChanged(propname, v, event->reply_userdata);
+            batchProperty(propname, v, event->reply_userdata);
         break;
     }
     case MPV_EVENT_LOG_MESSAGE: {
@@ -1290,10 +2416,10 @@ void MpvController::handleMpvEvent(mpv_event *event)
     case MPV_EVENT_CLIENT_MESSAGE: {
         mpv_event_client_message *msg =
                 reinterpret_cast<mpv_event_client_message*>(event->data);
-        QStringList list;
+        MpvEventBatch::Detail &d = batchDetail(MpvEventBatch::ClientMessage);
         for (int i = 0; i < msg->num_args; i++)
-            list.append(msg->args[i]);
-        emit clientMessage(event->reply_userdata, list);
+            d.args.append(msg->args[i]);
+        batch.entries.last().userData = event->reply_userdata;
         break;
     }
     case MPV_EVENT_VIDEO_RECONFIG: {
@@ -1306,22 +2432,25 @@ void MpvController::handleMpvEvent(mpv_event *event)
                 && (w = vw.toInt()) > 0 && (h = vh.toInt()) > 0) {
             QSize videoSize(w, h);
             if (lastVideoSize != videoSize) {
-                emit videoSizeChanged(videoSize);
+                batchDetail(MpvEventBatch::VideoSizeChange).size = videoSize;
                 lastVideoSize = videoSize;
             }
         } else if (!lastVideoSize.isEmpty()) {
             lastVideoSize = QSize();
-            emit videoSizeChanged(QSize());
+            batchDetail(MpvEventBatch::VideoSizeChange).size = QSize();
         }
         break;
     }
     case MPV_EVENT_HOOK: {
         mpv_event_hook *msg = reinterpret_cast<mpv_event_hook*>(event->data);
-        emit hookEvent(msg->name, event->reply_userdata, msg->id);
+        batchDetail(MpvEventBatch::Hook).mpvId = msg->id;
+        MpvEventBatch::Entry &e = batch.entries.last();
+        e.name = msg->name;
+        e.userData = event->reply_userdata;
         break;
     }
     default:
-        emit unhandledMpvEvent(event->event_id);
+        batchEntry(MpvEventBatch::Unhandled).eventId = event->event_id;
     }
 }
 
@@ -1330,3 +2459,60 @@ void MpvController::mpvWakeup(void *ctx)
     QMetaObject::invokeMethod(static_cast<MpvController*>(ctx), "parseMpvEvents",
                               Qt::QueuedConnection);
 }
+
+
+
+MpvPropertyPolicy::MpvPropertyPolicy(const MpvController::PropertyList &properties,
+                                     QObject *parent) : QObject(parent)
+{
+    for (const MpvController::MpvProperty &p : properties)
+        if (MpvController::isFastPropertyId(p.userData))
+            tracked.append({ p, QHash<QString, int>(), Unwanted, true });
+}
+
+bool MpvPropertyPolicy::setDemand(const QString &consumer, const QString &property,
+                                  int msec)
+{
+    for (Tracked &t : tracked) {
+        if (t.property.name != property)
+            continue;
+        auto it = t.demands.find(consumer);
+        if (it != t.demands.end() && *it == msec)
+            return true;
+        t.demands.insert(consumer, msec);
+        apply(t);
+        return true;
+    }
+    return false;
+}
+
+bool MpvPropertyPolicy::isObserved(const QString &property) const
+{
+    for (const Tracked &t : tracked)
+        if (t.property.name == property)
+            return t.observed;
+    return false;
+}
+
+void MpvPropertyPolicy::apply(Tracked &t)
+{
+    int interval = Unwanted;
+    for (int msec : t.demands)
+        if (msec != Unwanted && (interval == Unwanted || msec < interval))
+            interval = msec;
+
+    uint64_t id = t.property.userData;
+    if (interval == Unwanted) {
+        if (t.observed)
+            emit unobservePropertiesById(QSet<uint64_t>() << id);
+        t.observed = false;
+        return;
+    }
+    // Set the interval first, so that the value sent on observing follows it.
+    if (t.interval != interval)
+        emit setFastPropertyInterval(int(MpvController::fastPropertyIndex(id)), interval);
+    t.interval = interval;
+    if (!t.observed)
+        emit observeProperties({ t.property }, QSet<QString>());
+    t.observed = true;
+}
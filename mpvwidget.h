@@ -4,24 +4,49 @@
 #include <QOpenGLWidget>
 #include <QOpenGLTexture>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QVariant>
+#include <QImage>
 #include <QSet>
 #include <QMap>
+#include <QHash>
+#include <QSharedPointer>
 #include <functional>
+#include <atomic>
 #include <mpv/client.h>
 //#include <mpv/opengl_cb.h>
 #include <mpv/qthelper.hpp>
 #include <mpv/render.h>
 #include <mpv/render_gl.h>
 #include "helpers.h"
+#include "frametimings.h"
 
 class QLayout;
 class QMainWindow;
+class QOffscreenSurface;
+class QOpenGLContext;
 class QThread;
 class QTimer;
+class QWindow;
 class MpvWidgetInterface;
 class MpvController;
 class LogoDrawer;
+class MpvEventBatch;
+class MpvPropertyPolicy;
+
+// The value of a scalar property observed with a fast id.  It is passed by
+// value, so handing it to another thread allocates no strings or variants.
+// Flags are kept in integer.
+class MpvFastProperty {
+public:
+    int index = 0;
+    bool ok = false;
+    double real = 0.0;
+    int64_t integer = 0;
+};
+Q_DECLARE_METATYPE(MpvFastProperty)
+
 
 class MpvObject : public QObject
 {
@@ -29,7 +54,19 @@ class MpvObject : public QObject
 
     typedef std::function<void(MpvObject*,bool,const QVariant&)> PropertyDispatchFunction;
     typedef QMap<QString, PropertyDispatchFunction> PropertyDispatchMap;
+
+    // Scalar properties that change often are observed with a fast id, and
+    // dispatched by its index rather than by name.
+    enum FastProperty {
+        FastTimePos, FastDuration, FastSeekable, FastPause, FastFps,
+        FastAvsync, FastDisplayDrops, FastDecoderDrops, FastAudioBitrate,
+        FastVideoBitrate, FastPropertyCount
+    };
+    typedef void (*FastDispatchFunction)(MpvObject*, const MpvFastProperty&);
 public:
+    // The stats page after mpv's own ones, drawn from our frame timings.
+    enum { RenderTimingsPage = 3 };
+
     explicit MpvObject(QObject *owner, const QString &clientName = "mpv");
     ~MpvObject();
 
@@ -48,6 +85,7 @@ public:
     void showStatsPage(int page);
     int cycleStatsPage();
     int selectedStatsPage();
+    FrameTimings *frameTimings();
 
     void urlOpen(QUrl url);
     void fileOpen(QString filename);
@@ -76,6 +114,8 @@ public:
     void setSubtitleTrack(int64_t id);
     void setVideoTrack(int64_t id);
     void setDrawLogo(bool yes);
+    void setRenderingParked(bool parked);
+    void refreshPlayTime();
     void setVolume(int64_t volume);
     bool eofReached();
     void setClientDebuggingMessages(bool yes);
@@ -84,6 +124,7 @@ public:
     double playLength();
     double playTime();
     QSize videoSize();
+    QVariantMap metaData();
     bool clientDebuggingMessages();
 
     void setCachedMpvOption(const QString &option, const QVariant &value);
@@ -91,6 +132,17 @@ public:
     QVariant blockingSetMpvPropertyVariant(QString name, QVariant value);
     QVariant blockingSetMpvOptionVariant(QString name, QVariant value);
     QVariant getMpvPropertyVariant(QString name);
+    QVariant mirroredMpvProperty(QString name);
+    void getMpvPropertyAsync(QString name, const std::function<void(QVariant)> &callback);
+    void getMpvPropertyStringAsync(QString name, const std::function<void(QVariant)> &callback);
+    void setMpvPropertyAsync(QString name, QVariant value, const std::function<void(QVariant)> &callback);
+    void setMpvOptionAsync(QString name, QVariant value, const std::function<void(QVariant)> &callback);
+    void mpvCommandAsync(QVariant params, const std::function<void(QVariant)> &callback);
+    void grabRawFrame(const QSize &size, const std::function<void(QImage)> &callback);
+    int blockingCallCount();
+    quint64 workerWakeups() const;
+    QVariantMap eventStats() const;
+    void setPropertyDemand(const QString &consumer, const QString &property, int msec);
 
 signals:
     void ctrlContinueHook(uint64_t mpvId);
@@ -139,9 +191,14 @@ private:
     void setMpvOptionVariant(QString name, QVariant value);
     void showCursor();
     void hideCursor();
+    void countBlockingCall(const QString &what);
+    int fastIndexOf(const QString &name) const;
+    QVariant fastValue(int index) const;
 
 private slots:
+    void ctrl_eventBatch(const MpvEventBatch &batch);
     void ctrl_mpvPropertyChanged(QString name, QVariant v);
+    void ctrl_mpvFastPropertyChanged(const MpvFastProperty &p);
     void ctrl_hookEvent(QString name, uint64_t selfId, uint64_t mpvId);
     void ctrl_unhandledMpvEvent(int eventLevel);
     void ctrl_videoSizeChanged(QSize size);
@@ -150,27 +207,38 @@ private slots:
     void self_metadata(QVariantMap metadata);
     void self_audioDeviceList(const QVariantList &list);
     void hideTimer_timeout();
+    void timingsTimer_timeout();
 
     void self_mouseMoved();
 
 private:
     static PropertyDispatchMap propertyDispatch;
+    static const FastDispatchFunction fastDispatch[FastPropertyCount];
 
     Helpers::MpvWidgetType widgetType = Helpers::NullWidget;
     QLayout *hostLayout = nullptr;
     QMainWindow *hostWindow = nullptr;
     MpvController *ctrl = nullptr;
+    MpvPropertyPolicy *policy = nullptr;
     MpvWidgetInterface *widget = nullptr;
 
     QThread *worker = nullptr;
     QTimer *hideTimer = nullptr;
+    QTimer *timingsTimer = nullptr;
 
     QVariantMap cachedState;
+    QHash<QString, QVariant> propertyMirror;
+    MpvFastProperty fastValues[FastPropertyCount];
+    bool fastReported[FastPropertyCount] {};
+    int blockingCalls = 0;
+    std::atomic<quint64> workerWakeups_ { 0 };
     QSize videoSize_;
+    QVariantMap metaData_;
     double playTime_ = 0.0;
     double playLength_ = 0.0;
 
     int shownStatsPage = 0;
+    bool renderingParked = false;
     bool loopImages = true;
     bool debugMessages = false;
 };
@@ -187,6 +255,10 @@ public:
     virtual void setLogoUrl(const QString &filename);
     virtual void setLogoBackground(const QColor &color);
     virtual void setDrawLogo(bool yes);
+    virtual void setRenderingParked(bool parked);
+    virtual FrameTimings *frameTimings();
+    // Whether frames drawn for the widget would be seen, or can be skipped.
+    static bool windowShowsFrames(QWidget *widget);
 
 protected:
     MpvObject *mpvObject = nullptr;
@@ -209,6 +281,11 @@ public:
     void setLogoUrl(const QString &filename);
     void setLogoBackground(const QColor &color);
     void setDrawLogo(bool yes);
+    void setRenderingParked(bool parked);
+    FrameTimings *frameTimings();
+    // Frames drawn, and frames handed back to mpv undrawn while hidden.
+    quint64 renderedFrames() const;
+    quint64 skippedFrames() const;
     static void *get_proc_address(void *ctx, const char *name);
 
 signals:
@@ -224,6 +301,8 @@ protected:
 
 private:
     static void render_update(void *ctx);
+    bool framesVisible();
+    void skipFrame();
 
 private slots:
     void maybeUpdate();
@@ -235,15 +314,148 @@ private:
     mpv_render_context *render = nullptr;
     LogoDrawer *logo = nullptr;
     bool drawLogo = true;
+    bool renderingParked = false;
+    bool updatePending = false;
     int glWidth = 0, glHeight = 0;
+    quint64 framesRendered = 0;
+    quint64 framesSkipped = 0;
+    FrameTimings timings;
+};
+
+
+// MpvGlThreadRenderer renders mpv's frames on a thread of its own, straight
+// into a native window that it also presents, so that a busy gui thread
+// delays neither drawing nor display.  Frames that are skipped are handed
+// to mpv with the context current on an offscreen surface instead.
+class MpvGlThreadRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    MpvGlThreadRenderer(MpvController *ctrl, QOpenGLContext *context,
+                        QWindow *window, QOffscreenSurface *surface,
+                        const mpv_render_param &displayParam);
+    ~MpvGlThreadRenderer();
+
+    void setTargetSize(const QSize &size);
+    void setRefreshRate(double rate);
+    void setSkipping(bool skipping);
+    FrameTimings *frameTimings();
+
+signals:
+    void frameDone(bool rendered);
+
+public slots:
+    void initialize();
+    void render(bool force);
+    void shutdown();
+
+private:
+    static void render_update(void *ctx);
+
+    MpvController *ctrl = nullptr;
+    QOpenGLContext *context = nullptr;
+    QWindow *window = nullptr;
+    QOffscreenSurface *surface = nullptr;
+    mpv_render_param displayParam;
+    mpv_render_context *mpvRender = nullptr;
+    std::atomic<bool> renderQueued { false };
+    std::atomic<bool> skipping { false };
+    FrameTimings timings;
+
+    QMutex lock;                // guards targetSize and refreshRate
+    QSize targetSize = QSize(1, 1);
+    double refreshRate = 0.0;
+};
+
+
+// MpvGlThreadWidget holds the window an MpvGlThreadRenderer presents to.
+// Like MpvEmbedWidget, it paints the logo itself while nothing plays, and
+// the video window lets input through to it.
+class MpvGlThreadWidget : public QWidget, public MpvWidgetInterface
+{
+    Q_OBJECT
+    Q_INTERFACES(MpvWidgetInterface)
+
+public:
+    explicit MpvGlThreadWidget(MpvObject *object, QWidget *parent = nullptr);
+    ~MpvGlThreadWidget();
+
+    QWidget *self();
+    void initMpv();
+    void setLogoUrl(const QString &filename);
+    void setLogoBackground(const QColor &color);
+    void setDrawLogo(bool yes);
+    void setRenderingParked(bool parked);
+    FrameTimings *frameTimings();
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
+    void childEvent(QChildEvent *event);
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+
+private:
+    void requestRender();
+    void updateSkipping();
+    void updateTarget();
+
+private slots:
+    void renderer_frameDone(bool rendered);
+    void self_playbackStarted();
+    void self_playbackFinished();
+
+private:
+    QThread *renderThread = nullptr;
+    MpvGlThreadRenderer *renderer = nullptr;
+    QOffscreenSurface *surface = nullptr;
+    QWindow *videoWindow = nullptr;
+    QWidget *videoContainer = nullptr;
+    LogoDrawer *logo = nullptr;
+    bool drawLogo = true;
+    bool renderingParked = false;
+    bool skippingFrames = false;
+    quint64 framesRendered = 0;
+    quint64 framesSkipped = 0;
 };
 
 
 // FIXME: implement MpvVulkanCbWidget
 typedef MpvGlWidget MpvVulkanCbWidget;
 
-// FIXME: implement MpvEmbedWidget
-typedef MpvGlWidget MpvEmbedWidget;
+// MpvEmbedWidget hands its native window to mpv, which then presents video
+// into it with its own output, without going through Qt.  The logo is
+// painted here while nothing plays.
+class MpvEmbedWidget : public QWidget, public MpvWidgetInterface
+{
+    Q_OBJECT
+    Q_INTERFACES(MpvWidgetInterface)
+
+public:
+    explicit MpvEmbedWidget(MpvObject *object, QWidget *parent = nullptr);
+    ~MpvEmbedWidget();
+
+    QWidget *self();
+    void initMpv();
+    void setLogoUrl(const QString &filename);
+    void setLogoBackground(const QColor &color);
+    void setDrawLogo(bool yes);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+
+private slots:
+    void self_playbackStarted();
+    void self_playbackFinished();
+
+private:
+    LogoDrawer *logo = nullptr;
+    bool drawLogo = true;
+};
 
 
 
@@ -264,6 +476,37 @@ Q_DECLARE_METATYPE(MpvErrorCode)
 
 
 
+// The events drained from mpv in one go, in the order they happened.  When
+// a property changes again within a batch, its earlier entry is marked as
+// superseded and emptied, so that only the last value is acted on.  Entries
+// only hold what property changes need, and the rare events keep the rest
+// in their detail.
+class MpvEventBatch {
+public:
+    enum Kind { PropertyChange, FastPropertyChange, VideoSizeChange,
+                Hook, ClientMessage, Unhandled };
+    struct Detail {
+        uint64_t mpvId = 0;
+        QSize size;
+        QStringList args;
+    };
+    struct Entry {
+        Kind kind = Unhandled;
+        bool superseded = false;
+        int eventId = 0;
+        uint64_t userData = 0;
+        QString name;
+        QVariant value;
+        MpvFastProperty fast;
+        QSharedPointer<Detail> detail;
+    };
+    QVector<Entry> entries;
+};
+Q_DECLARE_TYPEINFO(MpvEventBatch::Entry, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(MpvEventBatch)
+
+
+
 // This wraps a lambda so that it is invoked in the calling thread. i.e. use
 // QMetaObject::invokeMethod on the controller's async functions to pass
 // through this object, like this:
@@ -302,19 +545,32 @@ public:
     };
     typedef QVector<MpvOption> OptionList;
 
+    // Properties observed with an id made by fastPropertyId are reported
+    // through mpvFastPropertyChanged instead of mpvPropertyChanged.  They
+    // must have a double, int64 or flag format.
+    static const int fastPropertyLimit = 64;
+    static uint64_t fastPropertyId(int index) { return fastPropertyBase | uint64_t(index); }
+    static bool isFastPropertyId(uint64_t id) { return id & fastPropertyBase; }
+    static uint64_t fastPropertyIndex(uint64_t id) { return id & ~fastPropertyBase; }
+
+    // How many mpv events were handled, how many batches they were handed
+    // over in, and how many property changes were dropped for a later one.
+    struct EventCounters {
+        quint64 events = 0;
+        quint64 batches = 0;
+        quint64 coalesced = 0;
+    };
+    EventCounters eventCounters() const;
+
     MpvController(QObject *parent = nullptr);
     ~MpvController();
 
 signals:
     void durationChanged(int value);
     void positionChanged(int value);
-    void mpvPropertyChanged(QString name, QVariant v, uint64_t userData);
+    void eventBatch(const MpvEventBatch &batch);
     void logMessageByParts(QString prefix, QString level, QString msg);
     //void logMessage(QString message);
-    void clientMessage(uint64_t id, QStringList args);
-    void videoSizeChanged(QSize size);
-    void hookEvent(QString hookName, uint64_t selfId, uint64_t mpvId);
-    void unhandledMpvEvent(int eventNumber);
 
 public slots:
     void create(const MpvController::OptionList &earlyOptions);
@@ -329,8 +585,10 @@ public slots:
                           const QSet<QString> &throttled = QSet<QString>());
     int unobservePropertiesById(const QSet<uint64_t> &ids);
     void setThrottleTime(int msec);
+    void setFastPropertyInterval(int index, int msec);
 
     QString clientName();
+    QString mpvVersion();
     QStringList protocolList();
     int64_t timeMicroseconds();
     unsigned long apiVersion();
@@ -348,25 +606,90 @@ public slots:
     void commandAsync(const QVariant &params, MpvCallback *callback);
     void setPropertyVariantAsync(const QString &name, const QVariant &value, MpvCallback *callback);
     void getPropertyVariantAsync(const QString &name, MpvCallback *callback);
+    void getPropertyStringAsync(const QString &name, MpvCallback *callback);
+    void screenshotRaw(const QSize &size, MpvCallback *callback);
 
     void parseMpvEvents();
 
 private:
+    void replyOnError(MpvCallback *callback, int err);
     void setThrottledProperty(const QString &name, const QVariant &v, uint64_t userData);
     void flushProperties();
+    int fastInterval(int index);
+    void scheduleFlush();
+    void handleFastProperty(mpv_event_property *prop, uint64_t userData);
+    MpvEventBatch::Entry &batchEntry(MpvEventBatch::Kind kind);
+    MpvEventBatch::Detail &batchDetail(MpvEventBatch::Kind kind);
+    void batchProperty(const QString &name, const QVariant &v, uint64_t userData);
+    void batchFastProperty(const MpvFastProperty &p);
+    void deliverBatch();
     void handleMpvEvent(mpv_event *event);
     static void mpvWakeup(void *ctx);
 
+    static const uint64_t fastPropertyBase = uint64_t(1) << 63;
+
     mpv::qt::Handle mpv;
+    QString mpvVersion_;
     QStringList protocolList_;
     QSize lastVideoSize = QSize(0,0);
 
     QTimer *throttler = nullptr;
+    QElapsedTimer throttleClock;
+    int throttleInterval = 1000/12;
+    qint64 slowFlushed = 0;
+    int fastIntervals[fastPropertyLimit];
+    qint64 fastFlushed[fastPropertyLimit];
     QSet<QString> throttledProperties;
     typedef QMap<QString,QPair<QVariant,uint64_t>> ThrottledValueMap;
     ThrottledValueMap throttledValues;
+    quint64 throttledFast = 0;
+    quint64 pendingFast = 0;
+    MpvFastProperty fastValues[fastPropertyLimit];
+
+    MpvEventBatch batch;
+    QHash<QPair<QString,uint64_t>, int> batchedProperties;
+    int batchedFast[fastPropertyLimit];
+    std::atomic<quint64> countedEvents { 0 };
+    std::atomic<quint64> countedBatches { 0 };
+    std::atomic<quint64> countedCoalesced { 0 };
 
     int shownStatsPage = 0;
 };
 
+
+// MpvPropertyPolicy decides how often each fast property is reported, from
+// what its consumers ask for.  A consumer names the interval it wants, or
+// that it doesn't want the property at all.  The shortest interval asked for
+// wins, and a property every consumer has declined is unobserved until one
+// asks for it again.  Properties nobody has asked about keep the
+// controller's throttle time.
+class MpvPropertyPolicy : public QObject
+{
+    Q_OBJECT
+public:
+    enum { Unwanted = -1 };
+
+    MpvPropertyPolicy(const MpvController::PropertyList &properties,
+                      QObject *parent = nullptr);
+    bool setDemand(const QString &consumer, const QString &property, int msec);
+    bool isObserved(const QString &property) const;
+
+signals:
+    void observeProperties(const MpvController::PropertyList &properties,
+                           const QSet<QString> &throttled);
+    void unobservePropertiesById(const QSet<uint64_t> &ids);
+    void setFastPropertyInterval(int index, int msec);
+
+private:
+    struct Tracked {
+        MpvController::MpvProperty property;
+        QHash<QString, int> demands;
+        int interval;
+        bool observed;
+    };
+    void apply(Tracked &t);
+
+    QVector<Tracked> tracked;
+};
+
 #endif // MPVWIDGET_H
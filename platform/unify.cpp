@@ -2,17 +2,22 @@
 #include <QProcess>
 #include <QApplication>
 #include <QDir>
+#include <QFile>
 #include "unify.h"
 
 // Platform includes
 #if defined(Q_OS_WIN)
+#include <io.h>
 #include "devicemanager_win.h"
 #include "screensaver_win.h"
 #elif defined(Q_OS_MAC)
+#include <unistd.h>
 #include "devicemanager_mac.h"
 #include "screensaver_mac.h"
 #else
 #include <dlfcn.h>
+#include <unistd.h>
+#include <malloc.h>
 #include "devicemanager_unix.h"
 #include "screensaver_unix.h"
 #endif
@@ -161,3 +166,28 @@ void Platform::disableAutomaticAccel(QWidget *what)
     Q_UNUSED(what);
 #endif
 }
+
+qint64 Platform::heapInUse()
+{
+    // Bytes handed out by malloc, or -1 where we can't ask.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    return qint64(mi.uordblks + mi.hblkhd);
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+    return qint64(uint(mi.uordblks)) + qint64(uint(mi.hblkhd));
+#else
+    return -1;
+#endif
+}
+
+void Platform::syncFile(QFile &file)
+{
+    // Push what was written out of the OS cache and onto the disk.
+    file.flush();
+#if defined(Q_OS_WIN)
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
@@ -5,6 +5,7 @@
 #include <QString>
 
 class DeviceManager;
+class QFile;
 class ScreenSaver;
 
 namespace Platform {
@@ -21,6 +22,8 @@ namespace Platform {
     bool tiledDesktopsExist();
     bool tilingDesktopActive();
     void disableAutomaticAccel(QWidget *what);
+    qint64 heapInUse();
+    void syncFile(QFile &file);
 }
 
 #endif // PLATFORM_ALL_H
@@ -1,7 +1,12 @@
 ﻿#include <QFileInfo>
+#include <QDataStream>
 #include <QMutableListIterator>
+#include <QMutex>
+#include <QAtomicInt>
 #include <cmath>
+#include <algorithm>
 #include "playlist.h"
+#include "storage.h"
 
 
 
@@ -15,14 +20,55 @@ static char keyTitle[] = "title";
 static char keyUrl[] = "url";
 static char keyUuid[] = "uuid";
 
+// Version of the QDataStream encoding used by playlist records.  Bump
+// PlaylistCollection::recordVersion whenever the record layout changes.
+static const int recordStreamVersion = QDataStream::Qt_5_6;
+
+// Tombstoned search index entries are swept away once there are at least
+// this many of them and they outnumber the live ones.
+static const int searchCompactThreshold = 1024;
+
+
+
+static QReadWriteLock metadataKeysLock;
+static QHash<QString, quint16> metadataKeyIds;
+static QStringList metadataKeyNames;
+
+quint16 MetadataKeys::intern(const QString &key)
+{
+    {
+        QReadLocker locker(&metadataKeysLock);
+        auto it = metadataKeyIds.constFind(key);
+        if (it != metadataKeyIds.constEnd())
+            return *it;
+    }
+    QWriteLocker locker(&metadataKeysLock);
+    auto it = metadataKeyIds.constFind(key);
+    if (it != metadataKeyIds.constEnd())
+        return *it;
+    if (metadataKeyNames.count() >= MetadataKeys::Full)
+        return MetadataKeys::Full;
+    quint16 id = quint16(metadataKeyNames.count());
+    metadataKeyNames.append(key);
+    metadataKeyIds.insert(key, id);
+    return id;
+}
+
+QString MetadataKeys::name(quint16 id)
+{
+    QReadLocker locker(&metadataKeysLock);
+    return metadataKeyNames.value(id);
+}
+
 
 
 Item::Item(QUrl url)
 {
-    static int globalCounter = 0;
+    // Items are made on the playlist loader as well as the gui thread.
+    static QAtomicInt globalCounter;
     setUrl(url);
     setUuid(QUuid::createUuid());
-    setOriginalPosition(globalCounter++);   // Preserve order on first restore
+    setOriginalPosition(globalCounter.fetchAndAddRelaxed(1));   // Preserve order on first restore
     setQueuePosition(0);
     setExtraPlayTimes(0);
     setHidden(false);
@@ -50,22 +96,56 @@ void Item::setPlaylistUuid(const QUuid &uuid)
 
 QUrl Item::url() const
 {
-    return url_;
+    if (urlName_.isEmpty())
+        return url_;
+    return QUrl::fromLocalFile(urlDirectory_ + urlName_);
 }
 
 void Item::setUrl(const QUrl &url)
 {
+    ++revision_;
+    urlDirectory_.clear();
+    urlName_.clear();
+    url_ = QUrl();
+
+    // Only split urls that survive the round trip through a plain path.
+    if (url.isLocalFile()) {
+        QString path = url.toLocalFile();
+        int slash = path.lastIndexOf('/');
+        if (slash >= 0 && slash + 1 < path.length()
+                && QUrl::fromLocalFile(path) == url) {
+            urlDirectory_ = internDirectory(path.left(slash + 1));
+            urlName_ = path.mid(slash + 1);
+            return;
+        }
+    }
     url_ = url;
 }
 
-const QVariantMap &Item::metadata() const
+QVariantMap Item::metadata() const
 {
-    return metadata_;
+    QVariantMap qvm;
+    for (const MetadataEntry &e : metadata_)
+        qvm.insert(MetadataKeys::name(e.key), e.value);
+    return qvm;
 }
 
-void Item::setMetadata(const QVariantMap &qvm)
+void Item::setMetadata(const QVariantMap &qvm, PlaylistCollection *owner)
 {
-    metadata_ = qvm;
+    storeMetadata(qvm);
+    ++revision_;
+    if (!owner)
+        return;
+
+    // Metadata arrives long after the item was added, so tell the search
+    // indexes that can see us to retokenize.
+    auto pl = owner->playlistOf(playlistUuid_);
+    if (pl) {
+        pl->reindexItem(this);
+        pl->journalItem(this);
+    }
+    if (queuePosition_ > 0)
+        PlaylistCollection::queuePlaylist()->reindexItem(this);
 }
 
 int Item::originalPosition()
@@ -131,13 +211,17 @@ bool Item::hidden()
 
 QString Item::toDisplayString() const
 {
-    if (url().isLocalFile())
-        return QFileInfo(url().toLocalFile()).completeBaseName();
-    return url().toDisplayString(QUrl::FullyDecoded);
+    if (!urlName_.isEmpty())
+        return QFileInfo(urlName_).completeBaseName();
+    if (url_.isLocalFile())
+        return QFileInfo(url_.toLocalFile()).completeBaseName();
+    return url_.toDisplayString(QUrl::FullyDecoded);
 }
 
 QString Item::toString() const
 {
+    if (!urlName_.isEmpty())
+        return urlDirectory_ + urlName_;
     return url_.isLocalFile() ? url_.toLocalFile() : url_.url();
 }
 
@@ -158,11 +242,263 @@ QVariantMap Item::toVMap() const
 
 void Item::fromVMap(const QVariantMap &qvm)
 {
-    url_ = qvm.contains(keyUrl) ? qvm.value(keyUrl).toUrl() : QUrl();
+    setUrl(qvm.contains(keyUrl) ? qvm.value(keyUrl).toUrl() : QUrl());
     uuid_ = qvm.contains(keyUuid) ? qvm.value(keyUuid).toUuid() : QUuid::createUuid();
-    metadata_ = qvm.contains(keyMetadata) ? qvm.value(keyMetadata).toMap() : QVariantMap();
+    storeMetadata(qvm.contains(keyMetadata) ? qvm.value(keyMetadata).toMap() : QVariantMap());
 }
 
+void Item::toBinary(QDataStream &out) const
+{
+    out << uuid_;
+    if (!urlName_.isEmpty())
+        out << quint8(1) << urlDirectory_ << urlName_;
+    else
+        out << quint8(0) << url_;
+    out << quint16(metadata_.count());
+    for (const MetadataEntry &e : metadata_)
+        out << MetadataKeys::name(e.key) << e.value;
+}
+
+void Item::fromBinary(QDataStream &in)
+{
+    quint8 split;
+    in >> uuid_ >> split;
+    urlDirectory_.clear();
+    urlName_.clear();
+    url_ = QUrl();
+    if (split) {
+        QString directory;
+        in >> directory >> urlName_;
+        urlDirectory_ = internDirectory(directory);
+    } else {
+        in >> url_;
+    }
+
+    quint16 count;
+    in >> count;
+    metadata_.clear();
+    metadata_.reserve(count);
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString key;
+        QVariant value;
+        in >> key >> value;
+        quint16 id = MetadataKeys::intern(key);
+        if (id != MetadataKeys::Full)
+            metadata_.append({ id, value });
+    }
+    ++revision_;
+}
+
+int Item::revision() const
+{
+    return revision_;
+}
+
+bool Item::cachedLabel(int format, QString &label) const
+{
+    if (labelFormat_ != format || labelRevision_ != revision_)
+        return false;
+    label = label_;
+    return true;
+}
+
+void Item::setCachedLabel(int format, const QString &label)
+{
+    label_ = label;
+    labelFormat_ = format;
+    labelRevision_ = revision_;
+}
+
+QString Item::internDirectory(const QString &directory)
+{
+    // Hand out the stored copy, so that every item in a directory shares
+    // the same string data.  Directories are never forgotten.
+    static QMutex lock;
+    static QSet<QString> directories;
+    QMutexLocker locker(&lock);
+    auto it = directories.constFind(directory);
+    if (it == directories.constEnd())
+        it = directories.insert(directory);
+    return *it;
+}
+
+void Item::storeMetadata(const QVariantMap &qvm)
+{
+    metadata_.clear();
+    metadata_.reserve(qvm.count());
+    for (auto it = qvm.constBegin(); it != qvm.constEnd(); ++it) {
+        quint16 id = MetadataKeys::intern(it.key());
+        if (id != MetadataKeys::Full)
+            metadata_.append({ id, it.value() });
+    }
+    metadata_.squeeze();
+}
+
+PlaylistJournal::Sink PlaylistJournal::sink;
+int PlaylistJournal::batchDepth = 0;
+QList<QByteArray> PlaylistJournal::batched;
+
+PlaylistJournal::Batch::Batch()
+{
+    ++batchDepth;
+}
+
+PlaylistJournal::Batch::~Batch()
+{
+    if (--batchDepth > 0 || batched.isEmpty())
+        return;
+    QList<QByteArray> records;
+    records.swap(batched);
+    if (records.count() == 1) {
+        emitRecord(records.first());
+        return;
+    }
+    write(Group, QUuid(), [&](QDataStream &out) {
+        out << records;
+    });
+}
+
+void PlaylistJournal::setJournal(const QSharedPointer<Journal> &journal)
+{
+    if (journal)
+        setSink([journal](const QByteArray &record) { journal->append(record); });
+    else
+        setSink(Sink());
+}
+
+void PlaylistJournal::setSink(const PlaylistJournal::Sink &sink)
+{
+    PlaylistJournal::sink = sink;
+    batched.clear();
+}
+
+bool PlaylistJournal::active()
+{
+    return bool(sink);
+}
+
+void PlaylistJournal::write(Op op, const QUuid &playlist,
+                            const std::function<void(QDataStream &)> &payload)
+{
+    if (!sink)
+        return;
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out.setVersion(recordStreamVersion);
+    out << quint8(op) << playlist;
+    if (payload)
+        payload(out);
+    emitRecord(record);
+}
+
+void PlaylistJournal::emitRecord(const QByteArray &record)
+{
+    if (batchDepth > 0)
+        batched.append(record);
+    else
+        sink(record);
+}
+
+void PlaylistJournal::playlistAdded(const QSharedPointer<Playlist> &playlist)
+{
+    if (!sink)
+        return;
+    QByteArray data = playlist->toBinary();
+    write(AddPlaylist, playlist->uuid(), [&](QDataStream &out) {
+        out << data;
+    });
+}
+
+void PlaylistJournal::playlistRemoved(const QUuid &uuid)
+{
+    write(RemovePlaylist, uuid);
+}
+
+void PlaylistJournal::playlistBackedUp(const QSharedPointer<Playlist> &playlist)
+{
+    if (!sink)
+        return;
+    QByteArray data = playlist->toBinary();
+    write(BackupPlaylist, playlist->uuid(), [&](QDataStream &out) {
+        out << data;
+    });
+}
+
+void PlaylistJournal::tabsMoved(const QList<QUuid> &order)
+{
+    write(MoveTabs, QUuid(), [&](QDataStream &out) {
+        out << order;
+    });
+}
+
+void PlaylistJournal::replay(const QByteArray &record,
+                             QList<QSharedPointer<Playlist>> &tabs,
+                             QList<QSharedPointer<Playlist>> &backup)
+{
+    QDataStream in(record);
+    in.setVersion(recordStreamVersion);
+    quint8 op;
+    QUuid uuid;
+    in >> op >> uuid;
+    auto indexIn = [&uuid](const QList<QSharedPointer<Playlist>> &list) {
+        for (int i = 0; i < list.count(); ++i)
+            if (list.at(i)->uuid() == uuid)
+                return i;
+        return -1;
+    };
+
+    switch (op) {
+    case AddPlaylist:
+    case BackupPlaylist: {
+        auto &list = op == AddPlaylist ? tabs : backup;
+        QByteArray data;
+        in >> data;
+        if (indexIn(list) >= 0)
+            break;
+        QSharedPointer<Playlist> p(new Playlist);
+        p->fromBinary(data);
+        list.append(p);
+        break;
+    }
+    case RemovePlaylist: {
+        int index = indexIn(tabs);
+        if (index >= 0)
+            tabs.removeAt(index);
+        break;
+    }
+    case MoveTabs: {
+        QList<QUuid> order;
+        in >> order;
+        QList<QSharedPointer<Playlist>> sorted;
+        for (const QUuid &u : order) {
+            for (int i = 0; i < tabs.count(); ++i) {
+                if (tabs.at(i)->uuid() == u) {
+                    sorted.append(tabs.takeAt(i));
+                    break;
+                }
+            }
+        }
+        tabs = sorted + tabs;
+        break;
+    }
+    case Group: {
+        QList<QByteArray> records;
+        in >> records;
+        for (const QByteArray &r : records)
+            replay(r, tabs, backup);
+        break;
+    }
+    default: {
+        int index = indexIn(tabs);
+        if (index >= 0)
+            tabs.at(index)->replay(Op(op), in);
+        break;
+    }
+    }
+}
+
+
+
 QSharedPointer<ItemCollection> ItemCollection::collection;
 
 ItemCollection::ItemCollection() : QObject(nullptr)
@@ -185,6 +521,7 @@ QSharedPointer<ItemCollection> ItemCollection::getSingleton()
 QSharedPointer<Item> ItemCollection::addItem(const QUrl url)
 {
     auto item = QSharedPointer<Item>::create(url);
+    QMutexLocker locker(&lock);
     items.insert(item->uuid(), item);
     return item;
 }
@@ -193,27 +530,336 @@ QSharedPointer<Item> ItemCollection::addItem(const QUuid &itemUuid, const QUrl &
 {
     QSharedPointer<Item> item(new Item(url));
     item->setUuid(itemUuid);
+    QMutexLocker locker(&lock);
     items.insert(item->uuid(), item);
     return item;
 }
 
 QSharedPointer<Item> ItemCollection::itemOf(const QUuid &itemUuid)
 {
+    QMutexLocker locker(&lock);
     return items.value(itemUuid, QSharedPointer<Item>());
 }
 
 void ItemCollection::removeItem(const QUuid &itemUuid)
 {
+    QMutexLocker locker(&lock);
     items.remove(itemUuid);
 }
 
 void ItemCollection::storeItem(const QSharedPointer<Item> &item)
 {
+    QMutexLocker locker(&lock);
     items.insert(item->uuid(), item);
 }
 
 
 
+static inline quint64 trigramAt(const QChar *c)
+{
+    return quint64(c[0].unicode()) << 32 | quint64(c[1].unicode()) << 16
+            | quint64(c[2].unicode());
+}
+
+void PlaylistSearchIndex::insert(const QSharedPointer<Item> &item)
+{
+    QMutexLocker locker(&mutex);
+    auto it = slotsByUuid.constFind(item->uuid());
+    if (it != slotsByUuid.constEnd()) {
+        quint32 slot = *it;
+        Entry &e = entries[slot];
+        if (e.item == item && e.revision == item->revision()) {
+            // Taken and put back (sorting, moving rows): the text and
+            // postings are still good.
+            if (!e.live) {
+                e.live = true;
+                --deadEntries;
+            }
+            applyFilterTo(slot);
+            return;
+        }
+    }
+    reindex(item);
+}
+
+void PlaylistSearchIndex::remove(const QUuid &uuid)
+{
+    QMutexLocker locker(&mutex);
+    auto it = slotsByUuid.constFind(uuid);
+    if (it != slotsByUuid.constEnd())
+        kill(*it);
+    maybeCompact();
+}
+
+void PlaylistSearchIndex::update(const Item *item)
+{
+    QMutexLocker locker(&mutex);
+    auto it = slotsByUuid.constFind(item->uuid());
+    if (it == slotsByUuid.constEnd())
+        return;
+    const Entry &e = entries[*it];
+    if (!e.live || e.item.data() != item || e.revision == item->revision())
+        return;
+    QSharedPointer<Item> shared = e.item;
+    reindex(shared);
+}
+
+void PlaylistSearchIndex::clear()
+{
+    // The filter survives, so whatever is added next is filtered too.
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    slotsByUuid.clear();
+    postings.clear();
+    matches.clear();
+    toggled.clear();
+    deadEntries = 0;
+}
+
+void PlaylistSearchIndex::filter(const QStringList &needles)
+{
+    QMutexLocker locker(&mutex);
+    maybeCompact();
+
+    bool narrowing = filtering && refines(needles);
+    QVector<quint32> candidates = narrowing ? matches : candidatesFor(needles);
+    QVector<quint32> found;
+    for (quint32 slot : candidates) {
+        const Entry &e = entries[slot];
+        if (e.live && textMatches(e.text, needles))
+            found.append(slot);
+    }
+
+    // Both lists are sorted, so walk them side by side and only touch the
+    // items whose visibility changes.
+    auto setHidden = [this](Entry &e, bool hidden) {
+        e.item->setHidden(hidden);
+        toggled.append(e.item);
+    };
+    if (filtering) {
+        auto f = found.constBegin();
+        for (quint32 slot : matches) {
+            while (f != found.constEnd() && *f < slot)
+                setHidden(entries[*f++], false);
+            if (f != found.constEnd() && *f == slot)
+                ++f;
+            else if (entries[slot].live)
+                setHidden(entries[slot], true);
+        }
+        while (f != found.constEnd())
+            setHidden(entries[*f++], false);
+    } else {
+        // Everything was shown, so only the misses change.
+        auto f = found.constBegin();
+        for (int slot = 0; slot < entries.size(); ++slot) {
+            bool match = f != found.constEnd() && *f == quint32(slot);
+            if (match)
+                ++f;
+            else if (entries[slot].live)
+                setHidden(entries[slot], true);
+        }
+    }
+
+    filtering = true;
+    currentNeedles = needles;
+    matches = found;
+}
+
+void PlaylistSearchIndex::clearFilter()
+{
+    QMutexLocker locker(&mutex);
+    for (Entry &e : entries) {
+        if (e.live && e.item->hidden()) {
+            e.item->setHidden(false);
+            toggled.append(e.item);
+        }
+    }
+    filtering = false;
+    currentNeedles.clear();
+    matches.clear();
+}
+
+QString PlaylistSearchIndex::itemText(const Item *item)
+{
+    // Needles never contain a newline, so joining the fields with one can't
+    // create matches across them.
+    QString text = item->toDisplayString();
+    for (const QVariant &v : item->metadata()) {
+        text.append(QChar('\n'));
+        text.append(v.toString());
+    }
+    return text.toLower();
+}
+
+bool PlaylistSearchIndex::textMatches(const QString &text,
+                                      const QStringList &needles)
+{
+    for (const QString &needle : needles)
+        if (!text.contains(needle))
+            return false;
+    return true;
+}
+
+void PlaylistSearchIndex::reindex(const QSharedPointer<Item> &item)
+{
+    auto it = slotsByUuid.constFind(item->uuid());
+    if (it != slotsByUuid.constEnd())
+        kill(*it);
+    maybeCompact();
+    quint32 slot = addEntry(item, itemText(item.data()), item->revision());
+    applyFilterTo(slot);
+}
+
+quint32 PlaylistSearchIndex::addEntry(const QSharedPointer<Item> &item,
+                                      const QString &text, int revision)
+{
+    quint32 slot = quint32(entries.size());
+    entries.append({ item, text, revision, true });
+    slotsByUuid.insert(item->uuid(), slot);
+
+    // Slots only ever grow, so every posting list stays sorted and a repeated
+    // trigram in this entry is always at the back of its list.
+    const QChar *c = text.constData();
+    for (int i = 0; i + 3 <= text.size(); ++i) {
+        QVector<quint32> &list = postings[trigramAt(c + i)];
+        if (list.isEmpty() || list.last() != slot)
+            list.append(slot);
+    }
+    return slot;
+}
+
+void PlaylistSearchIndex::kill(quint32 slot)
+{
+    if (!entries[slot].live)
+        return;
+    entries[slot].live = false;
+    ++deadEntries;
+}
+
+void PlaylistSearchIndex::applyFilterTo(quint32 slot)
+{
+    if (!filtering)
+        return;
+    Entry &e = entries[slot];
+    bool match = textMatches(e.text, currentNeedles);
+    auto it = std::lower_bound(matches.begin(), matches.end(), slot);
+    bool listed = it != matches.end() && *it == slot;
+    if (match && !listed)
+        matches.insert(it, slot);
+    else if (!match && listed)
+        matches.erase(it);
+    if (e.item->hidden() != !match) {
+        e.item->setHidden(!match);
+        toggled.append(e.item);
+    }
+}
+
+bool PlaylistSearchIndex::refines(const QStringList &needles) const
+{
+    // Every old needle lives inside a new one, so the new matches can only
+    // be a subset of the old ones.
+    for (const QString &old : currentNeedles) {
+        bool covered = false;
+        for (const QString &needle : needles) {
+            if (needle.contains(old)) {
+                covered = true;
+                break;
+            }
+        }
+        if (!covered)
+            return false;
+    }
+    return true;
+}
+
+QVector<quint32> PlaylistSearchIndex::candidatesFor(const QStringList &needles) const
+{
+    const QVector<quint32> *best = nullptr;
+    for (const QString &needle : needles) {
+        const QChar *c = needle.constData();
+        for (int i = 0; i + 3 <= needle.size(); ++i) {
+            auto it = postings.constFind(trigramAt(c + i));
+            if (it == postings.constEnd())
+                return QVector<quint32>();
+            if (!best || it->size() < best->size())
+                best = &*it;
+        }
+    }
+    if (best)
+        return *best;
+
+    // Only short needles, so everything is a candidate.
+    QVector<quint32> all;
+    all.reserve(entries.size() - deadEntries);
+    for (int slot = 0; slot < entries.size(); ++slot)
+        if (entries[slot].live)
+            all.append(quint32(slot));
+    return all;
+}
+
+QVector<QSharedPointer<Item>> PlaylistSearchIndex::takeToggled()
+{
+    QMutexLocker locker(&mutex);
+    QVector<QSharedPointer<Item>> taken;
+    taken.swap(toggled);
+    return taken;
+}
+
+void PlaylistSearchIndex::maybeCompact()
+{
+    if (deadEntries < searchCompactThreshold
+            || deadEntries * 2 < entries.size())
+        return;
+    sweep();
+}
+
+void PlaylistSearchIndex::sweep()
+{
+    // Tombstones hold on to their items, so this is what finally lets go of
+    // removed ones.
+    if (!deadEntries)
+        return;
+
+    QVector<Entry> old;
+    old.swap(entries);
+    QVector<bool> wasMatch(old.size(), false);
+    for (quint32 slot : matches)
+        wasMatch[int(slot)] = true;
+
+    slotsByUuid.clear();
+    postings.clear();
+    matches.clear();
+    deadEntries = 0;
+    for (int i = 0; i < old.size(); ++i) {
+        if (!old[i].live)
+            continue;
+        quint32 slot = addEntry(old[i].item, old[i].text, old[i].revision);
+        if (wasMatch[i])
+            matches.append(slot);
+    }
+}
+
+
+
+int PlaylistPositions::indexOf(const QUuid &uuid)
+{
+    // The table taken along may be out of date, in which case it is made
+    // again from the items, once.
+    int index = positions.value(uuid, -1);
+    if (index >= 0 && index < items.count() && items.at(index)->uuid() == uuid)
+        return index;
+    if (rebuilt)
+        return -1;
+    rebuilt = true;
+    positions.clear();
+    positions.reserve(items.count());
+    for (int i = 0; i < items.count(); ++i)
+        positions.insert(items.at(i)->uuid(), i);
+    return positions.value(uuid, -1);
+}
+
+
+
 Playlist::Playlist(const QString &title)
 {
     setUuid(QUuid::createUuid());
@@ -234,6 +880,11 @@ QSharedPointer<Item> Playlist::addItem(const QUrl &url)
     i->setPlaylistUuid(uuid_);
     items.append(i);
     itemsByUuid.insert(i->uuid(), i);
+    searchIndex.insert(i);
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << QUuid() << quint32(1);
+        i->toBinary(out);
+    });
     return i;
 }
 
@@ -246,14 +897,28 @@ QSharedPointer<Item> Playlist::addItem(const QUuid &uuid, const QUrl &url)
     i->setUuid(uuid);
     items.append(i);
     itemsByUuid.insert(uuid, i);
+    searchIndex.insert(i);
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << QUuid() << quint32(1);
+        i->toBinary(out);
+    });
     return i;
 }
 
 QSharedPointer<Item> Playlist::addItemClone(const QSharedPointer<Item> &item)
 {
-    QSharedPointer<Item> i = addItem(item->url());
+    // Fill in the metadata before indexing, so the item is tokenized once.
+    QWriteLocker locker(&listLock);
+    QSharedPointer<Item> i(ItemCollection::getSingleton()->addItem(item->url()));
     i->setPlaylistUuid(uuid_);
     i->setMetadata(item->metadata());
+    items.append(i);
+    itemsByUuid.insert(i->uuid(), i);
+    searchIndex.insert(i);
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << QUuid() << quint32(1);
+        i->toBinary(out);
+    });
     return i;
 }
 
@@ -262,6 +927,11 @@ void Playlist::addItemRaw(const QSharedPointer<Item> &item)
     QWriteLocker locker(&listLock);
     items.append(item);
     itemsByUuid.insert(item->uuid(), item);
+    searchIndex.insert(item);
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << QUuid() << quint32(1);
+        item->toBinary(out);
+    });
 }
 
 QSharedPointer<Item> Playlist::itemAt(int index)
@@ -354,15 +1024,29 @@ void Playlist::addItems(const QUuid &where,
         item->setPlaylistUuid(uuid_);
         items.insert(indexWhere + i, item);
         itemsByUuid.insert(item->uuid(), item);
+        searchIndex.insert(item);
     }
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << where << quint32(itemsToAdd.count());
+        for (auto &item : itemsToAdd)
+            item->toBinary(out);
+    });
 }
 
 void Playlist::removeItem(const QUuid &uuid)
 {
+    // Only queued items go near the queue, so that playlists being replayed
+    // on the loader thread never touch it.
     QWriteLocker locker(&listLock);
-    PlaylistCollection::queuePlaylist()->removeItem(uuid);
-    items.removeAll(itemsByUuid.take(uuid));
+    QSharedPointer<Item> item = itemsByUuid.take(uuid);
+    if (item && item->queuePosition() > 0)
+        PlaylistCollection::queuePlaylist()->removeItem(uuid);
+    items.removeAll(item);
+    searchIndex.remove(uuid);
     ItemCollection::getSingleton()->removeItem(uuid);
+    writeJournal(PlaylistJournal::RemoveItems, [&](QDataStream &out) {
+        out << QList<QUuid>({ uuid });
+    });
 }
 
 void Playlist::takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove)
@@ -370,10 +1054,36 @@ void Playlist::takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove)
     // "takeItemsRaw", because we don't check if it's in a queue or whatever,
     // it's just taken raw, potentially damaging everything.  Only use if you
     // may know what you're doing.
+    QList<QUuid> uuids;
     for (const QSharedPointer<Item> &item: itemsToRemove) {
         itemsByUuid.remove(item->uuid());
         items.removeAll(item);
+        searchIndex.remove(item->uuid());
+        uuids.append(item->uuid());
     }
+    writeJournal(PlaylistJournal::RemoveItems, [&](QDataStream &out) {
+        out << uuids;
+    });
+}
+
+void Playlist::moveItems(const QUuid &where,
+                         const QList<QSharedPointer<Item>> &itemsToMove)
+{
+    // Inserts before where like addItems, so a null uuid moves to the end.
+    QWriteLocker locker(&listLock);
+    QList<QUuid> uuids;
+    for (const QSharedPointer<Item> &item : itemsToMove) {
+        items.removeAll(item);
+        uuids.append(item->uuid());
+    }
+    int indexWhere = items.indexOf(itemsByUuid.value(where));
+    if (indexWhere < 0)
+        indexWhere = items.size();
+    for (int i = 0; i < itemsToMove.count(); ++i)
+        items.insert(indexWhere + i, itemsToMove.at(i));
+    writeJournal(PlaylistJournal::MoveItems, [&](QDataStream &out) {
+        out << where << uuids;
+    });
 }
 
 QList<QUuid> Playlist::replaceItem(const QUuid &where, const QList<QUrl> &urls)
@@ -383,6 +1093,7 @@ QList<QUuid> Playlist::replaceItem(const QUuid &where, const QList<QUrl> &urls)
         return QList<QUuid>();
 
     itemsByUuid[where]->setUrl(urls[0]);
+    searchIndex.insert(itemsByUuid[where]);
 
     QList<QUuid> addedItems;
     // essentially insertAfter(where, urls[1..end]);
@@ -392,17 +1103,39 @@ QList<QUuid> Playlist::replaceItem(const QUuid &where, const QList<QUrl> &urls)
         i->setPlaylistUuid(uuid_);
         items.insert(insertIndex + urlIndex, i);
         itemsByUuid.insert(i->uuid(), i);
+        searchIndex.insert(i);
         addedItems.append(i->uuid());
     }
+
+    PlaylistJournal::Batch batch;
+    writeJournal(PlaylistJournal::UpdateItem, [&](QDataStream &out) {
+        itemsByUuid[where]->toBinary(out);
+    });
+    if (!addedItems.isEmpty()) {
+        QSharedPointer<Item> next = items.value(insertIndex + urls.count());
+        writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+            out << (next ? next->uuid() : QUuid()) << quint32(addedItems.count());
+            for (int n = 1; n < urls.count(); n++)
+                items.at(insertIndex + n)->toBinary(out);
+        });
+    }
     return addedItems;
 }
 
 void Playlist::clear()
 {
     QWriteLocker locker(&listLock);
-    PlaylistCollection::queuePlaylist()->removeItems(itemsByUuid.keys());
+    QList<QUuid> queued;
+    for (auto &i : items)
+        if (i->queuePosition() > 0)
+            queued.append(i->uuid());
+    if (!queued.isEmpty())
+        PlaylistCollection::queuePlaylist()->removeItems(queued);
     items.clear();
     itemsByUuid.clear();
+    positions.clear();
+    searchIndex.clear();
+    writeJournal(PlaylistJournal::ClearItems);
 }
 
 QDateTime Playlist::created()
@@ -425,6 +1158,9 @@ void Playlist::setTitle(const QString &title)
 {
     QWriteLocker locker(&listLock);
     title_ = title;
+    writeJournal(PlaylistJournal::SetTitle, [&](QDataStream &out) {
+        out << title;
+    });
 }
 
 bool Playlist::shuffle()
@@ -435,6 +1171,9 @@ bool Playlist::shuffle()
 void Playlist::setShuffle(bool shuffling)
 {
     shuffle_ = shuffling;
+    writeJournal(PlaylistJournal::SetShuffle, [&](QDataStream &out) {
+        out << shuffling;
+    });
 }
 
 QUuid Playlist::uuid()
@@ -456,7 +1195,158 @@ QUuid Playlist::nowPlaying()
 
 void Playlist::setNowPlaying(const QUuid &uuid)
 {
+    if (nowPlaying_ == uuid)
+        return;
     nowPlaying_ = uuid;
+    writeJournal(PlaylistJournal::SetNowPlaying, [&](QDataStream &out) {
+        out << uuid;
+    });
+}
+
+void Playlist::setFilter(const QStringList &needles)
+{
+    QReadLocker locker(&listLock);
+    searchIndex.filter(needles);
+}
+
+void Playlist::clearFilter()
+{
+    QReadLocker locker(&listLock);
+    searchIndex.clearFilter();
+}
+
+QVector<QSharedPointer<Item>> Playlist::takeFilterChanges()
+{
+    return searchIndex.takeToggled();
+}
+
+int Playlist::indexOf(const QUuid &uuid)
+{
+    QWriteLocker locker(&listLock);
+    int index = positions.value(uuid, -1);
+    if (index >= 0 && index < items.count() && items.at(index)->uuid() == uuid)
+        return index;
+    if (!itemsByUuid.contains(uuid))
+        return -1;
+    positions.clear();
+    positions.reserve(items.count());
+    for (int i = 0; i < items.count(); ++i)
+        positions.insert(items.at(i)->uuid(), i);
+    return positions.value(uuid, -1);
+}
+
+PlaylistPositions Playlist::positionSnapshot()
+{
+    // Both are shared, so this only costs the lock.
+    QReadLocker locker(&listLock);
+    PlaylistPositions snapshot;
+    snapshot.items = items;
+    snapshot.positions = positions;
+    return snapshot;
+}
+
+void Playlist::setJournaled(bool yes)
+{
+    journaled_ = yes;
+}
+
+void Playlist::journalItem(const Item *item)
+{
+    writeJournal(PlaylistJournal::UpdateItem, [&](QDataStream &out) {
+        item->toBinary(out);
+    });
+}
+
+void Playlist::replay(PlaylistJournal::Op op, QDataStream &in)
+{
+    switch (op) {
+    case PlaylistJournal::AddItems: {
+        QUuid where;
+        quint32 count;
+        in >> where >> count;
+        QList<QSharedPointer<Item>> added;
+        for (quint32 n = 0; n < count; ++n) {
+            QSharedPointer<Item> i(new Item());
+            i->fromBinary(in);
+            if (in.status() != QDataStream::Ok)
+                break;
+            if (contains(i->uuid()))
+                continue;
+            ItemCollection::getSingleton()->storeItem(i);
+            added.append(i);
+        }
+        addItems(where, added);
+        break;
+    }
+    case PlaylistJournal::RemoveItems: {
+        QList<QUuid> uuids;
+        in >> uuids;
+        for (const QUuid &uuid : uuids)
+            if (contains(uuid))
+                removeItem(uuid);
+        break;
+    }
+    case PlaylistJournal::MoveItems: {
+        QUuid where;
+        QList<QUuid> uuids;
+        in >> where >> uuids;
+        QList<QSharedPointer<Item>> moving;
+        for (const QUuid &uuid : uuids)
+            if (auto i = itemOf(uuid))
+                moving.append(i);
+        moveItems(where, moving);
+        break;
+    }
+    case PlaylistJournal::UpdateItem: {
+        Item updated;
+        updated.fromBinary(in);
+        auto i = itemOf(updated.uuid());
+        if (!i)
+            break;
+        i->setUrl(updated.url());
+        i->setMetadata(updated.metadata());
+        reindexItem(i.data());
+        break;
+    }
+    case PlaylistJournal::ClearItems:
+        clear();
+        break;
+    case PlaylistJournal::SetTitle: {
+        QString title;
+        in >> title;
+        setTitle(title);
+        break;
+    }
+    case PlaylistJournal::SetShuffle: {
+        bool shuffling;
+        in >> shuffling;
+        setShuffle(shuffling);
+        break;
+    }
+    case PlaylistJournal::SetNowPlaying: {
+        QUuid uuid;
+        in >> uuid;
+        setNowPlaying(uuid);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Playlist::writeJournal(PlaylistJournal::Op op,
+                            const std::function<void(QDataStream &)> &payload)
+{
+    // uuid_ is read without the lock, as callers are usually holding it.
+    if (journaled_)
+        PlaylistJournal::write(op, uuid_, payload);
+}
+
+void Playlist::reindexItem(const Item *item)
+{
+    // No listLock here: this is reached from Item::setMetadata, which may be
+    // called while our own write lock is held.  The index has its own mutex.
+    searchIndex.update(item);
 }
 
 QStringList Playlist::toStringList()
@@ -473,13 +1363,22 @@ void Playlist::fromStringList(QStringList sl)
     QWriteLocker locker(&listLock);
     items.clear();
     itemsByUuid.clear();
+    searchIndex.clear();
     for (QString &s : sl) {
         QSharedPointer<Item> item(new Item());
         item->setPlaylistUuid(uuid_);
         item->fromString(s);
         items.append(item);
         itemsByUuid.insert(item->uuid(), item);
+        searchIndex.insert(item);
     }
+    PlaylistJournal::Batch batch;
+    writeJournal(PlaylistJournal::ClearItems);
+    writeJournal(PlaylistJournal::AddItems, [&](QDataStream &out) {
+        out << QUuid() << quint32(items.count());
+        for (auto &item : items)
+            item->toBinary(out);
+    });
 }
 
 QVariantMap Playlist::toVMap()
@@ -523,11 +1422,77 @@ void Playlist::fromVMap(const QVariantMap &qvm)
             i->fromVMap(v.toMap());
             this->items.append(i);
             this->itemsByUuid.insert(i->uuid(), i);
+            searchIndex.insert(i);
             ItemCollection::getSingleton()->storeItem(i);
         }
     }
 }
 
+QByteArray Playlist::toBinary()
+{
+    QReadLocker locker(&listLock);
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(recordStreamVersion);
+    out << uuid_ << title_ << created_ << shuffle_ << nowPlaying_;
+    out << quint32(items.count());
+    for (auto &i : items)
+        i->toBinary(out);
+    return data;
+}
+
+void Playlist::fromBinary(const QByteArray &data)
+{
+    QWriteLocker locker(&listLock);
+    QDataStream in(data);
+    in.setVersion(recordStreamVersion);
+    quint32 count;
+    in >> uuid_ >> title_ >> created_ >> shuffle_ >> nowPlaying_ >> count;
+    // A damaged record keeps the items before the damage.  Every item takes
+    // at least 20 bytes, so don't trust a larger count.
+    items.reserve(int(qMin<quint32>(count, quint32(data.size() / 20))));
+    for (quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+        QSharedPointer<Item> i(new Item());
+        i->setPlaylistUuid(uuid_);
+        i->fromBinary(in);
+        if (in.status() != QDataStream::Ok)
+            break;
+        items.append(i);
+        itemsByUuid.insert(i->uuid(), i);
+        searchIndex.insert(i);
+        ItemCollection::getSingleton()->storeItem(i);
+    }
+}
+
+QVariantMap Playlist::recordToVMap(const QByteArray &record)
+{
+    QDataStream in(record);
+    in.setVersion(recordStreamVersion);
+    QUuid uuid, nowPlaying;
+    QString title;
+    QDateTime created;
+    bool shuffle;
+    quint32 count;
+    in >> uuid >> title >> created >> shuffle >> nowPlaying >> count;
+
+    QVariantMap qvm;
+    qvm.insert(keyCreated, created);
+    qvm.insert(keyTitle, title);
+    qvm.insert(keyShuffle, shuffle);
+    qvm.insert(keyUuid, uuid);
+    qvm.insert(keyNowPlaying, nowPlaying);
+    QVariantList qvl;
+    for (quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+        Item i;
+        i.fromBinary(in);
+        if (in.status() != QDataStream::Ok)
+            break;
+        qvl.append(i.toVMap());
+    }
+    qvm.insert(keyItems, qvl);
+    return qvm;
+}
+
 
 
 QueuePlaylist::QueuePlaylist(const QString &title)
@@ -551,6 +1516,7 @@ QPair<QUuid,QUuid> QueuePlaylist::takeFirst()
         return { QUuid(), QUuid() };
     QSharedPointer<Item> item = items.takeFirst();
     itemsByUuid.remove(item->uuid());
+    searchIndex.remove(item->uuid());
     item->setQueuePosition(0);
     int i = 1;
     for (auto &item : items)
@@ -591,6 +1557,7 @@ void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &
             if (!itemsByUuid.contains(item->uuid())) {
                 items.append(item);
                 itemsByUuid.insert(item->uuid(), item);
+                searchIndex.insert(item);
                 item->setQueuePosition(items.count());
                 added.append(item->uuid());
             }
@@ -617,6 +1584,7 @@ void QueuePlaylist::addItems(const QUuid &where, const QList<QSharedPointer<Item
         QSharedPointer<Item> item = itemsToAdd[i];
         items.insert(index + i, item);
         itemsByUuid.insert(item->uuid(), item);
+        searchIndex.insert(item);
     }
     count = items.count();
     for (int i = index; i < count; i++)
@@ -642,6 +1610,7 @@ void QueuePlaylist::clear()
         item->setQueuePosition(0);
     items.clear();
     itemsByUuid.clear();
+    searchIndex.clear();
 }
 
 int QueuePlaylist::contains(const QList<QUuid> &itemsToCheck)
@@ -667,6 +1636,7 @@ int QueuePlaylist::toggle_(const QUuid &playlistUuid, const QUuid &itemUuid, boo
         return 0;
     items.append(item);
     itemsByUuid.insert(itemUuid, item);
+    searchIndex.insert(item);
     item->setQueuePosition(items.count());
     return 1;
 }
@@ -688,6 +1658,7 @@ void QueuePlaylist::removeItem_(const QUuid &uuid)
     int index = items.indexOf(item);
     items.removeOne(item);
     itemsByUuid.remove(uuid);
+    searchIndex.remove(uuid);
     item->setQueuePosition(0);
     int count = items.count();
     for (int i = index; i < count; i++)
@@ -704,6 +1675,7 @@ QList<int> QueuePlaylist::removeItems_(const QList<QUuid> &itemsToRemove)
         QSharedPointer<Item> item = i.next();
         if (removalSet.contains(item->uuid())) {
             itemsByUuid.remove(item->uuid());
+            searchIndex.remove(item->uuid());
             item->setQueuePosition(0);
             i.remove();
             removedIndices.append(index);
@@ -757,11 +1729,13 @@ QSharedPointer<QueuePlaylist> PlaylistCollection::queuePlaylist()
 
 QSharedPointer<Playlist> PlaylistCollection::newPlaylist(const QString &title)
 {
+    materialize();
     return doNewPlaylist(title, QUuid::createUuid());
 }
 
 QSharedPointer<Playlist> PlaylistCollection::clonePlaylist(const QUuid &uuid)
 {
+    materialize();
     if (!playlistsByUuid.contains(uuid))
         return QSharedPointer<Playlist>();
     auto origin = playlistsByUuid[uuid];
@@ -778,6 +1752,7 @@ QSharedPointer<Playlist> PlaylistCollection::clonePlaylist(const QUuid &uuid)
 
 void PlaylistCollection::removePlaylist(const QUuid &uuid)
 {
+    materialize();
     if (!playlistsByUuid.contains(uuid))
         return;
     QSharedPointer<Playlist> p = playlistsByUuid.value(uuid);
@@ -794,15 +1769,23 @@ void PlaylistCollection::removePlaylist(const QSharedPointer<Playlist> &p)
 
 QSharedPointer<Playlist> PlaylistCollection::playlistAt(int col) const
 {
+    const_cast<PlaylistCollection*>(this)->materialize();
     return (col < playlists.count()) ? playlists.at(col) : QSharedPointer<Playlist>();
 }
 
 QSharedPointer<Playlist> PlaylistCollection::playlistOf(const QUuid &uuid) const
 {
+    const_cast<PlaylistCollection*>(this)->materialize();
     return playlistsByUuid.value(uuid);
 }
 
 void PlaylistCollection::addPlaylist(const QSharedPointer<Playlist> &playlist)
+{
+    materialize();
+    addPlaylist_(playlist);
+}
+
+void PlaylistCollection::addPlaylist_(const QSharedPointer<Playlist> &playlist)
 {
     if (!playlist)
         return;
@@ -817,6 +1800,7 @@ void PlaylistCollection::addPlaylist(const QSharedPointer<Playlist> &playlist)
 
 void PlaylistCollection::fromVList(const QVariantList &data)
 {
+    materialize();
     for (const auto &d : data) {
         QSharedPointer<Playlist> p(new Playlist);
         p->fromVMap(d.toMap());
@@ -824,13 +1808,41 @@ void PlaylistCollection::fromVList(const QVariantList &data)
     }
 }
 
-QVariantList PlaylistCollection::toVList()
+void PlaylistCollection::fromRecords(const QSharedPointer<RecordFile> &file)
 {
-    QVariantList l;
-    for (const auto &p : playlists) {
-        l.append(p->toVMap());
+    materialize();
+    pendingFile = file;
+    for (int i = 0; i < file->count(); ++i)
+        pendingRecords.append(file->record(i));
+}
+
+QList<QByteArray> PlaylistCollection::toRecords()
+{
+    // Take our own copy of anything still pointing into the map, so that
+    // the file can be let go of before it is overwritten.
+    if (pendingFile) {
+        for (QByteArray &r : pendingRecords)
+            r = QByteArray(r.constData(), r.size());
+        pendingFile.reset();
+    }
+    QList<QByteArray> records;
+    for (const auto &p : playlists)
+        records.append(p->toBinary());
+    return records + pendingRecords;
+}
+
+void PlaylistCollection::materialize()
+{
+    if (pendingRecords.isEmpty())
+        return;
+    QList<QByteArray> records;
+    records.swap(pendingRecords);
+    for (const QByteArray &r : records) {
+        QSharedPointer<Playlist> p(new Playlist);
+        p->fromBinary(r);
+        addPlaylist_(p);
     }
-    return l;
+    pendingFile.reset();
 }
 
 QSharedPointer<Playlist> PlaylistCollection::doNewPlaylist(const QString &title,
@@ -864,15 +1876,8 @@ int PlaylistSearcher::bumps()
 bool PlaylistSearcher::itemMatchesFilter(const QSharedPointer<Item> &item,
                                          const QStringList &needles)
 {
-    QSet<QString> found;
-    findNeedles(item->toDisplayString(), needles, found);
-    if (found.count() == needles.count())
-        return true;
-
-    // OPTIMIZE: don't run the metadata through toLower every search
-    for (const QVariant &v : item->metadata())
-        findNeedles(v.toString(), needles, found);
-    return found.count() == needles.count();
+    return PlaylistSearchIndex::textMatches(
+                PlaylistSearchIndex::itemText(item.data()), needles);
 }
 
 void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString text)
@@ -892,10 +1897,7 @@ void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString tex
     if (list.isNull())
         return;
 
-    auto marker = [&needles](QSharedPointer<Item> item) {
-        item->setHidden(!itemMatchesFilter(item, needles));
-    };
-    list->iterateItems(marker);
+    list->setFilter(needles);
     emit playlistFiltered(list->uuid());
 }
 
@@ -904,10 +1906,7 @@ void PlaylistSearcher::clearPlaylistFilter(QSharedPointer<Playlist> &list)
     if (list.isNull())
         return;
 
-    auto clearer = [](QSharedPointer<Item> item) {
-        item->setHidden(false);
-    };
-    list->iterateItems(clearer);
+    list->clearFilter();
     emit playlistFiltered(list->uuid());
 }
 
@@ -915,14 +1914,3 @@ QStringList PlaylistSearcher::textToNeedles(QString text)
 {
     return text.toLower().split(QString(" "), QString::SkipEmptyParts);
 }
-
-void PlaylistSearcher::findNeedles(const QString &text,
-                                   const QStringList &needles,
-                                   QSet<QString> &found)
-{
-    QString haystack = text.toLower();
-    for (const QString &needle : needles) {
-        if (haystack.contains(needle))
-            found.insert(needle);
-    }
-}
@@ -14,8 +14,31 @@
 #include <QHash>
 #include <QStringList>
 #include <QVariantMap>
+#include <QVector>
+#include <QMutex>
 #include <QReadWriteLock>
 
+class QDataStream;
+class RecordFile;
+class Journal;
+class Playlist;
+class PlaylistCollection;
+
+// MetadataKeys interns the metadata key names (title, artist, ...) shared by
+// every item, so that an item stores a small id per key instead of a string.
+// Once every id is taken, new keys get Full, and are dropped by the items.
+class MetadataKeys {
+public:
+    enum : quint16 { Full = 0xffff };
+    static quint16 intern(const QString &key);
+    static QString name(quint16 id);
+};
+
+
+
+// Items are stored compactly: metadata is a small vector keyed by interned
+// ids, and local file urls are split into a directory shared between items
+// and a file name.  The accessors rebuild the usual Qt types on demand.
 class Item {
 public:
     Item(QUrl url = QUrl());
@@ -26,8 +49,10 @@ public:
     void setPlaylistUuid(const QUuid &uuid);
     QUrl url() const;
     void setUrl(const QUrl &url);
-    const QVariantMap &metadata() const;
-    void setMetadata(const QVariantMap &qvm);
+    QVariantMap metadata() const;
+    // The playlists of owner that hold this item are told of the change.
+    // Without one, reindexing and journaling are left to the caller.
+    void setMetadata(const QVariantMap &qvm, PlaylistCollection *owner = nullptr);
 
     int originalPosition();
     void setOriginalPosition(int i);
@@ -51,12 +76,36 @@ public:
 
     QVariantMap toVMap() const;
     void fromVMap(const QVariantMap &qvm);
+    void toBinary(QDataStream &out) const;
+    void fromBinary(QDataStream &in);
+
+    // Bumped whenever the url or metadata changes, so that anything derived
+    // from them (search text, display labels) can tell when it is stale.
+    int revision() const;
+
+    // The label drawn for this item, kept until the item or the display
+    // format changes.
+    bool cachedLabel(int format, QString &label) const;
+    void setCachedLabel(int format, const QString &label);
 
 private:
+    struct MetadataEntry {
+        quint16 key;
+        QVariant value;
+    };
+    static QString internDirectory(const QString &directory);
+    void storeMetadata(const QVariantMap &qvm);
+
     QUuid uuid_;
     QUuid playlistUuid_;
-    QUrl url_;
-    QVariantMap metadata_;
+    QString urlDirectory_;          // set for local files only
+    QString urlName_;
+    QUrl url_;                      // everything else
+    QVector<MetadataEntry> metadata_;
+    int revision_ = 0;
+    QString label_;
+    int labelFormat_ = -1;
+    int labelRevision_ = -1;
     int originalPosition_;
     int queuePosition_ = 0;
     int extraPlayTimes_ = 0;
@@ -80,11 +129,131 @@ public:
     void storeItem(const QSharedPointer<Item> &item);
 
 private:
+    // Playlists are loaded on another thread during startup.
+    QMutex lock;
     QHash<QUuid, QSharedPointer<Item>> items;
 };
 
 
 
+// PlaylistSearchIndex keeps the lowercased text of every item in a playlist
+// along with trigram postings of that text.  A search only verifies the
+// items found in the shortest posting list of its needles, and a search that
+// narrows the previous one only re-checks the previous matches.  It applies
+// the result directly to the items' hidden flags, and remembers which items
+// changed so that views only have to touch those.
+class PlaylistSearchIndex {
+public:
+    void insert(const QSharedPointer<Item> &item);
+    void remove(const QUuid &uuid);
+    void update(const Item *item);
+    void clear();
+
+    void filter(const QStringList &needles);
+    void clearFilter();
+    QVector<QSharedPointer<Item>> takeToggled();
+
+    static QString itemText(const Item *item);
+    static bool textMatches(const QString &text, const QStringList &needles);
+
+private:
+    struct Entry {
+        QSharedPointer<Item> item;
+        QString text;
+        int revision;
+        bool live;
+    };
+
+    void reindex(const QSharedPointer<Item> &item);
+    quint32 addEntry(const QSharedPointer<Item> &item, const QString &text,
+                     int revision);
+    void kill(quint32 slot);
+    void applyFilterTo(quint32 slot);
+    bool refines(const QStringList &needles) const;
+    QVector<quint32> candidatesFor(const QStringList &needles) const;
+    void maybeCompact();
+    void sweep();
+
+    QVector<Entry> entries;
+    QHash<QUuid, quint32> slotsByUuid;
+    QHash<quint64, QVector<quint32>> postings;
+    int deadEntries = 0;
+
+    bool filtering = false;
+    QStringList currentNeedles;
+    QVector<quint32> matches;     // sorted slots matching currentNeedles
+    QVector<QSharedPointer<Item>> toggled;
+
+    QMutex mutex;
+};
+
+
+
+// Every change to the playlists shown as tabs is written to a journal as it
+// happens.  Replaying it over the last saved records brings them back up to
+// date, so saving never has to rewrite every playlist at once.
+class PlaylistJournal {
+public:
+    enum Op : quint8 {
+        AddPlaylist, RemovePlaylist, BackupPlaylist, MoveTabs,
+        AddItems, RemoveItems, MoveItems, UpdateItem, ClearItems,
+        SetTitle, SetShuffle, SetNowPlaying, Group
+    };
+    static const quint32 version = 1;
+
+    // Records written while a Batch is alive go out as one Group record, so
+    // that an operation on many items costs the journal a single record.
+    // Batches nest, and are only used on the gui thread.
+    class Batch {
+    public:
+        Batch();
+        ~Batch();
+    };
+
+    // Records normally go to the journal file, but may be sent anywhere.
+    typedef std::function<void(const QByteArray &)> Sink;
+    static void setJournal(const QSharedPointer<Journal> &journal);
+    static void setSink(const Sink &sink);
+    static bool active();
+    static void write(Op op, const QUuid &playlist,
+                      const std::function<void(QDataStream &)> &payload = nullptr);
+
+    static void playlistAdded(const QSharedPointer<Playlist> &playlist);
+    static void playlistRemoved(const QUuid &uuid);
+    static void playlistBackedUp(const QSharedPointer<Playlist> &playlist);
+    static void tabsMoved(const QList<QUuid> &order);
+
+    // Applies a record to the tabs and backup being restored.  Records
+    // already reflected in them are skipped over.
+    static void replay(const QByteArray &record,
+                       QList<QSharedPointer<Playlist>> &tabs,
+                       QList<QSharedPointer<Playlist>> &backup);
+
+private:
+    static void emitRecord(const QByteArray &record);
+
+    static Sink sink;
+    static int batchDepth;
+    static QList<QByteArray> batched;
+};
+
+
+
+// Item positions as they were when taken from a playlist, so that many can
+// be looked up without locking it for each.
+class PlaylistPositions {
+public:
+    int indexOf(const QUuid &uuid);
+
+private:
+    friend class Playlist;
+    QList<QSharedPointer<Item>> items;
+    QHash<QUuid, int> positions;
+    bool rebuilt = false;
+};
+
+
+
 class Playlist : public QObject {
     Q_OBJECT
 public:
@@ -108,6 +277,7 @@ public:
     virtual void addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd);
     virtual void removeItem(const QUuid &uuid);
     void takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove);
+    void moveItems(const QUuid &where, const QList<QSharedPointer<Item>> &itemsToMove);
     QList<QUuid> replaceItem(const QUuid &where, const QList<QUrl> &urls);
     virtual void clear();
 
@@ -122,23 +292,49 @@ public:
     QUuid nowPlaying();
     void setNowPlaying(const QUuid &uuid);
 
+    void setFilter(const QStringList &needles);
+    void clearFilter();
+    QVector<QSharedPointer<Item>> takeFilterChanges();
+    void reindexItem(const Item *item);
+
+    // Positions are kept in a table that is only rebuilt when it turns out
+    // to be out of date, so repeated lookups between moves are cheap.
+    int indexOf(const QUuid &uuid);
+    PlaylistPositions positionSnapshot();
+
+    // Only the playlists shown as tabs write their changes to the journal.
+    void setJournaled(bool yes);
+    void journalItem(const Item *item);
+    void replay(PlaylistJournal::Op op, QDataStream &in);
+
     QStringList toStringList();
     void fromStringList(QStringList sl);
 
     QVariantMap toVMap();
     void fromVMap(const QVariantMap &qvm);
+    QByteArray toBinary();
+    void fromBinary(const QByteArray &data);
+    // The map toVMap would make from a record, without making any items
+    // that would stand in for the live ones.  Safe to call from any thread.
+    static QVariantMap recordToVMap(const QByteArray &record);
 
 protected:
     QList<QSharedPointer<Item>> items;
     QHash<QUuid, QSharedPointer<Item>> itemsByUuid;
+    QHash<QUuid, int> positions;
     //QList<QUuid> queue;
     QDateTime created_;
     QString title_;
     bool shuffle_ = false;
     QUuid uuid_;
     QUuid nowPlaying_;
+    PlaylistSearchIndex searchIndex;
 
     QReadWriteLock listLock;
+    bool journaled_ = false;
+
+    void writeJournal(PlaylistJournal::Op op,
+                      const std::function<void(QDataStream &)> &payload = nullptr);
 
     friend class QueuePlaylist;
 };
@@ -190,11 +386,21 @@ public:
 
     void addPlaylist(const QSharedPointer<Playlist> &playlist);
     void fromVList(const QVariantList &data);
-    QVariantList toVList();
+
+    // Playlists read from a record file are only decoded once something
+    // asks for them.  Undecoded ones are written back out byte for byte.
+    static const quint32 recordVersion = 1;
+    void fromRecords(const QSharedPointer<RecordFile> &file);
+    QList<QByteArray> toRecords();
 
 private:
+    void materialize();
+    void addPlaylist_(const QSharedPointer<Playlist> &playlist);
+
     QList<QSharedPointer<Playlist>> playlists;
     QHash<QUuid, QSharedPointer<Playlist>> playlistsByUuid;
+    QSharedPointer<RecordFile> pendingFile;
+    QList<QByteArray> pendingRecords;
 
     QSharedPointer<Playlist> doNewPlaylist(const QString &title,
                                            const QUuid &uuid);
@@ -221,9 +427,6 @@ public slots:
     void clearPlaylistFilter(QSharedPointer<Playlist> &list);
 
 private:
-    static void findNeedles(const QString &text, const QStringList &needles,
-                            QSet<QString> &found);
-
     QReadWriteLock bumpLock;
     volatile int bumps_ = 0;
 };
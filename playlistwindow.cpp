@@ -6,6 +6,7 @@
 #include <QInputDialog>
 #include <QFileDialog>
 #include <QMenu>
+#include <QTabBar>
 #include <QThread>
 #include "playlistwindow.h"
 #include "ui_playlistwindow.h"
@@ -62,6 +63,7 @@ QPair<QUuid, QUuid> PlaylistWindow::addToPlaylist(const QUuid &playlist, const Q
     QList<QUrl> filtered = Helpers::filterUrls(what);
     QPair<QUuid, QUuid> info;
     auto qdp = widgets.contains(playlist) ? widgets.value(playlist) : widgets[QUuid()];
+    PlaylistJournal::Batch batch;
     for (QUrl &url : filtered) {
         QPair<QUuid,QUuid> itemInfo = qdp->importUrl(url);
         if (info.second.isNull())
@@ -168,7 +170,7 @@ void PlaylistWindow::setMetadata(QUuid list, QUuid item, const QVariantMap &map)
     auto i = pl->itemOf(item);
     if (!i)
         return;
-    i->setMetadata(map);
+    i->setMetadata(map, PlaylistCollection::getSingleton().data());
 
     auto qdp = currentPlaylistWidget();
     if (qdp->uuid() == list)
@@ -232,29 +234,42 @@ void PlaylistWindow::deltaExtraPlayTimes(QUuid list, QUuid item, int delta)
     widgets[list]->viewport()->repaint();
 }
 
-QVariantList PlaylistWindow::tabsToVList() const
+void PlaylistWindow::tabsFromVList(const QVariantList &qvl)
 {
-    QVariantList qvl;
+    QList<QSharedPointer<Playlist>> playlists;
+    for (const QVariant &v : qvl) {
+        QSharedPointer<Playlist> p(new Playlist);
+        p->fromVMap(v.toMap());
+        playlists.append(p);
+    }
+    tabsFromPlaylists(playlists);
+}
+
+QList<QByteArray> PlaylistWindow::tabsToRecords() const
+{
+    QList<QByteArray> records;
     for (int i = 0; i < ui->tabWidget->count(); i++) {
         auto widget = reinterpret_cast<DrawnPlaylist *>(ui->tabWidget->widget(i));
-        qvl.append(widget->toVMap());
+        records.append(widget->toBinary());
     }
-    return qvl;
+    return records;
 }
 
-void PlaylistWindow::tabsFromVList(const QVariantList &qvl)
+void PlaylistWindow::tabsFromPlaylists(const QList<QSharedPointer<Playlist>> &playlists)
 {
     ui->tabWidget->clear();
     widgets.clear();
-    for (const QVariant &v : qvl) {
+    auto collection = PlaylistCollection::getSingleton();
+    for (const QSharedPointer<Playlist> &pl : playlists) {
+        collection->addPlaylist(pl);
+        pl->setJournaled(true);
         auto qdp = new DrawnPlaylist();
         qdp->setDisplayParser(&displayParser);
-        qdp->fromVMap(v.toMap());
+        qdp->setUuid(pl->uuid());
         connect(qdp, &DrawnPlaylist::itemDesired,
                 this, &PlaylistWindow::itemDesired);
         connect(qdp, &DrawnPlaylist::contextMenuRequested,
                 this, &PlaylistWindow::playlist_contextMenuRequested);
-        auto pl = PlaylistCollection::getSingleton()->playlistOf(qdp->uuid());
         ui->tabWidget->addTab(qdp, pl->title());
         widgets.insert(pl->uuid(), qdp);
     }
@@ -325,6 +340,9 @@ void PlaylistWindow::connectSignalsToSlots()
     connect(this->toggleViewAction(), &QAction::toggled,
             this, &PlaylistWindow::viewActionChanged);
 
+    connect(ui->tabWidget->tabBar(), &QTabBar::tabMoved,
+            this, &PlaylistWindow::tabBar_tabMoved);
+
     connect(ui->newTab, &QPushButton::clicked,
             this, &PlaylistWindow::newTab);
     connect(ui->closeTab, &QPushButton::clicked,
@@ -384,6 +402,12 @@ void PlaylistWindow::addNewTab(QUuid playlist, QString title)
     widgets.insert(playlist, qdp);
     ui->tabWidget->addTab(qdp, title);
     ui->tabWidget->setCurrentWidget(qdp);
+
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(playlist);
+    if (pl) {
+        pl->setJournaled(true);
+        PlaylistJournal::playlistAdded(pl);
+    }
 }
 
 void PlaylistWindow::addQuickQueue()
@@ -441,7 +465,8 @@ void PlaylistWindow::addSimplePlaylist(QStringList data)
 void PlaylistWindow::setDisplayFormatSpecifier(QString fmt)
 {
     displayParser.takeFormatString(fmt);
-    ui->tabWidget->currentWidget()->update();
+    currentPlaylistWidget()->viewport()->update();
+    queueWidget->viewport()->update();
 }
 
 void PlaylistWindow::newTab()
@@ -761,6 +786,7 @@ void PlaylistWindow::playlist_removeItemRequested()
     if (!qdp)
         return;
 
+    PlaylistJournal::Batch batch;
     qdp->traverseSelected([qdp](QUuid uuid) { qdp->removeItem(uuid); });
     updatePlaylistHasItems();
 }
@@ -919,6 +945,16 @@ void PlaylistWindow::playlist_contextMenuRequested(const QPoint &p, const QUuid
     m->exec(listWidget->mapToGlobal(p));
 }
 
+void PlaylistWindow::tabBar_tabMoved(int from, int to)
+{
+    Q_UNUSED(from)
+    Q_UNUSED(to)
+    QList<QUuid> order;
+    for (int i = 0; i < ui->tabWidget->count(); i++)
+        order.append(reinterpret_cast<DrawnPlaylist *>(ui->tabWidget->widget(i))->uuid());
+    PlaylistJournal::tabsMoved(order);
+}
+
 void PlaylistWindow::on_tabWidget_tabCloseRequested(int index)
 {
     int current = ui->tabWidget->currentIndex();
@@ -931,10 +967,12 @@ void PlaylistWindow::on_tabWidget_tabCloseRequested(int index)
     auto copy = collection->clonePlaylist(qdp->uuid());
     copy->setCreated(qdp->playlist()->created());
     backup->addPlaylist(copy);
+    PlaylistJournal::playlistBackedUp(copy);
 
     if (qdp->uuid().isNull()) {
         qdp->removeAll();
     } else {
+        PlaylistJournal::playlistRemoved(qdp->uuid());
         collection->removePlaylist(qdp->uuid());
         widgets.remove(qdp->uuid());
         ui->tabWidget->removeTab(index);
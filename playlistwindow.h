@@ -3,6 +3,7 @@
 
 #include <QDockWidget>
 #include <QHash>
+#include <QSharedPointer>
 #include <QUuid>
 #include <random>
 #include "helpers.h"
@@ -12,6 +13,7 @@ class PlaylistWindow;
 }
 
 class DrawnPlaylist;
+class Playlist;
 class PlaylistSelection;
 class QThread;
 class PlaylistSearcher;
@@ -41,8 +43,9 @@ public:
     void setExtraPlayTimes(QUuid list, QUuid item, int amount);
     void deltaExtraPlayTimes(QUuid list, QUuid item, int delta);
 
-    QVariantList tabsToVList() const;
     void tabsFromVList(const QVariantList &qvl);
+    QList<QByteArray> tabsToRecords() const;
+    void tabsFromPlaylists(const QList<QSharedPointer<Playlist>> &playlists);
 
 protected:
     bool eventFilter(QObject *obj, QEvent *event);
@@ -128,6 +131,7 @@ private slots:
     void playlist_hideOnFullscreenToggled(bool checked);
     void playlist_contextMenuRequested(const QPoint &p, const QUuid &playlistUuid, const QUuid &itemUuid);
 
+    void tabBar_tabMoved(int from, int to);
     void on_tabWidget_tabCloseRequested(int index);
 
     void on_tabWidget_tabBarDoubleClicked(int index);
@@ -1,21 +1,268 @@
 #include <QStandardPaths>
+#include <QCryptographicHash>
 #include <QSettings>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QDir>
 #include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QTextStream>
 #include <QUrl>
+#include <QtEndian>
+#include <algorithm>
 #include "storage.h"
 #include "platform/unify.h"
 
+// Record files start with a magic number, the format version of the records,
+// the journal generation they were saved at, the stamp of the JSON file
+// they agree with and their count, followed by each record prefixed with
+// its length.  All of these are little endian 32-bit numbers.
+static const quint32 recordMagic = 0x5251504d;  // "MPQR"
+static const int recordHeaderSize = 20;
+
+// Journal files are named <name>.<generation>.journal, and start with a
+// magic number and the format version.  Records follow until the end of
+// the file, each prefixed with its length.
+static const quint32 journalMagic = 0x4a51504d; // "MPQJ"
+static const int journalHeaderSize = 8;
+
 QString Storage::configPath;
 
+
+
+RecordFile::~RecordFile()
+{
+    if (data)
+        file.unmap(const_cast<uchar*>(data));
+}
+
+int RecordFile::count() const
+{
+    return records.count();
+}
+
+QByteArray RecordFile::record(int index) const
+{
+    auto r = records.at(index);
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(data + r.first),
+                                   r.second);
+}
+
+int RecordFile::journalGeneration() const
+{
+    return generation;
+}
+
+bool RecordFile::open(const QString &fileName, quint32 version)
+{
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    qint64 size = file.size();
+    if (size < recordHeaderSize)
+        return false;
+    data = file.map(0, size);
+    if (!data)
+        return false;
+    if (qFromLittleEndian<quint32>(data) != recordMagic
+            || qFromLittleEndian<quint32>(data + 4) != version)
+        return false;
+
+    generation = int(qFromLittleEndian<quint32>(data + 8));
+    stamp = qFromLittleEndian<quint32>(data + 12);
+    quint32 total = qFromLittleEndian<quint32>(data + 16);
+    qint64 pos = recordHeaderSize;
+    for (quint32 i = 0; i < total; ++i) {
+        if (size - pos < 4)
+            return false;
+        quint32 length = qFromLittleEndian<quint32>(data + pos);
+        pos += 4;
+        if (quint64(size - pos) < length)
+            return false;
+        records.append({ pos, int(length) });
+        pos += length;
+    }
+    return true;
+}
+
+
+
+class JournalSyncer : public QThread
+{
+public:
+    JournalSyncer(Journal *journal) : journal(journal) {}
+
+protected:
+    void run()
+    {
+        journal->syncLoop();
+    }
+
+private:
+    Journal *journal;
+};
+
+Journal::~Journal()
+{
+    // The syncer writes out whatever is still pending before it stops.
+    if (syncer) {
+        {
+            QMutexLocker locker(&lock);
+            stopping = true;
+            wake.wakeOne();
+        }
+        syncer->wait();
+        delete syncer;
+    }
+    QMutexLocker locker(&fileLock);
+    file.close();
+}
+
+void Journal::append(const QByteArray &record)
+{
+    QByteArray data(4, Qt::Uninitialized);
+    qToLittleEndian<quint32>(quint32(record.size()), reinterpret_cast<uchar*>(data.data()));
+    data.append(record);
+
+    QMutexLocker locker(&lock);
+    pending.append(data);
+    written += data.size();
+    wake.wakeOne();
+}
+
+qint64 Journal::size()
+{
+    QMutexLocker locker(&lock);
+    return written;
+}
+
+QStringList Journal::rotate()
+{
+    // Everything appended so far is handed back, and later records go to a
+    // new file.  The caller deletes the old files when it has saved them.
+    QMutexLocker locker(&fileLock);
+    writePending();
+    older.append(file.fileName());
+    file.close();
+    start(generation + 1);
+    QStringList files;
+    files.swap(older);
+    return files;
+}
+
+int Journal::currentGeneration()
+{
+    QMutexLocker locker(&fileLock);
+    return generation;
+}
+
+void Journal::writePending()
+{
+    // Called with fileLock held, which keeps the records in order: nothing
+    // else can take pending until these are in the file.
+    QByteArray data;
+    {
+        QMutexLocker locker(&lock);
+        data.swap(pending);
+    }
+    if (data.isEmpty() || !file.isOpen())
+        return;
+    file.write(data);
+    Platform::syncFile(file);
+}
+
+void Journal::syncLoop()
+{
+    while (true) {
+        {
+            QMutexLocker locker(&lock);
+            while (pending.isEmpty() && !stopping)
+                wake.wait(&lock);
+            if (pending.isEmpty() && stopping)
+                return;
+        }
+        QMutexLocker locker(&fileLock);
+        writePending();
+    }
+}
+
+bool Journal::start(int generation)
+{
+    // Called with fileLock held, or before the syncer runs.
+    {
+        QMutexLocker locker(&lock);
+        written = journalHeaderSize;
+    }
+    this->generation = generation;
+    file.setFileName(QString("%1.%2.journal").arg(prefix).arg(generation));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    uchar header[journalHeaderSize];
+    qToLittleEndian<quint32>(journalMagic, header);
+    qToLittleEndian<quint32>(version, header + 4);
+    file.write(reinterpret_cast<char*>(header), journalHeaderSize);
+    Platform::syncFile(file);
+    return true;
+}
+
+
+
+// Writes a set of record files, and once all of them made it to disk
+// removes the journal files they supersede.
+class RecordWriter : public QRunnable
+{
+public:
+    RecordWriter(Storage *storage, const QMap<QString, QList<QByteArray>> &files,
+                 quint32 version, int generation, const QStringList &obsolete,
+                 const Storage::RecordExporter &exporter) :
+        storage(storage), files(files), version(version), generation(generation),
+        obsolete(obsolete), exporter(exporter) {}
+
+    void run()
+    {
+        for (auto it = files.constBegin(); it != files.constEnd(); ++it)
+            if (!storage->writeRecords(it.key(), version, it.value(),
+                                       generation, exporter))
+                return;
+        for (const QString &f : obsolete)
+            QFile::remove(f);
+    }
+
+private:
+    Storage *storage;
+    QMap<QString, QList<QByteArray>> files;
+    quint32 version;
+    int generation;
+    QStringList obsolete;
+    Storage::RecordExporter exporter;
+};
+
+
+
+static QList<int> journalGenerations(const QDir &dir, const QString &name)
+{
+    QList<int> generations;
+    QStringList files = dir.entryList({ name + ".*.journal" }, QDir::Files);
+    for (const QString &f : files) {
+        bool ok;
+        int generation = f.mid(name.length() + 1,
+                               f.length() - name.length() - 9).toInt(&ok);
+        if (ok)
+            generations.append(generation);
+    }
+    std::sort(generations.begin(), generations.end());
+    return generations;
+}
+
+
+
 Storage::Storage(QObject *parent) :
     QObject(parent)
 {
     QDir().mkpath(fetchConfigPath());
+    writer.setMaxThreadCount(1);
 }
 
 QString Storage::fetchConfigPath()
@@ -53,6 +300,128 @@ QVariantList Storage::readVList(QString name)
     return doc.array().toVariantList();
 }
 
+bool Storage::writeRecords(QString name, quint32 version, const QList<QByteArray> &records,
+                           int journalGeneration, const Storage::RecordExporter &exporter)
+{
+    // Only touches configPath, so this is safe to call from the writer.  The
+    // JSON file is left alone unless exporting.  Whatever it holds then has
+    // been read already, be it by the records it was exported from or on
+    // falling back to it, so it is the one the records agree with.
+    if (exporter) {
+        QVariantList qvl;
+        for (const QByteArray &r : records)
+            qvl.append(exporter(r));
+        writeVList(name, qvl);
+    }
+    quint32 stamp = jsonStamp(name);
+
+    QSaveFile file(QDir(configPath).absoluteFilePath(name + ".bin"));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    uchar header[recordHeaderSize];
+    qToLittleEndian<quint32>(recordMagic, header);
+    qToLittleEndian<quint32>(version, header + 4);
+    qToLittleEndian<quint32>(quint32(journalGeneration), header + 8);
+    qToLittleEndian<quint32>(stamp, header + 12);
+    qToLittleEndian<quint32>(quint32(records.count()), header + 16);
+    file.write(reinterpret_cast<char*>(header), recordHeaderSize);
+    for (const QByteArray &r : records) {
+        uchar length[4];
+        qToLittleEndian<quint32>(quint32(r.size()), length);
+        file.write(reinterpret_cast<char*>(length), 4);
+        file.write(r);
+    }
+    return file.commit();
+}
+
+QSharedPointer<RecordFile> Storage::readRecords(QString name, quint32 version)
+{
+    // A JSON file that doesn't match the stamp was written by an older
+    // build, so let the caller fall back to reading that instead.
+    QDir dir(configPath);
+    QSharedPointer<RecordFile> file(new RecordFile);
+    if (!file->open(dir.absoluteFilePath(name + ".bin"), version))
+        return QSharedPointer<RecordFile>();
+    if (QFileInfo::exists(dir.absoluteFilePath(name + ".json"))
+            && jsonStamp(name) != file->stamp)
+        return QSharedPointer<RecordFile>();
+    return file;
+}
+
+void Storage::writeRecordsInBackground(const QMap<QString, QList<QByteArray>> &files,
+                                       quint32 version, int journalGeneration,
+                                       const QStringList &obsolete,
+                                       const Storage::RecordExporter &exporter)
+{
+    writer.start(new RecordWriter(this, files, version, journalGeneration,
+                                  obsolete, exporter));
+}
+
+bool Storage::writingInBackground()
+{
+    return writer.activeThreadCount() > 0;
+}
+
+void Storage::waitForBackgroundWrites()
+{
+    writer.waitForDone();
+}
+
+QSharedPointer<Journal> Storage::openJournal(QString name, quint32 version)
+{
+    // Start a fresh file after any that are already there, so that the ones
+    // being read back stay untouched until they have been saved.
+    QDir dir(configPath);
+    QList<int> generations = journalGenerations(dir, name);
+    QSharedPointer<Journal> journal(new Journal);
+    journal->prefix = dir.absoluteFilePath(name);
+    journal->version = version;
+    for (int g : generations)
+        journal->older.append(QString("%1.%2.journal").arg(journal->prefix).arg(g));
+    if (!journal->start(generations.isEmpty() ? 0 : generations.last() + 1))
+        return QSharedPointer<Journal>();
+    journal->syncer = new JournalSyncer(journal.data());
+    journal->syncer->start();
+    return journal;
+}
+
+QList<QByteArray> Storage::readJournal(QString name, quint32 version,
+                                       int fromGeneration, int toGeneration)
+{
+    // A record cut short by a crash ends its file.
+    QDir dir(configPath);
+    QList<QByteArray> records;
+    for (int g : journalGenerations(dir, name)) {
+        if (g < fromGeneration || g >= toGeneration)
+            continue;
+        QFile file(dir.absoluteFilePath(QString("%1.%2.journal").arg(name).arg(g)));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QByteArray data = file.readAll();
+        const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+        if (data.size() < journalHeaderSize
+                || qFromLittleEndian<quint32>(p) != journalMagic
+                || qFromLittleEndian<quint32>(p + 4) != version)
+            continue;
+        int pos = journalHeaderSize;
+        while (data.size() - pos >= 4) {
+            quint32 length = qFromLittleEndian<quint32>(p + pos);
+            pos += 4;
+            if (quint32(data.size() - pos) < length)
+                break;
+            records.append(data.mid(pos, int(length)));
+            pos += int(length);
+        }
+    }
+    return records;
+}
+
+int Storage::nextJournalGeneration(QString name)
+{
+    QList<int> generations = journalGenerations(QDir(configPath), name);
+    return generations.isEmpty() ? 0 : generations.last() + 1;
+}
+
 QStringList Storage::readM3U(const QString &where)
 {
     QStringList items;
@@ -94,3 +463,14 @@ QJsonDocument Storage::readJsonObject(QString fname)
     QJsonDocument doc = QJsonDocument::fromJson(QTextStream(&file).readAll().toUtf8());
     return doc;
 }
+
+quint32 Storage::jsonStamp(QString name)
+{
+    // Names the contents of a JSON file, or its absence.
+    QFile file(QDir(configPath).absoluteFilePath(name + ".json"));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(&file);
+    return qFromLittleEndian<quint32>(hash.result().constData());
+}
@@ -2,6 +2,79 @@
 #define STORAGE_H
 
 #include <QObject>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <climits>
+#include <functional>
+
+// A read-only view of a binary record file.  The file is memory mapped, and
+// the records handed out point into the map, so they are only valid while
+// the RecordFile is alive.
+class RecordFile
+{
+public:
+    ~RecordFile();
+    int count() const;
+    QByteArray record(int index) const;
+    // The first journal generation whose changes are not in the records.
+    int journalGeneration() const;
+
+private:
+    friend class Storage;
+    RecordFile() {}
+    bool open(const QString &fileName, quint32 version);
+
+    QFile file;
+    const uchar *data = nullptr;
+    int generation = 0;
+    quint32 stamp = 0;
+    QVector<QPair<qint64, int>> records;
+};
+
+// An append-only log of records.  It is split into numbered files, so that
+// the older ones can be let go of once their changes are saved elsewhere.
+// Records are written and synced to disk on a thread of the journal's own,
+// and whatever is appended during one sync goes out with the next, so
+// appending never waits on the disk.
+class Journal
+{
+public:
+    ~Journal();
+    void append(const QByteArray &record);
+    qint64 size();
+    QStringList rotate();
+    int currentGeneration();
+
+private:
+    friend class Storage;
+    friend class JournalSyncer;
+    Journal() {}
+    bool start(int generation);
+    void writePending();
+    void syncLoop();
+
+    QMutex lock;                // guards pending, written and stopping
+    QWaitCondition wake;
+    QByteArray pending;
+    qint64 written = 0;
+    bool stopping = false;
+    QThread *syncer = nullptr;
+
+    QMutex fileLock;            // guards the rest
+    QFile file;
+    QString prefix;
+    quint32 version = 0;
+    int generation = 0;
+    QStringList older;
+};
 
 class Storage : public QObject
 {
@@ -16,12 +89,42 @@ public:
     void writeVList(QString name, const QVariantList &qvl);
     QVariantList readVList(QString name);
 
+    typedef std::function<QVariant(const QByteArray &)> RecordExporter;
+
+    // Records are stamped with the journal generation they were saved at, so
+    // that replaying skips the journal files they already hold.  Older
+    // builds only read the JSON files, so with an exporter the records go
+    // there as well.  Either way the record file notes which JSON file it
+    // agrees with.
+    bool writeRecords(QString name, quint32 version, const QList<QByteArray> &records,
+                      int journalGeneration = 0,
+                      const RecordExporter &exporter = nullptr);
+    // Gives nothing when the JSON file has been written by an older build
+    // since, so that the caller reads that instead.
+    QSharedPointer<RecordFile> readRecords(QString name, quint32 version);
+    void writeRecordsInBackground(const QMap<QString, QList<QByteArray>> &files,
+                                  quint32 version, int journalGeneration,
+                                  const QStringList &obsolete,
+                                  const RecordExporter &exporter = nullptr);
+    bool writingInBackground();
+    void waitForBackgroundWrites();
+
+    QSharedPointer<Journal> openJournal(QString name, quint32 version);
+    // Reads the journal files from one generation up to, but not including,
+    // another.
+    QList<QByteArray> readJournal(QString name, quint32 version,
+                                  int fromGeneration = 0,
+                                  int toGeneration = INT_MAX);
+    // The generation a journal opened now would start at.
+    int nextJournalGeneration(QString name);
+
     QStringList readM3U(const QString &where);
     void writeM3U(const QString &where, QStringList items);
 
 private:
     void writeJsonObject(QString fname, const QJsonDocument &doc);
     QJsonDocument readJsonObject(QString fname);
+    quint32 jsonStamp(QString name);
 
 signals:
 
@@ -29,6 +132,7 @@ public slots:
 
 private:
     static QString configPath;
+    QThreadPool writer;
 };
 
 #endif // STORAGE_H
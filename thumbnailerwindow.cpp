@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <cmath>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QFont>
 #include <QFontMetrics>
 #include <QOpenGLContext>
 #include <QPainter>
+#include <QTextStream>
+#include <QThread>
 #include <QTimer>
 #include "platform/unify.h"
 #include "helpers.h"
@@ -25,6 +30,7 @@ constexpr int emptySpace = pageMargin + rhsPadding;
 constexpr int pageMarginSum = pageMargin * 2;
 constexpr int thumbShadow = 4;
 constexpr int timerWaitMsec = 500;
+constexpr int stallTimeoutMsec = 30000;
 constexpr int osdFontSize = 12;
 constexpr int osdFontShadow = 2;
 
@@ -33,6 +39,7 @@ ThumbnailerWindow::ThumbnailerWindow(QWidget *parent) :
     ui(new Ui::ThumbnailerWindow)
 {
     ui->setupUi(this);
+    ui->decoderInstances->setValue(QThread::idealThreadCount());
     connect(ui->actionGo, &QPushButton::clicked,
             this, &ThumbnailerWindow::begin);
 
@@ -103,6 +110,8 @@ void ThumbnailerWindow::begin()
     p.imageWidth = ui->imageWidth->value();
     p.cols = ui->layoutColumns->value();
     p.rows = ui->layoutRow->value();
+    p.instances = ui->decoderInstances->value();
+    p.rawCapture = ui->rawCapture->isChecked();
     thumbnailer->execute(p);
 
 }
@@ -115,22 +124,299 @@ MpvThumbnailer::MpvThumbnailer(QObject *parent)
 
 MpvThumbnailer::~MpvThumbnailer()
 {
-    deinitPlayer();
+    qDeleteAll(workers);
+    workers.clear();
 }
 
 void MpvThumbnailer::execute(const MpvThumbnailer::Params &p)
 {
-    if (thumbState != AvailableState) {
+    if (!workers.isEmpty()) {
         Logger::log(logModule, "tried to start with an already started thumbnailer");
         return;
     }
+    this->p = p;
+    int total = p.rows * p.cols;
+    int instances = qBound(1, p.instances, total);
+    LogStream(logModule) << "starting thumbnailing process for " << p.sourceUrl
+                         << " with " << instances << " instances";
+
+    thumbs = QVector<ThumbPts>(total, ThumbPts { 0, 0, 0.0, 0, QImage() });
+    thumbsDone = 0;
+    info = { 0, {-1,-1}, -1, {} };
+    runningWorkers = instances;
+    workersComplete = true;
+    for (int i = 0; i < instances; i++) {
+        auto worker = new MpvThumbnailWorker(this, i, instances);
+        connect(worker, &MpvThumbnailWorker::fileInfo,
+                this, &MpvThumbnailer::worker_fileInfo);
+        connect(worker, &MpvThumbnailWorker::thumbReady,
+                this, &MpvThumbnailer::worker_thumbReady);
+        connect(worker, &MpvThumbnailWorker::finished,
+                this, &MpvThumbnailer::worker_finished);
+        workers.append(worker);
+        worker->execute(p);
+    }
+    emit progress(0);
+}
+
+void MpvThumbnailer::renderImage()
+{
+    Logger::log(logModule, "rendering thumbnail image");
+
+    QFont blurbFont("Helvetica", 12);
+    QFontMetrics blurbMetrics(blurbFont);
+    QString blurb = "File Name: %1\n" "File Size: %2\n" "Resolution: %3x%4\n" "Duration: %5";
+    blurb = blurb.arg(p.sourceUrl.fileName(),
+                      Helpers::fileSizeToString(info.fileSize),
+                      QString::number(info.videoSize.width()),
+                      QString::number(info.videoSize.height()),
+                      Helpers::toDateFormat(info.duration));
+
+    // Calculate blurb size and therefore caption area
+    QRect oversizeRect = QRect(0, 0, p.imageWidth, p.imageWidth);
+    QRect blurbRect = blurbMetrics.boundingRect(oversizeRect, 0, blurb);
+    QRect captionArea = QRect(pageMargin, 0,
+                              p.imageWidth - pageMarginSum,
+                              blurbRect.height() + pageMargin + captionPadding);
+
+    // Calculate size of self label to fit the caption area
+    QFont selfFont("Helvetica", 1000, QFont::Black);
+    QFontMetrics selfMetrics1000(selfFont);
+    selfFont.setPixelSize((captionArea.height() - (pageMargin + captionPadding))
+                          * selfMetrics1000.height() / selfMetrics1000.ascent());
+    QFontMetrics selfMetrics(selfFont);
+    QString self = "MPC-QT";
+    QRect selfRect = captionArea.adjusted(0, -selfMetrics.descent(),
+                                          -pageMargin, selfMetrics.descent()*2);
+
+    // Create new image with size.
+    // h = captionbottom + margin-thumbmargin + (thumb+thumbmargin)*rows
+    QSize imageSize(p.imageWidth, captionArea.bottom() + rhsPadding +
+                    ((info.thumbSize.height()+ thumbMargin) * p.rows));
+    render = QImage(imageSize, QImage::Format_RGB32);
+    render.fill(QColor(0xef, 0xee, 0xec));
+    QPainter p(&render);
+
+    // Draw texts
+    p.setPen(QColor(0xfc, 0xfb, 0xfa));
+    p.setFont(selfFont);
+    p.drawText(selfRect, Qt::AlignRight | Qt::AlignVCenter, self);
+
+    p.setPen(QColor(0x10, 0x0f, 0x0d));
+    p.setFont(blurbFont);
+    p.drawText(blurbRect.translated(pageMargin, pageMargin), 0, blurb);
+
+    // Draw thumbnails
+    for (auto &t : thumbs) {
+        if (t.thumb.isNull())
+            continue;
+        QRectF rc({int(t.x) + 0.5, int(t.y) + 0.5}, t.thumb.size());
+        rc.translate(pageMargin, captionArea.bottom());
+        p.fillRect(rc.translated(thumbShadow, thumbShadow), {0xbc, 0xbb, 0xba});
+        p.fillRect(rc.adjusted(-1,-1,1,1), {0x8c, 0x8b, 0x8a});
+        p.drawImage(rc.topLeft().toPoint(), t.thumb);
+    }
+}
+
+bool MpvThumbnailer::saveImage()
+{
+    LogStream(logModule) << "saving thumbnails to " << p.imageFile;
+    bool saved = render.save(p.imageFile, nullptr, p.jpegQuality);
+    if (!saved)
+        Logger::log(logModule, "file was not saved. Is the filename correct?");
+    render = QImage();
+    return saved;
+}
+
+void MpvThumbnailer::worker_fileInfo(const MpvThumbnailer::FileInfo &info)
+{
+    // Every instance opens the same file, so the first to know will do.
+    if (this->info.duration < 0)
+        this->info = info;
+}
+
+void MpvThumbnailer::worker_thumbReady(const MpvThumbnailer::ThumbPts &thumb)
+{
+    if (thumb.index < 1 || thumb.index > thumbs.size())
+        return;
+    thumbs[thumb.index - 1] = thumb;
+    ++thumbsDone;
+    emit progress(thumbsDone * 100 / thumbs.size());
+}
+
+void MpvThumbnailer::worker_finished(bool complete)
+{
+    // A sheet with holes in it is not saved.
+    workersComplete = workersComplete && complete;
+    if (--runningWorkers > 0)
+        return;
+    bool saved = false;
+    if (!workersComplete) {
+        LogStream(logModule) << "gave up on thumbnails for " << p.sourceUrl;
+    } else if (thumbsDone > 0) {
+        renderImage();
+        saved = saveImage();
+    } else {
+        Logger::log(logModule, "no thumbnails were taken");
+    }
+    for (auto worker : workers)
+        worker->deleteLater();
+    workers.clear();
+    thumbs.clear();
+    emit finished(saved);
+}
+
+
+
+ThumbnailBatch::ThumbnailBatch(QObject *parent)
+    : QObject(parent)
+{
+
+}
+
+ThumbnailBatch::~ThumbnailBatch()
+{
+    for (auto &job : jobs)
+        delete job.thumbnailer;
+    jobs.clear();
+}
+
+void ThumbnailBatch::execute(const QList<QUrl> &sources, const ThumbnailBatch::Params &p)
+{
+    this->p = p;
+    pending.clear();
+    outputFiles.clear();
+    for (const QUrl &url : sources)
+        pending.enqueue(url);
+    filesDone = 0;
+    filesFailed = 0;
+    fileTime = 0;
+    batchClock.start();
+
+    int count = qBound(1, p.jobs, qMax(1, pending.size()));
+    for (int i = 0; i < count; i++) {
+        auto thumbnailer = new MpvThumbnailer(this);
+        connect(thumbnailer, &MpvThumbnailer::finished,
+                this, [this, thumbnailer](bool saved) {
+            thumbnailer_finished(thumbnailer, saved);
+        }, Qt::QueuedConnection);
+        jobs.append({ thumbnailer, QUrl(), QElapsedTimer() });
+    }
+    runningJobs = 0;
+    for (auto &job : jobs)
+        if (startNext(job))
+            ++runningJobs;
+    if (!runningJobs)
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+}
+
+int ThumbnailBatch::failures() const
+{
+    return filesFailed;
+}
+
+bool ThumbnailBatch::startNext(ThumbnailBatch::Job &job)
+{
+    if (pending.isEmpty())
+        return false;
+    job.source = pending.dequeue();
+    MpvThumbnailer::Params sheet = p.sheet;
+    sheet.sourceUrl = job.source;
+    sheet.imageFile = outputFile(job.source);
+    job.clock.start();
+    job.thumbnailer->execute(sheet);
+    return true;
+}
+
+QString ThumbnailBatch::outputFile(const QUrl &source)
+{
+    // Sheets go next to their file unless told otherwise.  Streams have no
+    // folder of their own, so theirs go in the current one.  The name keeps
+    // the file's extension, and is numbered when another file of the batch
+    // already has it, so that no sheet is written over another.
+    QString name = QFileInfo(source.path()).fileName();
+    if (name.isEmpty())
+        name = source.host();
+    name = Platform::sanitizedFilename(name + "_thumbs");
+    QString folder = p.outputDirectory;
+    if (folder.isEmpty())
+        folder = source.isLocalFile() ? QFileInfo(source.toLocalFile()).absolutePath()
+                                      : QDir::currentPath();
+    QDir().mkpath(folder);
+    QString file = folder + "/" + name + "." + p.outputFormat;
+    for (int i = 2; outputFiles.contains(file); i++)
+        file = QString("%1/%2_%3.%4").arg(folder, name, QString::number(i), p.outputFormat);
+    outputFiles.insert(file);
+    return file;
+}
+
+void ThumbnailBatch::thumbnailer_finished(MpvThumbnailer *thumbnailer, bool saved)
+{
+    auto job = std::find_if(jobs.begin(), jobs.end(), [thumbnailer](const Job &j) {
+        return j.thumbnailer == thumbnailer;
+    });
+    if (job == jobs.end())
+        return;
+
+    qint64 elapsed = job->clock.elapsed();
+    ++filesDone;
+    fileTime += elapsed;
+    if (!saved)
+        ++filesFailed;
+    QTextStream(stdout) << QString("thumbnails: %1 s %2 %3\n")
+                           .arg(elapsed / 1000.0, 7, 'f', 2)
+                           .arg(saved ? "ok    " : "failed")
+                           .arg(job->source.toDisplayString(QUrl::PreferLocalFile));
+
+    if (startNext(*job) || --runningJobs > 0)
+        return;
+
+    double wall = batchClock.elapsed() / 1000.0;
+    QTextStream(stdout) << QString("thumbnails: %1 files (%2 failed) in %3 s, "
+                                   "%4 files/min, %5 s per file, %6x parallel\n")
+                           .arg(filesDone).arg(filesFailed)
+                           .arg(wall, 0, 'f', 2)
+                           .arg(wall > 0 ? filesDone * 60.0 / wall : 0.0, 0, 'f', 1)
+                           .arg(filesDone ? fileTime / 1000.0 / filesDone : 0.0, 0, 'f', 2)
+                           .arg(wall > 0 ? fileTime / 1000.0 / wall : 0.0, 0, 'f', 2);
+    emit finished();
+}
+
+
+
+MpvThumbnailWorker::MpvThumbnailWorker(QObject *parent, int slot, int slotCount)
+    : QObject(parent), slot(slot), slotCount(slotCount)
+{
+    // A file that stops making progress, e.g. one mpv never gets a frame
+    // out of, is given up on rather than holding up the rest.
+    stallTimer = new QTimer(this);
+    stallTimer->setSingleShot(true);
+    stallTimer->setInterval(stallTimeoutMsec);
+    connect(stallTimer, &QTimer::timeout,
+            this, &MpvThumbnailWorker::stallTimer_timeout);
+}
+
+MpvThumbnailWorker::~MpvThumbnailWorker()
+{
+    deinitPlayer();
+}
+
+void MpvThumbnailWorker::execute(const MpvThumbnailer::Params &p)
+{
+    if (thumbState != AvailableState) {
+        Logger::log(logModule, "tried to start with an already started worker");
+        return;
+    }
     thumbState = StartedState;
 
-    initPlayer();
-    LogStream(logModule) << "starting thumbnailing process for " << p.sourceUrl;
     this->p = p;
+    initPlayer();
     pendingPts.clear();
-    processedPts.clear();
+    stallTimer->start();
+
+    // Raw captures come straight from the decoder, so no output is needed.
+    if (p.rawCapture)
+        emit mpv->ctrlSetOptionVariant("vo", "null");
 
     emit mpv->ctrlSetOptionVariant("profile", "gpu-hq");
     emit mpv->ctrlSetOptionVariant("blend-subtitles", "video");
@@ -147,31 +433,36 @@ void MpvThumbnailer::execute(const MpvThumbnailer::Params &p)
     emit mpv->ctrlSetOptionVariant("fps", 200);
     mpv->urlOpen(p.sourceUrl);
     mpv->setPaused(true);
-    emit progress(0);
 }
 
-void MpvThumbnailer::initPlayer()
+void MpvThumbnailWorker::initPlayer()
 {
     mpv = new MpvObject(this, friendlyName);
-    thumbnailer = new MpvThumbnailDrawer(mpv);
-    mpv->setWidgetType(Helpers::CustomWidget, thumbnailer);
+    if (!p.rawCapture) {
+        thumbnailer = new MpvThumbnailDrawer(mpv);
+        mpv->setWidgetType(Helpers::CustomWidget, thumbnailer);
+    }
     connect(mpv, &MpvObject::fileSizeChanged,
-            this, &MpvThumbnailer::mpv_fileSizeChanged);
+            this, &MpvThumbnailWorker::mpv_fileSizeChanged);
     connect(mpv, &MpvObject::playbackFinished,
-            this, &MpvThumbnailer::mpv_playbackFinished);
+            this, &MpvThumbnailWorker::mpv_playbackFinished);
     connect(mpv, &MpvObject::playbackIdling,
-            this, &MpvThumbnailer::mpv_playbackIdling);
+            this, &MpvThumbnailWorker::mpv_playbackIdling);
     connect(mpv, &MpvObject::playLengthChanged,
-            this, &MpvThumbnailer::mpv_playLengthChanged);
+            this, &MpvThumbnailWorker::mpv_playLengthChanged);
     connect(mpv, &MpvObject::playTimeChanged,
-            this, &MpvThumbnailer::mpv_playTimeChanged);
+            this, &MpvThumbnailWorker::mpv_playTimeChanged);
     connect(mpv, &MpvObject::videoSizeChanged,
-            this, &MpvThumbnailer::mpv_videoSizeChanged);
-    thumbnailer->setAttribute(Qt::WA_DontShowOnScreen);
-    thumbnailer->show();
+            this, &MpvThumbnailWorker::mpv_videoSizeChanged);
+    connect(mpv, &MpvObject::tracksChanged,
+            this, &MpvThumbnailWorker::mpv_tracksChanged);
+    if (thumbnailer) {
+        thumbnailer->setAttribute(Qt::WA_DontShowOnScreen);
+        thumbnailer->show();
+    }
 }
 
-void MpvThumbnailer::deinitPlayer()
+void MpvThumbnailWorker::deinitPlayer()
 {
     if (!mpv)
         return;
@@ -182,41 +473,81 @@ void MpvThumbnailer::deinitPlayer()
     mpv = nullptr;
 }
 
-void MpvThumbnailer::initThumbPts()
+void MpvThumbnailWorker::stop(bool complete)
+{
+    if (!mpv)
+        return;
+    stallTimer->stop();
+    deinitPlayer();
+    pendingPts.clear();
+    thumbState = AvailableState;
+    emit finished(complete);
+}
+
+void MpvThumbnailWorker::initThumbPts()
 {
     int total = p.rows * p.cols;
-    int index = 1;
     int dx = (p.imageWidth - emptySpace)/p.cols;
     int dy = thumbSize.height() + thumbMargin;
 
     pendingPts.clear();
-    processedPts.clear();
-    for (int r = 0; r < p.rows; r++) {
-        for (int c = 0; c < p.cols; c++) {
-            pendingPts.enqueue({c*dx, r*dy,
-                                (mpvDuration * index) / (total+1),
-                                index * 100 / total, index,
-                                QImage()});
-            index++;
-        }
+    for (int index = slot + 1; index <= total; index += slotCount) {
+        int r = (index - 1) / p.cols;
+        int c = (index - 1) % p.cols;
+        pendingPts.enqueue({c*dx, r*dy,
+                            (mpvDuration * index) / (total+1),
+                            index, QImage()});
     }
 }
 
-void MpvThumbnailer::processThumb()
+void MpvThumbnailWorker::startThumbs()
+{
+    initThumbPts();
+    emit fileInfo({ mpvFileSize, mpvVideoSize, mpvDuration, thumbSize });
+    nextThumb();
+}
+
+void MpvThumbnailWorker::processThumb()
 {
     if (pendingPts.isEmpty()) {
         Logger::log(logModule, "tried to process a thumb but there's nothing here");
         return;
     }
-    ThumbPts &front = pendingPts.front();
+    MpvThumbnailer::ThumbPts &front = pendingPts.front();
     LogStream(logModule) << "Processing slide " << front.index
-                         << "(" << front.percent << "%)";
-    emit progress(front.percent);
+                         << " on instance " << slot;
     front.thumb = thumbnailer->grabFramebuffer();
-    processedPts.enqueue(pendingPts.dequeue());
+    emit thumbReady(pendingPts.dequeue());
 }
 
-bool MpvThumbnailer::seekNextFrame()
+void MpvThumbnailWorker::captureRawThumb()
+{
+    if (pendingPts.isEmpty()) {
+        Logger::log(logModule, "tried to capture a thumb but there's nothing here");
+        return;
+    }
+    MpvThumbnailer::ThumbPts thumb = pendingPts.dequeue();
+    LogStream(logModule) << "Capturing slide " << thumb.index
+                         << " on instance " << slot;
+    mpv->grabRawFrame(thumbSize, [this, thumb](QImage image) mutable {
+        if (image.isNull())
+            Logger::log(logModule, "raw capture failed");
+        else
+            drawTimestamp(image, thumb.pts);
+        thumb.thumb = image;
+        emit thumbReady(thumb);
+        nextThumb();
+    });
+}
+
+void MpvThumbnailWorker::nextThumb()
+{
+    stallTimer->start();
+    if (!seekNextFrame())
+        mpv->stopPlayback();
+}
+
+bool MpvThumbnailWorker::seekNextFrame()
 {
     if (pendingPts.isEmpty())
         return false;
@@ -227,77 +558,12 @@ bool MpvThumbnailer::seekNextFrame()
     return true;
 }
 
-void MpvThumbnailer::renderImage()
-{
-    Logger::log(logModule, "rendering thumbnail image");
-
-    QFont blurbFont("Helvetica", 12);
-    QFontMetrics blurbMetrics(blurbFont);
-    QString blurb = "File Name: %1\n" "File Size: %2\n" "Resolution: %3x%4\n" "Duration: %5";
-    blurb = blurb.arg(p.sourceUrl.fileName(),
-                      Helpers::fileSizeToString(mpvFileSize),
-                      QString::number(mpvVideoSize.width()),
-                      QString::number(mpvVideoSize.height()),
-                      Helpers::toDateFormat(mpvDuration));
-
-    // Calculate blurb size and therefore caption area
-    QRect oversizeRect = QRect(0, 0, p.imageWidth, p.imageWidth);
-    QRect blurbRect = blurbMetrics.boundingRect(oversizeRect, 0, blurb);
-    QRect captionArea = QRect(pageMargin, 0,
-                              p.imageWidth - pageMarginSum,
-                              blurbRect.height() + pageMargin + captionPadding);
-
-    // Calculate size of self label to fit the caption area
-    QFont selfFont("Helvetica", 1000, QFont::Black);
-    QFontMetrics selfMetrics1000(selfFont);
-    selfFont.setPixelSize((captionArea.height() - (pageMargin + captionPadding))
-                          * selfMetrics1000.height() / selfMetrics1000.ascent());
-    QFontMetrics selfMetrics(selfFont);
-    QString self = "MPC-QT";
-    QRect selfRect = captionArea.adjusted(0, -selfMetrics.descent(),
-                                          -pageMargin, selfMetrics.descent()*2);
-
-    // Create new image with size.
-    // h = captionbottom + margin-thumbmargin + (thumb+thumbmargin)*rows
-    QSize imageSize(p.imageWidth, captionArea.bottom() + rhsPadding +
-                    ((thumbSize.height()+ thumbMargin) * p.rows));
-    render = QImage(imageSize, QImage::Format_RGB32);
-    render.fill(QColor(0xef, 0xee, 0xec));
-    QPainter p(&render);
-
-    // Draw texts
-    p.setPen(QColor(0xfc, 0xfb, 0xfa));
-    p.setFont(selfFont);
-    p.drawText(selfRect, Qt::AlignRight | Qt::AlignVCenter, self);
-
-    p.setPen(QColor(0x10, 0x0f, 0x0d));
-    p.setFont(blurbFont);
-    p.drawText(blurbRect.translated(pageMargin, pageMargin), 0, blurb);
-
-    // Draw thumbnails
-    for (auto &t : processedPts) {
-        QRectF rc({int(t.x) + 0.5, int(t.y) + 0.5}, t.thumb.size());
-        rc.translate(pageMargin, captionArea.bottom());
-        p.fillRect(rc.translated(thumbShadow, thumbShadow), {0xbc, 0xbb, 0xba});
-        p.fillRect(rc.adjusted(-1,-1,1,1), {0x8c, 0x8b, 0x8a});
-        p.drawImage(rc.topLeft().toPoint(), t.thumb);
-    }
-}
-
-void MpvThumbnailer::saveImage()
-{
-    LogStream(logModule) << "saving thumbnails to " << p.imageFile;
-    if (!render.save(p.imageFile, nullptr, p.jpegQuality))
-        Logger::log(logModule, "file was not saved. Is the filename correct?");
-    render.detach();
-}
-
-void MpvThumbnailer::mpv_fileSizeChanged(int64_t bytes)
+void MpvThumbnailWorker::mpv_fileSizeChanged(int64_t bytes)
 {
     mpvFileSize = bytes;
 }
 
-void MpvThumbnailer::mpv_videoSizeChanged(QSize video)
+void MpvThumbnailWorker::mpv_videoSizeChanged(QSize video)
 {
     mpvVideoSize = video;
     if (mpvVideoSize == QSize(-1,-1))
@@ -310,7 +576,8 @@ void MpvThumbnailer::mpv_videoSizeChanged(QSize video)
     int h = int(availPx / aRatio + 0.5);
     int w = int(h * aRatio + 0.5);
     thumbSize = QSize(w, h);
-    thumbnailer->resize(thumbSize);
+    if (thumbnailer)
+        thumbnailer->resize(thumbSize);
 
     // Set a consistent size for the osd message
     double factor = safeDiv(mpvVideoSize.height(), h);
@@ -320,19 +587,18 @@ void MpvThumbnailer::mpv_videoSizeChanged(QSize video)
     if (thumbState == StaleState) {
         // video size was not valid at first navigation,
         // so initialize our stuff now.
-        initThumbPts();
-        seekNextFrame();
+        startThumbs();
     }
 }
 
-void MpvThumbnailer::mpv_playLengthChanged(double length)
+void MpvThumbnailWorker::mpv_playLengthChanged(double length)
 {
     mpvDuration = length;
     osdTimeFormat = length < 3600.0 ? Helpers::ShortHourFormat
                                     : Helpers::ShortFormat;
 }
 
-void MpvThumbnailer::mpv_playTimeChanged(double time)
+void MpvThumbnailWorker::mpv_playTimeChanged(double time)
 {
     // This function is called:
     // * Once at file open with timestamp 0
@@ -358,8 +624,7 @@ void MpvThumbnailer::mpv_playTimeChanged(double time)
             thumbState = StaleState;
             return;
         }
-        initThumbPts();
-        seekNextFrame();
+        startThumbs();
         return;
     }
 
@@ -371,33 +636,73 @@ void MpvThumbnailer::mpv_playTimeChanged(double time)
 
     if (thumbState == PlayingState) {
         thumbState = WaitingForTimer;
-        QTimer::singleShot(timerWaitMsec, this, &MpvThumbnailer::timer_navigateTick);
+        QTimer::singleShot(timerWaitMsec, this, &MpvThumbnailWorker::timer_navigateTick);
     }
 }
 
-void MpvThumbnailer::mpv_playbackFinished()
+void MpvThumbnailWorker::mpv_playbackFinished()
 {
     thumbState = FinishedState;
 }
 
-void MpvThumbnailer::mpv_playbackIdling()
+void MpvThumbnailWorker::mpv_playbackIdling()
 {
+    // mpv idles once before the file is opened, too.
     if (thumbState != FinishedState)
         return;
-    deinitPlayer();
+    stop(pendingPts.isEmpty());
+}
+
+void MpvThumbnailWorker::mpv_tracksChanged(const QVariantList &tracks)
+{
+    // Files without video never get a video size, so they are noticed here.
+    // Cover art does not count.
+    if (tracks.isEmpty() || thumbState == AvailableState)
+        return;
+    for (const QVariant &v : tracks) {
+        QVariantMap track = v.toMap();
+        if (track["type"] == "video" && !track["albumart"].toBool())
+            return;
+    }
+    // The player is still busy sending this, so it goes away afterwards.
+    LogStream(logModule) << "no video in " << p.sourceUrl << " on instance " << slot;
     thumbState = AvailableState;
-    emit finished();
+    QTimer::singleShot(0, this, [this]() { stop(false); });
 }
 
-void MpvThumbnailer::timer_navigateTick()
+void MpvThumbnailWorker::timer_navigateTick()
 {
-    processThumb();
-    if (seekNextFrame())
+    if (!mpv)
+        return;
+    if (p.rawCapture) {
+        captureRawThumb();
         return;
+    }
+    processThumb();
+    nextThumb();
+}
+
+void MpvThumbnailWorker::stallTimer_timeout()
+{
+    LogStream(logModule) << "timed out on " << p.sourceUrl << " on instance " << slot;
+    stop(false);
+}
 
-    renderImage();
-    saveImage();
-    mpv->stopPlayback();
+void MpvThumbnailWorker::drawTimestamp(QImage &image, double pts)
+{
+    // Raw captures have no osd, so the time is drawn in its place.
+    QFont font("Helvetica");
+    font.setPixelSize(osdFontSize);
+    font.setBold(true);
+    QString text = Helpers::toDateFormatFixed(pts, osdTimeFormat);
+    QRect area = image.rect().adjusted(0, 0, -osdFontShadow * 2, -osdFontShadow);
+    QPainter painter(&image);
+    painter.setFont(font);
+    painter.setPen(QColor(0, 0, 0, 0x80));
+    painter.drawText(area.translated(osdFontShadow, osdFontShadow),
+                     Qt::AlignRight | Qt::AlignBottom, text);
+    painter.setPen(QColor(0xff, 0xff, 0xff, 0x80));
+    painter.drawText(area, Qt::AlignRight | Qt::AlignBottom, text);
 }
 
 
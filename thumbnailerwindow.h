@@ -1,10 +1,13 @@
 #ifndef THUMBNAILERWINDOW_H
 #define THUMBNAILERWINDOW_H
 
+#include <QElapsedTimer>
 #include <QImage>
 #include <QOpenGLWidget>
 #include <QWidget>
 #include <QQueue>
+#include <QSet>
+#include <QVector>
 #include <QUrl>
 #include "mpvwidget.h"
 
@@ -13,6 +16,7 @@ class ThumbnailerWindow;
 }
 class MpvThumbnailDrawer;
 class MpvThumbnailer;
+class MpvThumbnailWorker;
 
 class ThumbnailerWindow : public QWidget
 {
@@ -40,32 +44,33 @@ private:
     QString screenshotFormat = "png";
 };
 
+// MpvThumbnailer splits the thumbnails of a sheet between several mpv
+// instances, and assembles what they grab by index.
 class MpvThumbnailer : public QObject {
     Q_OBJECT
 
-    enum ThumbnailingState {
-        AvailableState, // Available for use
-        StartedState,   // File opened
-        StaleState,     // File opened, but no video size yet
-        SeekingState,   // Seek command sent
-        PlayingState,   // Playing video until frozen
-        WaitingForTimer, // Waiting for snapshot timer
-        FinishedState   // Playback finished
+public:
+    struct Params {
+        QUrl sourceUrl;
+        QString imageFile;
+        int jpegQuality, imageWidth;
+        int cols, rows;
+        int instances;
+        bool rawCapture;
     };
 
     struct ThumbPts {
         int x, y;
         double pts;
-        int percent, index;
+        int index;
         QImage thumb;
     };
 
-public:
-    struct Params {
-        QUrl sourceUrl;
-        QString imageFile;
-        int jpegQuality, imageWidth;
-        int cols, rows;
+    struct FileInfo {
+        int64_t fileSize;
+        QSize videoSize;
+        double duration;
+        QSize thumbSize;
     };
 
     explicit MpvThumbnailer(QObject *parent);
@@ -74,17 +79,114 @@ public:
 
 signals:
     void progress(int percent);
+    void finished(bool saved);
+
+private:
+    void renderImage();
+    bool saveImage();
+
+private slots:
+    void worker_fileInfo(const MpvThumbnailer::FileInfo &info);
+    void worker_thumbReady(const MpvThumbnailer::ThumbPts &thumb);
+    void worker_finished(bool complete);
+
+private:
+    Params p;
+    QList<MpvThumbnailWorker*> workers;
+    int runningWorkers = 0;
+    bool workersComplete = true;
+    int thumbsDone = 0;
+    QVector<ThumbPts> thumbs;
+    FileInfo info = { 0, {-1,-1}, -1, {} };
+    QImage render;
+};
+
+
+// ThumbnailBatch makes a sheet for each of a list of files without any
+// windows, running a fixed number of thumbnailers at a time.  It prints how
+// long each file took, and the overall throughput when done.
+class ThumbnailBatch : public QObject {
+    Q_OBJECT
+
+public:
+    struct Params {
+        MpvThumbnailer::Params sheet;
+        QString outputDirectory;
+        QString outputFormat;
+        int jobs;
+    };
+
+    explicit ThumbnailBatch(QObject *parent = nullptr);
+    ~ThumbnailBatch();
+    void execute(const QList<QUrl> &sources, const Params &p);
+    int failures() const;
+
+signals:
     void finished();
 
+private:
+    struct Job {
+        MpvThumbnailer *thumbnailer;
+        QUrl source;
+        QElapsedTimer clock;
+    };
+
+    bool startNext(Job &job);
+    QString outputFile(const QUrl &source);
+
+private slots:
+    void thumbnailer_finished(MpvThumbnailer *thumbnailer, bool saved);
+
+private:
+    Params p;
+    QQueue<QUrl> pending;
+    QSet<QString> outputFiles;
+    QList<Job> jobs;
+    int runningJobs = 0;
+    int filesDone = 0;
+    int filesFailed = 0;
+    qint64 fileTime = 0;
+    QElapsedTimer batchClock;
+};
+
+
+// MpvThumbnailWorker drives one mpv instance through its share of a sheet:
+// the thumbnails whose index falls on its slot.
+class MpvThumbnailWorker : public QObject {
+    Q_OBJECT
+
+    enum ThumbnailingState {
+        AvailableState, // Available for use
+        StartedState,   // File opened
+        StaleState,     // File opened, but no video size yet
+        SeekingState,   // Seek command sent
+        PlayingState,   // Playing video until frozen
+        WaitingForTimer, // Waiting for snapshot timer
+        FinishedState   // Playback finished
+    };
+
+public:
+    MpvThumbnailWorker(QObject *parent, int slot, int slotCount);
+    ~MpvThumbnailWorker();
+    void execute(const MpvThumbnailer::Params &p);
+
+signals:
+    void fileInfo(const MpvThumbnailer::FileInfo &info);
+    void thumbReady(const MpvThumbnailer::ThumbPts &thumb);
+    void finished(bool complete);
+
 private:
     void initPlayer();
     void deinitPlayer();
+    void stop(bool complete);
 
     void initThumbPts();
+    void startThumbs();
     void processThumb();
+    void captureRawThumb();
+    void nextThumb();
     bool seekNextFrame();
-    void renderImage();
-    void saveImage();
+    void drawTimestamp(QImage &image, double pts);
 
 private slots:
     void mpv_fileSizeChanged(int64_t bytes);
@@ -93,12 +195,17 @@ private slots:
     void mpv_playTimeChanged(double time);
     void mpv_playbackFinished();
     void mpv_playbackIdling();
+    void mpv_tracksChanged(const QVariantList &tracks);
     void timer_navigateTick();
+    void stallTimer_timeout();
 
 private:
-    Params p;
+    MpvThumbnailer::Params p;
+    int slot = 0;
+    int slotCount = 1;
     MpvObject *mpv = nullptr;
     MpvThumbnailDrawer *thumbnailer = nullptr;
+    QTimer *stallTimer = nullptr;
 
     ThumbnailingState thumbState = AvailableState;
     double mpvTime = -1;
@@ -106,9 +213,7 @@ private:
     Helpers::TimeFormat osdTimeFormat = Helpers::ShortFormat;
     int64_t mpvFileSize = 0;
     QSize mpvVideoSize = {-1,-1};
-    QQueue<ThumbPts> pendingPts;
-    QQueue<ThumbPts> processedPts;
-    QImage render;
+    QQueue<MpvThumbnailer::ThumbPts> pendingPts;
     QSize thumbSize;
 };
 